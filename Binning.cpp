@@ -0,0 +1,171 @@
+// C++
+#include <algorithm>
+
+// C
+#include <assert.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BINNING_X86
+#include <immintrin.h>
+#endif
+
+// Self
+#include "Binning.h"
+
+// Samples lie within the tile, so positions are nonnegative and truncating them gives the same bin as floor.
+// Accumulation mirrors DataAccumulator<double>'s plus_equals operation by operation, including squaring the
+// float stddev as a float, so every kernel's results are bit-identical.
+
+/// Samples whose bin ids are computed together, before their runs are accumulated
+static const unsigned BLOCK_SIZE = 256;
+
+static void compute_bins_scalar(const DataSample<double> *samples, unsigned n, double start, double scale,
+                                int *bins) {
+  for (unsigned i = 0; i < n; i++) bins[i] = (int) ((samples[i].time - start) * scale);
+}
+
+static void accumulate_scalar(const DataSample<double> *samples, const int *bins, unsigned n,
+                              std::vector<DataAccumulator<double> > &accumulators) {
+  unsigned i = 0;
+  while (i < n) {
+    int bin = bins[i];
+    assert((unsigned) bin < accumulators.size());
+    DataAccumulator<double> acc = accumulators[bin];
+    for (; i < n && bins[i] == bin; i++) acc += samples[i];
+    accumulators[bin] = acc;
+  }
+}
+
+#ifdef BINNING_X86
+
+__attribute__((target("sse2")))
+static void compute_bins_sse2(const DataSample<double> *samples, unsigned n, double start, double scale,
+                              int *bins) {
+  __m128d start2 = _mm_set1_pd(start), scale2 = _mm_set1_pd(scale);
+  unsigned i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d times = _mm_set_pd(samples[i + 1].time, samples[i].time);
+    __m128i ids = _mm_cvttpd_epi32(_mm_mul_pd(_mm_sub_pd(times, start2), scale2));
+    _mm_storel_epi64((__m128i*) (bins + i), ids);
+  }
+  compute_bins_scalar(samples + i, n - i, start, scale, bins + i);
+}
+
+/// Accumulate with (timesum, sum) and (sumsq, weight) each in one register
+__attribute__((target("sse2")))
+static void accumulate_sse2(const DataSample<double> *samples, const int *bins, unsigned n,
+                            std::vector<DataAccumulator<double> > &accumulators) {
+  unsigned i = 0;
+  while (i < n) {
+    int bin = bins[i];
+    assert((unsigned) bin < accumulators.size());
+    DataAccumulator<double> &acc = accumulators[bin];
+    __m128d timesum_sum = _mm_set_pd(acc.sum, acc.timesum);
+    __m128d sumsq_weight = _mm_set_pd(acc.weight, acc.sumsq);
+    for (; i < n && bins[i] == bin; i++) {
+      const DataSample<double> &sample = samples[i];
+      if (sample.weight == 0) continue;
+      __m128d weight = _mm_set1_pd(sample.weight);
+      float stddev_squared = sample.stddev * sample.stddev;
+      timesum_sum = _mm_add_pd(timesum_sum, _mm_mul_pd(_mm_set_pd(sample.value, sample.time), weight));
+      sumsq_weight = _mm_add_pd(sumsq_weight,
+                                _mm_mul_pd(_mm_set_pd(1.0, stddev_squared + sample.value * sample.value), weight));
+    }
+    _mm_storel_pd(&acc.timesum, timesum_sum);
+    _mm_storeh_pd(&acc.sum, timesum_sum);
+    _mm_storel_pd(&acc.sumsq, sumsq_weight);
+    _mm_storeh_pd(&acc.weight, sumsq_weight);
+  }
+}
+
+__attribute__((target("avx2")))
+static void compute_bins_avx2(const DataSample<double> *samples, unsigned n, double start, double scale,
+                              int *bins) {
+  __m256d start4 = _mm256_set1_pd(start), scale4 = _mm256_set1_pd(scale);
+  unsigned i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d times = _mm256_setr_pd(samples[i].time, samples[i + 1].time, samples[i + 2].time, samples[i + 3].time);
+    __m128i ids = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_sub_pd(times, start4), scale4));
+    _mm_storeu_si128((__m128i*) (bins + i), ids);
+  }
+  compute_bins_scalar(samples + i, n - i, start, scale, bins + i);
+}
+
+/// Accumulate with (timesum, sum, sumsq, weight), which are consecutive in DataAccumulator<double>, in one register
+__attribute__((target("avx2")))
+static void accumulate_avx2(const DataSample<double> *samples, const int *bins, unsigned n,
+                            std::vector<DataAccumulator<double> > &accumulators) {
+  unsigned i = 0;
+  while (i < n) {
+    int bin = bins[i];
+    assert((unsigned) bin < accumulators.size());
+    DataAccumulator<double> &acc = accumulators[bin];
+    __m256d sums = _mm256_loadu_pd(&acc.timesum);
+    for (; i < n && bins[i] == bin; i++) {
+      const DataSample<double> &sample = samples[i];
+      if (sample.weight == 0) continue;
+      float stddev_squared = sample.stddev * sample.stddev;
+      __m256d terms = _mm256_setr_pd(sample.time, sample.value, stddev_squared + sample.value * sample.value, 1.0);
+      sums = _mm256_add_pd(sums, _mm256_mul_pd(terms, _mm256_set1_pd(sample.weight)));
+    }
+    _mm256_storeu_pd(&acc.timesum, sums);
+  }
+}
+
+#endif
+
+BinningKernel best_binning_kernel() {
+#ifdef BINNING_X86
+  static BinningKernel best =
+    __builtin_cpu_supports("avx2") ? BINNING_AVX2 : __builtin_cpu_supports("sse2") ? BINNING_SSE2 : BINNING_SCALAR;
+  return best;
+#else
+  return BINNING_SCALAR;
+#endif
+}
+
+const char *binning_kernel_name(BinningKernel kernel) {
+  switch (kernel) {
+  case BINNING_BEST: return binning_kernel_name(best_binning_kernel());
+  case BINNING_SCALAR: return "scalar";
+  case BINNING_SSE2: return "sse2";
+  case BINNING_AVX2: return "avx2";
+  }
+  return "unknown";
+}
+
+void bin_samples(TileIndex tile, const DataSample<double> *begin, const DataSample<double> *end,
+                 std::vector<DataAccumulator<double> > &bins, BinningKernel kernel) {
+  if (begin == end) return;
+  assert(tile.contains_time(begin->time) && tile.contains_time((end - 1)->time));
+
+  BinningKernel best = best_binning_kernel();
+  if (kernel == BINNING_BEST) kernel = best;
+  else if (kernel > best) kernel = BINNING_SCALAR;
+
+  // bins.size() / duration is exact when bins.size() is a power of two, so bin ids match
+  // floor(tile.position(t) * bins.size())
+  double start = tile.start_time();
+  double scale = bins.size() / tile.duration();
+  int ids[BLOCK_SIZE];
+  for (size_t i = 0; i < (size_t) (end - begin); i += BLOCK_SIZE) {
+    const DataSample<double> *block = begin + i;
+    unsigned n = std::min<size_t>(BLOCK_SIZE, end - block);
+    switch (kernel) {
+#ifdef BINNING_X86
+    case BINNING_AVX2:
+      compute_bins_avx2(block, n, start, scale, ids);
+      accumulate_avx2(block, ids, n, bins);
+      break;
+    case BINNING_SSE2:
+      compute_bins_sse2(block, n, start, scale, ids);
+      accumulate_sse2(block, ids, n, bins);
+      break;
+#endif
+    default:
+      compute_bins_scalar(block, n, start, scale, ids);
+      accumulate_scalar(block, ids, n, bins);
+      break;
+    }
+  }
+}
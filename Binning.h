@@ -0,0 +1,55 @@
+#ifndef BINNING_INCLUDE_H
+#define BINNING_INCLUDE_H
+
+// C++
+#include <vector>
+
+// C
+#include <assert.h>
+#include <math.h>
+
+// Local
+#include "DataSample.h"
+#include "TileIndex.h"
+
+/// Implementations of bin_samples for double samples, in increasing order of speed.  BINNING_BEST selects the
+/// fastest the CPU supports.
+enum BinningKernel {
+  BINNING_BEST,
+  BINNING_SCALAR,
+  BINNING_SSE2,
+  BINNING_AVX2
+};
+
+/// Fastest kernel supported by this CPU;  never BINNING_BEST
+BinningKernel best_binning_kernel();
+
+/// \return Kernel name, for logging and benchmarks
+const char *binning_kernel_name(BinningKernel kernel);
+
+/// Accumulate samples into bins.size() equal-width bins spanning tile.  A sample at time t goes to bin
+/// floor(tile.position(t) * bins.size()), and bins already holding samples are added to.
+///
+/// Samples must be sorted by time and lie within tile.  Bin ids are computed several samples at a time, and each
+/// run of samples falling in the same bin is summed in registers before being stored, in sample order, so results
+/// are identical to adding each sample to its bin in turn.  Bin ids are exactly those of tile.position() when
+/// bins.size() is a power of two.
+///
+/// \param kernel Implementation to use;  kernels the CPU doesn't support fall back to BINNING_SCALAR
+void bin_samples(TileIndex tile, const DataSample<double> *begin, const DataSample<double> *end,
+                 std::vector<DataAccumulator<double> > &bins, BinningKernel kernel = BINNING_BEST);
+
+/// Accumulate samples into bins.size() equal-width bins spanning tile, one at a time
+template <class T>
+void bin_samples(TileIndex tile, const DataSample<T> *begin, const DataSample<T> *end,
+                 std::vector<DataAccumulator<T> > &bins) {
+  double start = tile.start_time();
+  double scale = bins.size() / tile.duration();
+  for (const DataSample<T> *sample = begin; sample < end; sample++) {
+    unsigned bin = (unsigned) floor((sample->time - start) * scale);
+    assert(bin < bins.size());
+    bins[bin] += *sample;
+  }
+}
+
+#endif
@@ -361,8 +361,10 @@ void PeriodicDataRecord::set_time(const TickToTime &ttt) {
 }
 
 
+/// Parse .bt file, passing each record's samples to receiver as they're parsed.  Samples for a given channel
+/// are normally, but not necessarily, received in ascending time.
 void parse_bt_file(const std::string &infile,
-                   std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > &data,
+                   BtParserReceiver &receiver,
                    std::vector<ParseError> &errors,
 		   ParseInfo &info)
 {
@@ -390,7 +392,6 @@ void parse_bt_file(const std::string &infile,
   TickToTime ttt;
 
   std::map<std::string, unsigned long long> last_tick;
-  bool out_of_order = false;
   
   while (ptr < end) {
     const unsigned char *beginning_of_record = ptr;
@@ -448,18 +449,7 @@ void parse_bt_file(const std::string &infile,
           pdr.get_data_samples(i, data_samples);
 
           if (data_samples.size()) {
-            if (data.find(channel_name) == data.end()) {
-              data[channel_name].reset(new std::vector<DataSample<double> >());
-            } else {
-              if (data[channel_name]->back().time > data_samples.front().time) {
-                if (verbose) log_f("Warning: sample times in channel %s are out-of-order (%f > %f)",
-                                   channel_name.c_str(),
-                                   data[channel_name]->back().time, data_samples.front().time);
-                out_of_order = true;
-              }
-            }
-            
-            data[channel_name]->insert(data[channel_name]->end(), data_samples.begin(), data_samples.end());
+            receiver.receive_data_samples(channel_name, data_samples);
 	    info.good_records++;
           }
           last_tick[channel_name] = pdr.first_sample_long_tick;
@@ -483,12 +473,56 @@ void parse_bt_file(const std::string &infile,
   if (-1 == munmap((void*)in_mem, len)) { perror("munmap"); exit(1); }
   fclose(in);
   
-  if (out_of_order) {
+  double duration = doubletime() - begintime;
+  log_f("parse_bt_file: Parsed %lld bytes in %g seconds (%dK/sec)", len, duration, (int)(len / duration / 1024));
+  if (verbose) {
+    log_f("parse_bt_file: %d RTYPE_START_OF_FILE records", nrecords[RTYPE_START_OF_FILE]);
+    log_f("parse_bt_file: %d RTYPE_RTC records", nrecords[RTYPE_RTC]);
+    log_f("parse_bt_file: %d RTYPE_PERIODIC_DATA records", nrecords[RTYPE_PERIODIC_DATA]);
+    log_f("parse_bt_file:    %lld values", nvalues);
+  }
+}
+
+class BtParserMapReceiver : public BtParserReceiver {
+public:
+  BtParserMapReceiver(std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > &data)
+    : m_data(data), out_of_order(false) {}
+  virtual void receive_data_samples(const std::string &channel_name,
+                                    const std::vector<DataSample<double> > &data_samples) {
+    if (m_data.find(channel_name) == m_data.end()) {
+      m_data[channel_name].reset(new std::vector<DataSample<double> >());
+    } else {
+      if (m_data[channel_name]->back().time > data_samples.front().time) {
+        if (verbose) log_f("Warning: sample times in channel %s are out-of-order (%f > %f)",
+                           channel_name.c_str(),
+                           m_data[channel_name]->back().time, data_samples.front().time);
+        out_of_order = true;
+      }
+    }
+    
+    m_data[channel_name]->insert(m_data[channel_name]->end(), data_samples.begin(), data_samples.end());
+  }
+private:
+  std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > &m_data;
+public:
+  bool out_of_order;
+};
+
+/// Parse .bt file, collecting each channel's samples, sorted by time, into data
+void parse_bt_file(const std::string &infile,
+                   std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > &data,
+                   std::vector<ParseError> &errors,
+		   ParseInfo &info)
+{
+  BtParserMapReceiver receiver(data);
+  parse_bt_file(infile, receiver, errors, info);
+
+  if (receiver.out_of_order) {
     for (std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > >::iterator i =
            data.begin(); i != data.end(); ++i) {
       
       simple_shared_ptr<std::vector<DataSample<double > > > samples = i->second;
-      std::sort(samples->begin(), samples->end(), DataSample<double>::time_lessthan);
+      std::stable_sort(samples->begin(), samples->end(), DataSample<double>::time_lessthan);
     }
   }
 
@@ -501,15 +535,6 @@ void parse_bt_file(const std::string &infile,
       assert((*samples)[i].time <= ((*samples)[i+1].time));
     }
   }
-
-  double duration = doubletime() - begintime;
-  log_f("parse_bt_file: Parsed %lld bytes in %g seconds (%dK/sec)", len, duration, (int)(len / duration / 1024));
-  if (verbose) {
-    log_f("parse_bt_file: %d RTYPE_START_OF_FILE records", nrecords[RTYPE_START_OF_FILE]);
-    log_f("parse_bt_file: %d RTYPE_RTC records", nrecords[RTYPE_RTC]);
-    log_f("parse_bt_file: %d RTYPE_PERIODIC_DATA records", nrecords[RTYPE_PERIODIC_DATA]);
-    log_f("parse_bt_file:    %lld values", nvalues);
-  }
 }
 
 // void test_tick_to_time()
@@ -109,6 +109,11 @@ public:
                                     const std::vector<DataSample<double> > &samples) = 0;
 };
 
+void parse_bt_file(const std::string &infile,
+                   BtParserReceiver &receiver,
+                   std::vector<ParseError> &errors,
+		   ParseInfo &info);
+
 void parse_bt_file(const std::string &infile,
                    std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > &data,
                    std::vector<ParseError> &errors,
@@ -1,11 +1,13 @@
 // System
+#include <algorithm>
 #include <assert.h>
-#include <set>
 #include <stdexcept>
 #include <stdio.h>
 #include <string.h>
 
 // Local
+#include "Binning.h"
+#include "ChannelWriter.h"
 #include "Log.h"
 #include "TileIndex.h"
 #include "utils.h"
@@ -14,8 +16,8 @@
 #include "Channel.h"
 
 
-int Channel::total_tiles_read;
-int Channel::total_tiles_written;
+std::atomic<int> Channel::total_tiles_read(0);
+std::atomic<int> Channel::total_tiles_written(0);
 int Channel::verbosity;
 
 /// Create channel reference to KVS
@@ -53,13 +55,23 @@ Channel::Locker::~Locker() {
 /// \return true if channel exists in KVS and read successful;  false if channel does not exist in KVS
 /// Channel exists if metainfo_key (.info) exists and is of non-zero size.  File may exist and be of zero size
 /// if the channel is locked before it is created.
+/// .info files written before fields were appended to ChannelInfo are shorter;  the missing fields read as zero,
+/// and the info reads as the current version.  Throws if the file has any other length, e.g. if partly written.
 bool Channel::read_info(ChannelInfo &info) const {
   std::string info_str;
   if (m_kvs.get(metainfo_key(), info_str) && info_str != "") {
-    assert(info_str.length() == sizeof(ChannelInfo));
-    memcpy((void*)&info, (void*)info_str.c_str(), sizeof(info));
+    bool legacy = info_str.length() == ChannelInfo::legacy_size();
+    if (!legacy && info_str.length() != sizeof(ChannelInfo)) {
+      throw std::runtime_error(string_printf("Channel: %s has %zd bytes of metainformation, not %zd",
+                                             descriptor().c_str(), info_str.length(), sizeof(ChannelInfo)));
+    }
+    memset((void*)&info, 0, sizeof(info));
+    memcpy((void*)&info, (void*)info_str.c_str(), info_str.length());
     assert(info.magic == ChannelInfo::MAGIC);
-    if (verbosity) log_f("Channel: read_info %s: root tile=%s", descriptor().c_str(), info.nonnegative_root_tile_index.to_string().c_str());
+    if (legacy) info.version = ChannelInfo::VERSION;
+    if (verbosity) log_f("Channel: read_info %s: root tiles=%s, %s", descriptor().c_str(),
+                         info.negative_root_tile_index.to_string().c_str(),
+                         info.nonnegative_root_tile_index.to_string().c_str());
     return true;
   } else {
     return false;
@@ -73,7 +85,9 @@ void Channel::write_info(const ChannelInfo &info) {
   assert(!info.nonnegative_root_tile_index.is_null());
   std::string info_str((char*)&info, (char*)((&info)+1));
   m_kvs.set(metainfo_key(), info_str);
-  if (verbosity) log_f("Channel: write_info %s : root tile=%s", descriptor().c_str(), info.nonnegative_root_tile_index.to_string().c_str());
+  if (verbosity) log_f("Channel: write_info %s : root tiles=%s, %s", descriptor().c_str(),
+                       info.negative_root_tile_index.to_string().c_str(),
+                       info.nonnegative_root_tile_index.to_string().c_str());
 }
 
 bool Channel::has_tile(TileIndex ti) const {
@@ -90,6 +104,31 @@ bool Channel::read_tile(TileIndex ti, Tile &tile) const {
   return true;
 }
 
+/// Combine samples into n_bins equal-width bins spanning ti
+template <class T>
+void summarize_samples(TileIndex ti, unsigned n_bins, std::vector<DataSample<T> > &samples) {
+  if (!samples.size()) return;
+  std::vector<DataAccumulator<T> > bins(n_bins);
+  bin_samples(ti, &samples[0], &samples[0] + samples.size(), bins);
+  samples.clear();
+  for (unsigned i = 0; i < bins.size(); i++) {
+    if (bins[i].weight > 0) samples.push_back(bins[i].get_sample());
+  }
+}
+
+/// Read tile, summarized as a tile at desired_level would be.  Tiles are only finer than desired_level when
+/// desired_level is above the root, and are then summarized into the bins of a tile at desired_level, which are
+/// 2^(desired_level - ti.level) times wider than ti's.
+bool Channel::read_tile_at_level(TileIndex ti, Tile &tile, int desired_level) const {
+  if (!read_tile(ti, tile)) return false;
+  if (ti.level < desired_level) {
+    int shift = std::min(desired_level - ti.level, 31);
+    summarize_samples(ti, std::max(BT_CHANNEL_DOUBLE_SAMPLES >> shift, 1), tile.double_samples);
+    summarize_samples(ti, std::max(BT_CHANNEL_STRING_SAMPLES >> shift, 1), tile.string_samples);
+  }
+  return true;
+}
+
 void Channel::write_tile(TileIndex ti, const Tile &tile) {
   std::string binary;
   tile.to_binary(binary);
@@ -111,11 +150,26 @@ void Channel::create_tile(TileIndex ti) {
   write_tile(ti, tile);
 }
 
-double Channel::level_from_rate(double samples_per_second) const {
+double Channel::level_from_rate(double samples_per_second) {
   double tile_length = BT_CHANNEL_DOUBLE_SAMPLES / samples_per_second;
   return TileIndex::duration_to_level(tile_length);
 }
 
+/// Set how samples added at the same time as an existing sample are combined.  Creates the channel if it doesn't
+/// exist.
+void Channel::set_duplicate_policy(DuplicatePolicy policy) {
+  ChannelWriter writer(*this);  // Locks self until writer is destroyed
+  writer.set_duplicate_policy(policy);
+  writer.commit();
+}
+
+/// \return How samples added at the same time as an existing sample are combined
+DuplicatePolicy Channel::duplicate_policy() const {
+  ChannelInfo info;
+  if (!read_info(info)) return DUPLICATES_OVERWRITE;
+  return (DuplicatePolicy)info.duplicate_policy;
+}
+
 void Channel::add_data(const std::vector<DataSample<double> > &data, DataRanges *channel_ranges) {
   add_data_internal(data, channel_ranges);
 }
@@ -128,123 +182,260 @@ void Channel::add_data(const std::vector<DataSample<std::string> > &data, DataRa
 /// \param data Data to add;  must be sorted in ascending time
 /// Locking:  This method acquires a lock to channel as needed to guarantee update is successful in an environment
 /// where multiple simultaneous updates are happening via add_data from multiple processes.
+/// To add more data than fits comfortably in memory, use ChannelWriter directly.
 template <class T>
 void Channel::add_data_internal(const std::vector<DataSample<T> > &data, DataRanges *channel_ranges) {
   if (!data.size()) return;
   // Sanity check
-  if (data[0].time < 0) throw std::runtime_error("Unimplemented feature: adding data with negative time");
   for (unsigned i = 0; i < data.size()-1; i++) {
     if (data[i].time > data[i+1].time) throw std::runtime_error("Attempt to add data that is not sorted by ascending time");
   }
 
-  //	regenerate = empty set
+  ChannelWriter writer(*this);  // Locks self until writer is destroyed
+  writer.add_data(data);
+  writer.commit(channel_ranges);
+}
+
+/// Read double samples with times in [begin, end)
+/// \param desired_level Level to read.  Above the bottom level, each sample summarizes the samples in one bin of a
+/// summary tile, with their mean and standard deviation, and their total weight;  use level_from_rate to choose a
+/// level.  Where the channel has no tiles that deep, the deepest tiles are read (see read_tile_at_level).
+void Channel::read_data(std::vector<DataSample<double> > &data, double begin, double end, int desired_level) const {
+  data.clear();
+
   Locker lock(*this);  // Lock self and hold lock until exiting this method
-  std::set<TileIndex> to_regenerate;
 
   ChannelInfo info;
   bool success = read_info(info);
   if (!success) {
-    // New channel
-    info.magic = ChannelInfo::MAGIC;
-    info.version = 0x00010000;
-    info.times = Range(data[0].time, data.back().time);
-    info.nonnegative_root_tile_index = TileIndex::nonnegative_all();
-    create_tile(TileIndex::nonnegative_all());
-    info.negative_root_tile_index = TileIndex::null();
-  } else {
-    info.times.add(Range(data[0].time, data.back().time));
-    // If we're not the all-tile, see if we need to move the root upwards
-    if (info.nonnegative_root_tile_index != TileIndex::nonnegative_all()) {
-      TileIndex new_nonnegative_root_tile_index = TileIndex::index_containing(info.times);
-      if (new_nonnegative_root_tile_index.level > info.nonnegative_root_tile_index.level) {
-	// Root index changed.  Confirm new root is parent or more distant ancestor of old root
-	assert(new_nonnegative_root_tile_index.is_ancestor_of(info.nonnegative_root_tile_index));
-	// Trigger regeneration from old root's parent, up through new root
-	to_regenerate.insert(info.nonnegative_root_tile_index.parent());
-	move_root_upwards(new_nonnegative_root_tile_index, info.nonnegative_root_tile_index);
-	info.nonnegative_root_tile_index = new_nonnegative_root_tile_index;
-      }
+    // Channel doesn't yet exist;  no data
+    if (verbosity) log_f("read_data: can't read info");
+    return;
+  }
+
+  for (TileIndex ti = find_first_tile(info, begin, desired_level);
+       !ti.is_null() && ti.start_time() < end;
+       ti = find_next_tile(info, ti, desired_level)) {
+    Tile tile;
+    assert(read_tile_at_level(ti, tile, desired_level));
+    unsigned i = 0;
+    // Skip any samples before requested time
+    for (; i < tile.double_samples.size() && tile.double_samples[i].time < begin; i++);
+
+    for (; i < tile.double_samples.size() && tile.double_samples[i].time < end; i++) {
+      data.push_back(tile.double_samples[i]);
     }
   }
+}
 
-  unsigned i=0;
+void Channel::latest(unsigned n, std::vector<DataSample<double> > &samples) const {
+  latest_internal(n, samples);
+}
 
-  while (i < data.size()) {
-    TileIndex ti= find_child_overlapping_time(info.nonnegative_root_tile_index, data[i].time, TileIndex::lowest_level());
-    assert(!ti.is_null());
+void Channel::latest(unsigned n, std::vector<DataSample<std::string> > &samples) const {
+  latest_internal(n, samples);
+}
 
-    Tile tile;
-    assert(read_tile(ti, tile));
-    const DataSample<T> *begin = &data[i];
-    while (i < data.size() && ti.contains_time(data[i].time)) i++;
-    const DataSample<T> *end = &data[i];
-    tile.insert_samples(begin, end);
-    
-    TileIndex new_root = split_tile_if_needed(ti, tile);
-    if (new_root != TileIndex::null()) {
-      assert(ti == TileIndex::nonnegative_all());
-      if (verbosity) log_f("Channel: %s changing root from %s to %s",
-                           descriptor().c_str(), ti.to_string().c_str(),
-                           new_root.to_string().c_str());
-      info.nonnegative_root_tile_index = new_root;
-      delete_tile(ti); // Delete old root
-      ti = new_root;
+/// Read the latest n samples of one type, in ascending time.  Descends from the roots, latest child first, skipping
+/// subtrees whose summaries hold no samples of that type, so only the tiles leading to those samples are read.
+/// Locking:  This method acquires a lock to channel for the duration of the read.
+template <class T>
+void Channel::latest_internal(unsigned n, std::vector<DataSample<T> > &samples) const {
+  samples.clear();
+  if (n == 0) return;
+  Locker lock(*this);  // Lock self and hold lock until exiting this method
+  ChannelInfo info;
+  if (!read_info(info)) return;
+
+  TileIndex roots[2] = { info.nonnegative_root_tile_index, info.negative_root_tile_index };
+  for (int i = 0; i < 2 && samples.size() < n; i++) {
+    if (!roots[i].is_null()) latest_subtree(roots[i], n, samples);
+  }
+  std::reverse(samples.begin(), samples.end());
+}
+
+/// Append the latest samples of one type under ti to samples, in descending time, until samples holds n
+template <class T>
+void Channel::latest_subtree(TileIndex ti, unsigned n, std::vector<DataSample<T> > &samples) const {
+  Tile tile;
+  // A channel with only negative samples has no nonnegative root tile
+  if (!read_tile(ti, tile)) return;
+  const std::vector<DataSample<T> > &tile_samples = tile.get_samples<T>();
+  // A tile's summaries cover every sample beneath it
+  if (tile_samples.empty()) return;
+
+  if (tile_exists(ti.left_child()) || tile_exists(ti.right_child())) {
+    latest_subtree(ti.right_child(), n, samples);
+    if (samples.size() < n) latest_subtree(ti.left_child(), n, samples);
+    return;
+  }
+  for (size_t i = tile_samples.size(); i > 0 && samples.size() < n; i--) samples.push_back(tile_samples[i - 1]);
+}
+
+/// Search for double samples with values inside a range
+struct ValueSearch {
+  Range values;
+  explicit ValueSearch(Range values) : values(values) {}
+  // Tiles written before tiles stored their ranges have none, and can't be skipped
+  bool might_match(const Tile &tile) const {
+    return tile.ranges.times.empty() || tile.ranges.double_samples.intersects(values);
+  }
+  bool matches(const DataSample<double> &sample) const { return values.includes(sample.value); }
+};
+
+/// Search for string samples containing all of a set of tokens
+struct TextSearch {
+  std::vector<std::string> tokens;
+  explicit TextSearch(const std::string &text) { TokenFilter::tokenize(text, tokens); }
+  bool might_match(const Tile &tile) const { return tile.token_filter.might_contain_all(tokens); }
+  bool matches(const DataSample<std::string> &sample) const {
+    std::vector<std::string> sample_tokens;
+    TokenFilter::tokenize(sample.value, sample_tokens);
+    for (unsigned i = 0; i < tokens.size(); i++) {
+      if (std::find(sample_tokens.begin(), sample_tokens.end(), tokens[i]) == sample_tokens.end()) return false;
     }
-    write_tile(ti, tile);
-    if (ti == info.nonnegative_root_tile_index && channel_ranges) { *channel_ranges = tile.ranges; }
-    if (ti != info.nonnegative_root_tile_index) to_regenerate.insert(ti.parent());
+    return true;
   }
-  
-  // Regenerate from lowest level to highest
-  while (!to_regenerate.empty()) {
-    TileIndex ti = *to_regenerate.begin();
-    to_regenerate.erase(to_regenerate.begin());
-    Tile regenerated, children[2];
-    assert(read_tile(ti.left_child(), children[0]));
-    assert(read_tile(ti.right_child(), children[1]));
-    create_parent_tile_from_children(ti, regenerated, children);
-    write_tile(ti, regenerated);
-    if (ti == info.nonnegative_root_tile_index && channel_ranges) { *channel_ranges = regenerated.ranges; }
-    if (ti != info.nonnegative_root_tile_index) to_regenerate.insert(ti.parent());
-  }
-  write_info(info);
-}
-
-void Channel::read_data(std::vector<DataSample<double> > &data, double begin, double end) const {
-  double time = begin;
-  data.clear();
+};
 
-  Locker lock(*this);  // Lock self and hold lock until exiting this method
+/// Find the double samples with times and values inside times and values (inclusive), in ascending time.  Every
+/// tile's ranges cover the values of all the samples beneath it, so subtrees whose ranges can't hold a match are
+/// skipped without reading their descendants, and only bottom-level tiles that might hold a match are scanned.
+/// Locking:  This method acquires a lock to channel for the duration of the search.
+void Channel::search(Range times, Range values, std::vector<DataSample<double> > &matches) const {
+  matches.clear();
+  if (!values.empty()) search_internal(times, ValueSearch(values), matches);
+}
+
+/// Find the string samples with times inside times (inclusive) containing every token of text, in ascending time.
+/// Tokens are runs of letters and digits, compared without case (see TokenFilter).  Subtrees whose token filters
+/// rule out a match are skipped, as for the numeric search.
+/// Locking:  This method acquires a lock to channel for the duration of the search.
+void Channel::search(Range times, const std::string &text, std::vector<DataSample<std::string> > &matches) const {
+  matches.clear();
+  TextSearch search(text);
+  if (search.tokens.size()) search_internal(times, search, matches);
+}
 
+template <class T, class Search>
+void Channel::search_internal(Range times, const Search &search, std::vector<DataSample<T> > &matches) const {
+  Locker lock(*this);  // Lock self and hold lock until exiting this method
   ChannelInfo info;
-  bool success = read_info(info);
-  if (!success) {
-    // Channel doesn't yet exist;  no data
-    if (verbosity) log_f("read_data: can't read info");
+  if (!read_info(info) || !info.times.intersects(times)) return;
+
+  TileIndex roots[2] = { info.negative_root_tile_index, info.nonnegative_root_tile_index };
+  for (int i = 0; i < 2; i++) {
+    if (!roots[i].is_null()) search_subtree(roots[i], times, search, matches);
+  }
+}
+
+template <class T, class Search>
+void Channel::search_subtree(TileIndex ti, Range times, const Search &search,
+                             std::vector<DataSample<T> > &matches) const {
+  if (ti.end_time() < times.min || ti.start_time() > times.max) return;
+  Tile tile;
+  if (!read_tile(ti, tile)) return;
+  bool has_ranges = !tile.ranges.times.empty();
+  if (has_ranges && !tile.ranges.times.intersects(times)) return;
+  if (!search.might_match(tile)) return;
+
+  if (tile_exists(ti.left_child()) || tile_exists(ti.right_child())) {
+    search_subtree(ti.left_child(), times, search, matches);
+    search_subtree(ti.right_child(), times, search, matches);
     return;
   }
-  bool first_tile = true;
+  const std::vector<DataSample<T> > &samples = tile.get_samples<T>();
+  for (unsigned i = 0; i < samples.size(); i++) {
+    if (times.includes(samples[i].time) && search.matches(samples[i])) matches.push_back(samples[i]);
+  }
+}
 
-  while (time < end) {
-    TileIndex ti = find_child_overlapping_time(info.nonnegative_root_tile_index, time, TileIndex::lowest_level());
-    if (ti.is_null()) {
-      // No tiles; no more data
-      if (verbosity) log_f("read_data: can't read tile");
-      return;
-    }
+/// Delete all samples with times inside times (inclusive)
+/// \param channel_ranges If non-NULL, returns ranges of the channel after the deletion
+///
+/// Tiles entirely inside times are deleted along with their descendants without being read;  only tiles straddling
+/// the edges of times are read and trimmed.  Each modified tile's ancestors are regenerated once.
+/// Locking:  This method acquires a lock to channel for the duration of the deletion.
+void Channel::delete_range(Range times, DataRanges *channel_ranges) {
+  Locker lock(*this);  // Lock self and hold lock until exiting this method
 
-    Tile tile;
-    assert(read_tile(ti, tile));
-    unsigned i = 0;
-    if (first_tile) {
-      // Skip any samples before requested time
-      for (; i < tile.double_samples.size() && tile.double_samples[i].time < begin; i++);
-    }
+  if (channel_ranges) channel_ranges->clear();
+  ChannelInfo info;
+  if (!read_info(info)) return;
 
-    for (; i < tile.double_samples.size() && tile.double_samples[i].time < end; i++) {
-      data.push_back(tile.double_samples[i]);
+  TileIndex roots[2] = { info.negative_root_tile_index, info.nonnegative_root_tile_index };
+  Tile root_tiles[2];
+  bool modified = false;
+  for (int i = 0; i < 2; i++) {
+    if (roots[i].is_null()) continue;
+    if (delete_range_in_subtree(roots[i], times, root_tiles[i])) {
+      modified = true;
+    } else {
+      read_tile(roots[i], root_tiles[i]);
     }
-    time = ti.end_time();
+  }
+
+  DataRanges ranges = root_tiles[0].ranges;
+  ranges.add(root_tiles[1].ranges);
+  if (channel_ranges) *channel_ranges = ranges;
+
+  if (modified) {
+    info.times = ranges.times;
+    info.record_modification(times);
+    write_info(info);
+  }
+}
+
+/// Delete samples inside times from the subtree rooted at ti
+/// \param tile Returns the new contents of ti, if modified
+/// \return true if ti was modified
+bool Channel::delete_range_in_subtree(TileIndex ti, Range times, Tile &tile) {
+  // Tile doesn't overlap times
+  if (ti.end_time() <= times.min || times.max < ti.start_time()) return false;
+
+  if (times.min <= ti.start_time() && ti.end_time() <= times.max) {
+    // Tile is entirely inside times;  replace it with an empty tile without children
+    if (verbosity) log_f("Channel: %s deleting subtree %s", descriptor().c_str(), ti.to_string().c_str());
+    delete_descendants(ti);
+    tile = Tile();
+    write_tile(ti, tile);
+    return true;
+  }
+
+  if (!has_tile(ti.left_child())) {
+    // Tile has no children;  trim its samples
+    if (!read_tile(ti, tile)) return false;
+    if (!tile.delete_samples(times)) return false;
+    write_tile(ti, tile);
+    return true;
+  }
+
+  Tile children[2];
+  bool left_modified = delete_range_in_subtree(ti.left_child(), times, children[0]);
+  bool right_modified = delete_range_in_subtree(ti.right_child(), times, children[1]);
+  if (!left_modified && !right_modified) return false;
+  if (!left_modified) assert(read_tile(ti.left_child(), children[0]));
+  if (!right_modified) assert(read_tile(ti.right_child(), children[1]));
+
+  if (children[0].double_samples.empty() && children[0].string_samples.empty() &&
+      children[1].double_samples.empty() && children[1].string_samples.empty()) {
+    // Nothing left underneath;  collapse to an empty tile without children
+    delete_descendants(ti);
+    tile = Tile();
+  } else {
+    create_parent_tile_from_children(ti, tile, children);
+  }
+  write_tile(ti, tile);
+  return true;
+}
+
+/// Delete all tiles below ti
+void Channel::delete_descendants(TileIndex ti) {
+  TileIndex children[2] = { ti.left_child(), ti.right_child() };
+  for (int i = 0; i < 2; i++) {
+    if (children[i].is_null() || !has_tile(children[i])) continue;
+    delete_descendants(children[i]);
+    delete_tile(children[i]);
   }
 }
 
@@ -253,8 +444,9 @@ void split_samples(const std::vector<DataSample<T> > &from, double split_time, T
   size_t split_index;
   for (split_index = 0; split_index < from.size() && from[split_index].time < split_time; split_index++) {}
 
-  to_a.insert_samples(&from[0], &from[split_index]);
-  to_b.insert_samples(&from[split_index], &from[from.size()]);
+  // Copy rather than insert, so samples sharing a time aren't combined
+  to_a.get_samples<T>().assign(from.begin(), from.begin() + split_index);
+  to_b.get_samples<T>().assign(from.begin() + split_index, from.end());
 }
 
 /// Split tile if needed (if it's too large)
@@ -272,7 +464,7 @@ TileIndex Channel::split_tile_if_needed(TileIndex ti, Tile &tile) {
 
   // If we're splitting an "all" tile, it means that until now the channel has only had one tile's worth of
   // data, and that a proper root tile location couldn't be selected.  Select a new root tile now.
-  if (ti.is_nonnegative_all()) {
+  if (ti.is_all()) {
     // TODO: this breaks if all samples are at one time
     ti = new_root_index = TileIndex::index_containing(Range(tile.first_sample_time(), tile.last_sample_time()));
     if (verbosity) log_f("split_tile_if_needed: Moving root tile to %s", ti.to_string().c_str());
@@ -284,6 +476,8 @@ TileIndex Channel::split_tile_if_needed(TileIndex ti, Tile &tile) {
   double split_time = ti.right_child().start_time();
   split_samples(tile.double_samples, split_time, children[0], children[1]);
   split_samples(tile.string_samples, split_time, children[0], children[1]);
+  children[0].recompute_ranges();
+  children[1].recompute_ranges();
 
   for (int i = 0; i < 2; i++) {
     assert(!has_tile(child_indexes[i]));
@@ -307,24 +501,14 @@ void combine_samples(unsigned int n_samples,
   const std::vector<DataSample<T> > *children[2];
   children[0]=&left_child; children[1]=&right_child;
 
-  int n=0;
   for (unsigned j = 0; j < 2; j++) {
+    // Version 1: bin samples into correct bin
+    // Version 2: try gaussian or lanczos(1) or 1/4 3/4 3/4 1/4
     const std::vector<DataSample<T> > &child = *children[j];
-    for (unsigned i = 0; i < child.size(); i++) {
-      // Version 1: bin samples into correct bin
-      // Version 2: try gaussian or lanczos(1) or 1/4 3/4 3/4 1/4
-      
-      const DataSample<T> &sample = child[i];
-      assert(parent_index.contains_time(sample.time));
-      unsigned bin = (unsigned) floor(parent_index.position(sample.time) * n_samples);
-      assert(bin < n_samples);
-      n++;
-      bins[bin] += sample;
-      assert(bins[bin].weight>0);
-    }
+    if (child.size()) bin_samples(parent_index, &child[0], &child[0] + child.size(), bins);
   }
 
-  n = 0;
+  int n = 0;
   int m=0;
   parent.clear();
   for (unsigned i = 0; i < bins.size(); i++) {
@@ -357,18 +541,8 @@ void Channel::create_parent_tile_from_children(TileIndex parent_index, Tile &par
 
   parent.ranges = children[0].ranges;
   parent.ranges.add(children[1].ranges);
-}
-
-void Channel::move_root_upwards(TileIndex new_root_index, TileIndex old_root_index) {
-  Tile old_root_tile;
-  Tile empty_tile;
-  assert(read_tile(old_root_index, old_root_tile));
-  TileIndex ti = old_root_index;
-  while (ti != new_root_index) {
-    write_tile(ti.sibling(), empty_tile);
-    write_tile(ti.parent(), old_root_tile);
-    ti = ti.parent();
-  }
+  parent.token_filter = children[0].token_filter;
+  parent.token_filter.add(children[1].token_filter);
 }
 
 // If ti exists, read it
@@ -386,7 +560,11 @@ bool Channel::read_tile_or_closest_ancestor(TileIndex ti, TileIndex &ret_index,
     if (verbosity) log_f("read_tile_or_closest_ancestor: can't read info");
     return false;
   }
-  TileIndex root = info.nonnegative_root_tile_index;
+  TileIndex root = info.root_tile_index(ti.start_time());
+  if (root.is_null()) {
+    // No data on this side of time zero
+    return false;
+  }
 
   if (ti.is_ancestor_of(root)) {
     ret_index = root;
@@ -418,22 +596,67 @@ void Channel::read_tiles_in_range(Range times,
   if (!success) return;
   if (!info.times.intersects(times)) return;
 
-  double time = times.min;
-  TileIndex ti = TileIndex::null();
-  while (time < times.max) {
-    if (ti.is_null()) {
-      ti = find_child_overlapping_time(info.nonnegative_root_tile_index, times.min, desired_level);
-    } else {
-      ti = find_successive_tile(info.nonnegative_root_tile_index, ti, desired_level);
-    }
-    if (ti.is_null() || ti.start_time() >= times.max) break;
-
+  for (TileIndex ti = find_first_tile(info, times.min, desired_level);
+       !ti.is_null() && ti.start_time() < times.max;
+       ti = find_next_tile(info, ti, desired_level)) {
     Tile t;
     assert(read_tile(ti, t));
     if (!(*callback)(t, times)) break;
   }
 }
 
+/// Read the tiles in times at several levels in one traversal.  For each level, returns the tiles
+/// read_tiles_in_range would read for that level, in time order.  Tiles needed by more than one level, and the
+/// existence checks for the tiles above them, are shared, so a tile is read at most once.
+/// \param levels Desired levels
+/// \param tiles Returns one vector of tiles per level, in the order of levels
+/// Locking:  This method acquires a lock to channel for the duration of the traversal.
+void Channel::read_pyramid(Range times, const std::vector<int> &levels,
+                           std::vector<std::vector<PyramidTile> > &tiles) const {
+  tiles.assign(levels.size(), std::vector<PyramidTile>());
+  Locker lock(*this);  // Lock self and hold lock until exiting this method
+  ChannelInfo info;
+  if (!read_info(info) || !info.times.intersects(times)) return;
+
+  std::vector<unsigned> pending(levels.size());
+  for (unsigned i = 0; i < levels.size(); i++) pending[i] = i;
+  TileIndex roots[2] = { info.negative_root_tile_index, info.nonnegative_root_tile_index };
+  for (int i = 0; i < 2; i++) {
+    if (!roots[i].is_null()) read_pyramid_subtree(roots[i], times, levels, pending, tiles);
+  }
+}
+
+/// Return ti for the pending levels it's at or above, or for all of them if it has no children, and descend for
+/// the rest
+/// \param pending Indexes into levels of the levels no ancestor of ti was returned for
+void Channel::read_pyramid_subtree(TileIndex ti, Range times, const std::vector<int> &levels,
+                                   const std::vector<unsigned> &pending,
+                                   std::vector<std::vector<PyramidTile> > &tiles) const {
+  // Same tiles as find_first_tile and find_next_tile:  the tile containing times.min, through the last tile
+  // starting before times.max
+  if (ti.end_time() <= times.min || ti.start_time() >= times.max) return;
+
+  bool leaf = !tile_exists(ti.left_child());
+  PyramidTile found;
+  std::vector<unsigned> descend;
+  for (unsigned i = 0; i < pending.size(); i++) {
+    if (!leaf && ti.level > levels[pending[i]]) {
+      descend.push_back(pending[i]);
+      continue;
+    }
+    if (!found.tile.get()) {
+      found.index = ti;
+      found.tile.reset(new Tile());
+      assert(read_tile(ti, *found.tile));
+    }
+    tiles[pending[i]].push_back(found);
+  }
+  if (descend.size()) {
+    read_pyramid_subtree(ti.left_child(), times, levels, descend, tiles);
+    read_pyramid_subtree(ti.right_child(), times, levels, descend, tiles);
+  }
+}
+
 std::string Channel::descriptor() const {
   return string_printf("%d/%s", m_owner_id, m_name.c_str());
 }
@@ -482,6 +705,8 @@ TileIndex Channel::find_child_overlapping_time(TileIndex ti, double t, int desir
 }
 
 TileIndex Channel::find_successive_tile(TileIndex root, TileIndex ti, int desired_level) const {
+  // Nothing follows the root itself
+  if (!root.is_ancestor_of(ti)) return TileIndex::null();
   // Move upwards until parent has a different end time
   while (1) {
     if (ti.parent().is_null()) return TileIndex::null();
@@ -498,12 +723,68 @@ TileIndex Channel::find_successive_tile(TileIndex root, TileIndex ti, int desire
   return find_child_overlapping_time(ti, ti.start_time(), desired_level);
 }
 
+// Returns the first tile at desired_level (or the lowest level available) overlapping time t, or if there is no
+// such tile, the first tile following t.  Searches the negative tree for times before zero, continuing into the
+// nonnegative tree if the channel has no negative samples.
+TileIndex Channel::find_first_tile(const ChannelInfo &info, double t, int desired_level) const {
+  if (t < 0 && !info.negative_root_tile_index.is_null()) {
+    return find_child_overlapping_time(info.negative_root_tile_index, t, desired_level);
+  }
+  return find_child_overlapping_time(info.nonnegative_root_tile_index, std::max(t, 0.0), desired_level);
+}
+
+// Returns the tile following ti, crossing from the end of the negative tree to the start of the nonnegative tree.
+// Returns TileIndex::null() after the last tile.
+TileIndex Channel::find_next_tile(const ChannelInfo &info, TileIndex ti, int desired_level) const {
+  if (!ti.is_negative()) {
+    return find_successive_tile(info.nonnegative_root_tile_index, ti, desired_level);
+  }
+  TileIndex next = find_successive_tile(info.negative_root_tile_index, ti, desired_level);
+  if (next.is_null()) next = find_child_overlapping_time(info.nonnegative_root_tile_index, 0, desired_level);
+  return next;
+}
+
+TileIndex Channel::find_predecessor_tile(TileIndex root, TileIndex ti, int desired_level) const {
+  // Nothing precedes the root itself
+  if (!root.is_ancestor_of(ti)) return TileIndex::null();
+  // Move upwards until parent has a different start time
+  while (1) {
+    if (ti.parent().is_null()) return TileIndex::null();
+    if (ti.parent().start_time() != ti.start_time()) break;
+    ti = ti.parent();
+    if (ti.level >= root.level) {
+      // No more underneath the root
+      return TileIndex::null();
+    }
+  }
+  // We are now the right child of our parent;  skip to the left child
+  ti = ti.sibling();
+
+  return find_child_overlapping_time(ti, ti.end_time(), desired_level);
+}
+
+// Returns the tile preceding ti, crossing from the start of the nonnegative tree to the end of the negative tree.
+// Returns TileIndex::null() before the first tile.
+TileIndex Channel::find_previous_tile(const ChannelInfo &info, TileIndex ti, int desired_level) const {
+  if (ti.is_negative()) {
+    return find_predecessor_tile(info.negative_root_tile_index, ti, desired_level);
+  }
+  TileIndex previous = find_predecessor_tile(info.nonnegative_root_tile_index, ti, desired_level);
+  if (previous.is_null() && !info.negative_root_tile_index.is_null()) {
+    TileIndex root = info.negative_root_tile_index;
+    previous = find_child_overlapping_time(root, root.end_time(), desired_level);
+  }
+  return previous;
+}
+
 std::string Channel::dump_tile_summaries() const {
   Locker lock(*this);  // Lock self and hold lock until exiting this method
   ChannelInfo info;
   bool success = read_info(info);
   if (success) {
-    return dump_tile_summaries_internal(info.nonnegative_root_tile_index, 0);
+    std::string ret;
+    if (!info.negative_root_tile_index.is_null()) ret += dump_tile_summaries_internal(info.negative_root_tile_index, 0);
+    return ret + dump_tile_summaries_internal(info.nonnegative_root_tile_index, 0);
   } else {
     return "";
   }
@@ -512,7 +793,7 @@ std::string Channel::dump_tile_summaries() const {
 std::string Channel::dump_tile_summaries_internal(TileIndex ti, int level) const {
   Tile tile;
   if (!read_tile(ti, tile)) return "";
-  std::string ret = string_printf("%*s%d.%d: %zd samples\n", level, "", ti.level, ti.offset, tile.double_samples.size());
+  std::string ret = string_printf("%*s%d.%lld: %zd samples\n", level, "", ti.level, ti.offset, tile.double_samples.size());
   return ret + dump_tile_summaries_internal(ti.left_child(), level+1) + dump_tile_summaries_internal(ti.right_child(), level+1);
 }
 
@@ -524,6 +805,11 @@ std::string Channel::metainfo_key() const {
   return key_prefix() + ".info";
 }
 
+bool Channel::is_metainfo_key(const std::string &key) {
+  // Tile keys end with the tile's offset
+  return filename_suffix(key) == "info";
+}
+
 std::string Channel::tile_key(TileIndex ti) const {
   return string_printf("%s.%d.%lld", key_prefix().c_str(), ti.level, ti.offset);
 }
@@ -2,6 +2,7 @@
 #define CHANNEL_INCLUDE_H
 
 // C++
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -9,6 +10,7 @@
 #include "ChannelInfo.h"
 #include "DataSample.h"
 #include "KVS.h"
+#include "simple_shared_ptr.h"
 #include "Tile.h"
 
 /// \class Channel Channel.h
@@ -51,15 +53,25 @@ public:
 
   bool has_tile(TileIndex ti) const;
   bool read_tile(TileIndex ti, Tile &tile) const;
+  bool read_tile_at_level(TileIndex ti, Tile &tile, int desired_level) const;
   void write_tile(TileIndex ti, const Tile &tile);
   bool delete_tile(TileIndex ti);
   void create_tile(TileIndex ti);
 
-  double level_from_rate(double samples_per_second) const;
+  static double level_from_rate(double samples_per_second);
+
+  void set_duplicate_policy(DuplicatePolicy policy);
+  DuplicatePolicy duplicate_policy() const;
 
   void add_data(const std::vector<DataSample<double> > &data, DataRanges *channel_ranges = NULL);
   void add_data(const std::vector<DataSample<std::string> > &data, DataRanges *channel_ranges = NULL);
-  void read_data(std::vector<DataSample<double> > &data, double begin, double end) const;
+  void read_data(std::vector<DataSample<double> > &data, double begin, double end,
+                 int desired_level = TileIndex::lowest_level()) const;
+  void latest(unsigned n, std::vector<DataSample<double> > &samples) const;
+  void latest(unsigned n, std::vector<DataSample<std::string> > &samples) const;
+  void search(Range times, Range values, std::vector<DataSample<double> > &matches) const;
+  void search(Range times, const std::string &text, std::vector<DataSample<std::string> > &matches) const;
+  void delete_range(Range times, DataRanges *channel_ranges = NULL);
   
   std::string tile_key(TileIndex ti) const;
   bool tile_exists(TileIndex ti) const;
@@ -68,6 +80,14 @@ public:
   bool read_tile_or_closest_ancestor(TileIndex ti, TileIndex &ret_index, Tile &ret) const;
   void read_tiles_in_range(Range times, bool (*callback)(const Tile &t, Range times), int desired_level) const;
 
+  /// Tile returned by read_pyramid.  Tiles returned for more than one level are read once and shared.
+  struct PyramidTile {
+    TileIndex index;
+    simple_shared_ptr<Tile> tile;
+  };
+  void read_pyramid(Range times, const std::vector<int> &levels,
+                    std::vector<std::vector<PyramidTile> > &tiles) const;
+
   std::string descriptor() const;
 
   /// Get subchannel names
@@ -82,12 +102,20 @@ public:
 				   unsigned int nlevels = -1);
 
 
-  static int total_tiles_read;
-  static int total_tiles_written;
+  /// \return true if key holds a channel's metainformation, rather than a tile
+  static bool is_metainfo_key(const std::string &key);
+
+  /// Tiles read and written by all channels;  updated from reader and writer threads alike
+  static std::atomic<int> total_tiles_read;
+  static std::atomic<int> total_tiles_written;
   static int verbosity;
 
   TileIndex find_child_overlapping_time(TileIndex ti, double t, int desired_level) const;
   TileIndex find_successive_tile(TileIndex root, TileIndex ti, int desired_level) const;
+  TileIndex find_first_tile(const ChannelInfo &info, double t, int desired_level) const;
+  TileIndex find_next_tile(const ChannelInfo &info, TileIndex ti, int desired_level) const;
+  TileIndex find_predecessor_tile(TileIndex root, TileIndex ti, int desired_level) const;
+  TileIndex find_previous_tile(const ChannelInfo &info, TileIndex ti, int desired_level) const;
 
 private:
   KVS &m_kvs;
@@ -95,15 +123,29 @@ private:
   std::string m_name;
   size_t m_max_tile_size;
   std::string dump_tile_summaries_internal(TileIndex ti=TileIndex::null(), int level=0) const;
+  void read_pyramid_subtree(TileIndex ti, Range times, const std::vector<int> &levels,
+                            const std::vector<unsigned> &pending, std::vector<std::vector<PyramidTile> > &tiles) const;
+
+  template <class T, class Search>
+  void search_internal(Range times, const Search &search, std::vector<DataSample<T> > &matches) const;
+  template <class T, class Search>
+  void search_subtree(TileIndex ti, Range times, const Search &search, std::vector<DataSample<T> > &matches) const;
 
   std::string key_prefix() const;
   std::string metainfo_key() const;
   
   TileIndex split_tile_if_needed(TileIndex ti, Tile &tile);
   void create_parent_tile_from_children(TileIndex ti, Tile &parent, Tile children[]);
-  void move_root_upwards(TileIndex new_root, TileIndex old_root);
+  bool delete_range_in_subtree(TileIndex ti, Range times, Tile &tile);
+  void delete_descendants(TileIndex ti);
   template <class T>
   void add_data_internal(const std::vector<DataSample<T> > &data, DataRanges *channel_ranges);
+  template <class T>
+  void latest_internal(unsigned n, std::vector<DataSample<T> > &samples) const;
+  template <class T>
+  void latest_subtree(TileIndex ti, unsigned n, std::vector<DataSample<T> > &samples) const;
+
+  friend class ChannelWriter;
 };
 
 /// \class ChannelLocker Channel.h
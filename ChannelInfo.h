@@ -2,20 +2,71 @@
 #define INCLUDE_CHANNEL_INFO_H
 
 
+// C
+#include <stddef.h>
+
 // Local includes
 #include "Range.h"
 #include "sizes.h"
 #include "TileIndex.h"
 
 struct ChannelInfo {
+  ChannelInfo() : magic(0), version(0), duplicate_policy(0), modification_count(0), creation_id(0) {}
   uint32 magic;
   enum {
     MAGIC = 0x68437442 // Magic('BtCh')
   };
   uint32 version;
+  enum {
+    /// .info files of this version end at duplicate_policy (see LEGACY_SIZE)
+    LEGACY_VERSION = 0x00010000,
+    /// Current version, with every field below
+    VERSION = 0x00020000
+  };
   Range times;
   TileIndex nonnegative_root_tile_index;
   TileIndex negative_root_tile_index;
+  /// How samples added at the same time as an existing sample are combined (a DuplicatePolicy).  Fields from here on
+  /// are absent from LEGACY_VERSION .info files, and read as zero.
+  uint32 duplicate_policy;
+  /// Number of times samples have been added or deleted
+  uint64 modification_count;
+  enum {
+    RECENT_MODIFICATIONS = 16
+  };
+  /// Times spanning the samples, or the tiles holding them, changed by each of the most recent modifications.
+  /// Modification n is at index n % RECENT_MODIFICATIONS.
+  Range recent_modifications[RECENT_MODIFICATIONS];
+  /// Random number chosen when the channel is created.  A channel deleted and created again restarts its
+  /// modification count, so versions of its data are identified by creation_id and modification_count together.
+  uint64 creation_id;
+
+  /// Length of LEGACY_VERSION .info files
+  static size_t legacy_size() { return offsetof(ChannelInfo, duplicate_policy); }
+
+  /// Root of the tree that holds samples at time t.  Times before zero live in the negative tree, which is
+  /// null until the channel's first negative-time sample is added.
+  TileIndex root_tile_index(double t) const {
+    return t < 0 ? negative_root_tile_index : nonnegative_root_tile_index;
+  }
+
+  /// Count a modification of samples within times
+  void record_modification(Range times) {
+    modification_count++;
+    recent_modifications[modification_count % RECENT_MODIFICATIONS] = times;
+  }
+
+  /// \param since Earlier modification_count
+  /// \return false if no samples within times have changed since modification_count was since;  true if they have,
+  /// or if that modification is too long ago to tell
+  bool modified_since(uint64 since, Range times) const {
+    if (since == modification_count) return false;
+    if (since > modification_count || modification_count - since > RECENT_MODIFICATIONS) return true;
+    for (uint64 n = since + 1; n <= modification_count; n++) {
+      if (recent_modifications[n % RECENT_MODIFICATIONS].intersects(times)) return true;
+    }
+    return false;
+  }
 };
 
 #endif
@@ -0,0 +1,135 @@
+// C++
+#include <algorithm>
+#include <cfloat>
+
+// Self
+#include "ChannelSampleRange.h"
+
+template <class T>
+static bool sample_before_time(const DataSample<T> &sample, double t) { return sample.time < t; }
+
+template <class T>
+static bool time_before_sample(double t, const DataSample<T> &sample) { return t < sample.time; }
+
+/// Index of the first sample at or after t, or in reverse, of the last sample at or before t
+template <class T>
+static long seek_index(const std::vector<DataSample<T> > &samples, double t, ChannelSampleRange::Direction direction) {
+  if (direction == ChannelSampleRange::FORWARD) {
+    return std::lower_bound(samples.begin(), samples.end(), t, sample_before_time<T>) - samples.begin();
+  }
+  return std::upper_bound(samples.begin(), samples.end(), t, time_before_sample<T>) - samples.begin() - 1;
+}
+
+template <class T>
+static const DataSample<T> *sample_at(const std::vector<DataSample<T> > &samples, long index) {
+  return 0 <= index && index < (long)samples.size() ? &samples[index] : NULL;
+}
+
+ChannelSampleRange::ChannelSampleRange(const Channel &channel, Range times, int desired_level, Direction direction)
+  : m_channel(channel), m_times(times), m_desired_level(desired_level), m_direction(direction),
+    m_ti(TileIndex::null()), m_double_index(0), m_string_index(0) {
+  seek(direction == FORWARD ? times.min : times.max);
+}
+
+double ChannelSampleRange::time() const {
+  const DataSample<double> *d = sample_at(m_tile.double_samples, m_double_index);
+  const DataSample<std::string> *s = sample_at(m_tile.string_samples, m_string_index);
+  if (m_direction == FORWARD) {
+    double t = DBL_MAX;
+    if (!done() && d) t = std::min(t, d->time);
+    if (!done() && s) t = std::min(t, s->time);
+    return t;
+  } else {
+    double t = -DBL_MAX;
+    if (!done() && d) t = std::max(t, d->time);
+    if (!done() && s) t = std::max(t, s->time);
+    return t;
+  }
+}
+
+const DataSample<double> *ChannelSampleRange::double_sample() const {
+  if (done()) return NULL;
+  const DataSample<double> *d = sample_at(m_tile.double_samples, m_double_index);
+  return d && d->time == time() ? d : NULL;
+}
+
+const DataSample<std::string> *ChannelSampleRange::string_sample() const {
+  if (done()) return NULL;
+  const DataSample<std::string> *s = sample_at(m_tile.string_samples, m_string_index);
+  return s && s->time == time() ? s : NULL;
+}
+
+ChannelSampleRange::Position ChannelSampleRange::position() const {
+  Position ret;
+  ret.time = time();
+  ret.double_sample = double_sample();
+  ret.string_sample = string_sample();
+  return ret;
+}
+
+void ChannelSampleRange::advance() {
+  if (done()) return;
+  long step = m_direction == FORWARD ? 1 : -1;
+  bool at_double = double_sample() != NULL, at_string = string_sample() != NULL;
+  if (at_double) m_double_index += step;
+  if (at_string) m_string_index += step;
+  settle();
+}
+
+void ChannelSampleRange::seek(double t) {
+  t = m_direction == FORWARD ? std::max(t, m_times.min) : std::min(t, m_times.max);
+  ChannelInfo info;
+  {
+    Channel::Locker lock(m_channel);
+    if (!m_channel.read_info(info)) {
+      m_ti = TileIndex::null();
+      return;
+    }
+  }
+  read_tile(m_channel.find_first_tile(info, t, m_desired_level));
+  m_double_index = seek_index(m_tile.double_samples, t, m_direction);
+  m_string_index = seek_index(m_tile.string_samples, t, m_direction);
+  settle();
+}
+
+/// Read tile ti, positioned at its first sample in the range's direction.  Missing tiles read as empty.
+void ChannelSampleRange::read_tile(TileIndex ti) {
+  m_ti = ti;
+  m_tile = Tile();
+  if (!m_ti.is_null()) {
+    Channel::Locker lock(m_channel);
+    m_channel.read_tile_at_level(m_ti, m_tile, m_desired_level);
+  }
+  m_double_index = m_direction == FORWARD ? 0 : (long)m_tile.double_samples.size() - 1;
+  m_string_index = m_direction == FORWARD ? 0 : (long)m_tile.string_samples.size() - 1;
+}
+
+/// Is t beyond the range in its direction?
+bool ChannelSampleRange::past_end(double t) const {
+  return m_direction == FORWARD ? t > m_times.max : t < m_times.min;
+}
+
+/// Move on from exhausted tiles until at a sample, and finish if that sample is beyond the range
+void ChannelSampleRange::settle() {
+  while (!done()) {
+    if (sample_at(m_tile.double_samples, m_double_index) || sample_at(m_tile.string_samples, m_string_index)) {
+      if (past_end(time())) m_ti = TileIndex::null();
+      return;
+    }
+    // Tiles whose times are all beyond the range hold nothing more to visit
+    if (past_end(m_direction == FORWARD ? m_ti.end_time() : m_ti.start_time())) {
+      m_ti = TileIndex::null();
+      return;
+    }
+    ChannelInfo info;
+    {
+      Channel::Locker lock(m_channel);
+      if (!m_channel.read_info(info)) {
+        m_ti = TileIndex::null();
+        return;
+      }
+    }
+    read_tile(m_direction == FORWARD ? m_channel.find_next_tile(info, m_ti, m_desired_level) :
+              m_channel.find_previous_tile(info, m_ti, m_desired_level));
+  }
+}
@@ -0,0 +1,115 @@
+#ifndef CHANNEL_SAMPLE_RANGE_INCLUDE_H
+#define CHANNEL_SAMPLE_RANGE_INCLUDE_H
+
+// C++
+#include <cstddef>
+#include <iterator>
+#include <string>
+
+// Local
+#include "Channel.h"
+#include "DataSample.h"
+#include "Range.h"
+#include "Tile.h"
+#include "TileIndex.h"
+
+/// \class ChannelSampleRange ChannelSampleRange.h
+///
+/// A channel's samples with times in a range, in time order or reverse time order.  Tiles are read one at a time,
+/// when the scan reaches them.  Double and string samples are merged:  the range is a sequence of positions, each
+/// with a time and the channel's double sample and string sample at that time, either of which may be missing.
+///
+/// Use the range as a cursor (done, time, double_sample, string_sample, advance, seek), or iterate it with begin()
+/// and end(), e.g. with standard algorithms and function objects, which the compiler can inline.  Iterators are
+/// input iterators sharing the range's position, so incrementing one moves them all.
+///
+/// A range keeps its own tile and position, so any number of ranges may be scanned at once, from one thread or
+/// several.  The channel's lock is taken while each tile is read, and not held between reads;  don't hold the
+/// channel's lock while using a range.
+class ChannelSampleRange {
+public:
+  enum Direction {
+    FORWARD,
+    REVERSE
+  };
+
+  /// \param channel Channel to read;  must outlive the range
+  /// \param times Times of samples to include, inclusive
+  /// \param desired_level Level to read.  Above the bottom level, samples are summaries (see Channel::read_data).
+  /// \param direction FORWARD to start at the earliest sample, REVERSE to start at the latest
+  ChannelSampleRange(const Channel &channel, Range times = Range::all(),
+                     int desired_level = TileIndex::lowest_level(), Direction direction = FORWARD);
+
+  /// \return true once every position has been visited
+  bool done() const { return m_ti.is_null(); }
+
+  /// \return Time of current position;  once done, DBL_MAX (FORWARD) or -DBL_MAX (REVERSE)
+  double time() const;
+
+  /// \return Double sample at current position, or NULL if none.  Valid until the range moves.
+  const DataSample<double> *double_sample() const;
+
+  /// \return String sample at current position, or NULL if none.  Valid until the range moves.
+  const DataSample<std::string> *string_sample() const;
+
+  /// Move to the next position, in the range's direction
+  void advance();
+
+  /// Move to the first position at or after t (FORWARD), or at or before t (REVERSE).  t may be behind the
+  /// current position.
+  void seek(double t);
+
+  /// One position of the range.  Pointers are valid until the range moves.
+  struct Position {
+    double time;
+    const DataSample<double> *double_sample;
+    const DataSample<std::string> *string_sample;
+  };
+
+  Position position() const;
+
+  class iterator {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef Position value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Position *pointer;
+    typedef Position reference;
+
+    explicit iterator(ChannelSampleRange *range = NULL) : m_range(range) {}
+    Position operator*() const { return m_range->position(); }
+    iterator &operator++() { m_range->advance(); return *this; }
+    void operator++(int) { m_range->advance(); }
+    /// Iterators are equal if both are at the end, or neither is
+    bool operator==(const iterator &rhs) const { return at_end() == rhs.at_end(); }
+    bool operator!=(const iterator &rhs) const { return at_end() != rhs.at_end(); }
+
+  private:
+    ChannelSampleRange *m_range;
+    bool at_end() const { return !m_range || m_range->done(); }
+  };
+
+  iterator begin() { return iterator(this); }
+  iterator end() { return iterator(); }
+
+private:
+  const Channel &m_channel;
+  Range m_times;
+  int m_desired_level;
+  Direction m_direction;
+  /// Current tile, or TileIndex::null() once done
+  TileIndex m_ti;
+  Tile m_tile;
+  /// Indexes of the next samples of each type in m_tile;  out of bounds once the tile has no more
+  long m_double_index, m_string_index;
+
+  void read_tile(TileIndex ti);
+  void settle();
+  bool past_end(double t) const;
+
+  // Not copyable;  iterators and positions point into the range
+  ChannelSampleRange(const ChannelSampleRange&);
+  ChannelSampleRange &operator=(const ChannelSampleRange&);
+};
+
+#endif
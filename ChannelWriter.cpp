@@ -0,0 +1,284 @@
+// System
+#include <algorithm>
+#include <assert.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+
+// Local
+#include "BinaryIO.h"
+#include "Log.h"
+#include "utils.h"
+
+// Self
+#include "ChannelWriter.h"
+
+/// Lock channel and read its metainformation.  If construction blocks, it's waiting for the lock.
+/// \param ch Channel to add samples to
+ChannelWriter::ChannelWriter(Channel &ch)
+  : m_ch(ch), m_lock(ch), m_modified(false), m_leaf(TileIndex::null()), m_pending_length(0),
+    m_pending_unsorted(false) {
+  m_channel_exists = m_ch.read_info(m_info);
+  m_root_ranges_known[0] = m_root_ranges_known[1] = false;
+}
+
+ChannelWriter::~ChannelWriter() {
+  if (!m_modified && m_leaf.is_null()) return;
+  try {
+    commit();
+  } catch (const std::exception &e) {
+    log_f("ChannelWriter: %s: commit failed: %s", m_ch.descriptor().c_str(), e.what());
+  }
+}
+
+void ChannelWriter::add_data(const std::vector<DataSample<double> > &data) {
+  add_data_internal(data);
+}
+
+void ChannelWriter::add_data(const std::vector<DataSample<std::string> > &data) {
+  add_data_internal(data);
+}
+
+static size_t pending_length(const DataSample<double> &sample) {
+  return BinaryWriter::write_length(sample);
+}
+
+static size_t pending_length(const DataSample<std::string> &sample) {
+  return BinaryWriter::write_length(DataSample<uint32>(0, 0)) + sample.value.length();
+}
+
+template <class T>
+void ChannelWriter::add_data_internal(const std::vector<DataSample<T> > &data) {
+  std::vector<DataSample<T> > &pending = m_pending.get_samples<T>();
+  for (unsigned i = 0; i < data.size(); i++) {
+    const DataSample<T> &sample = data[i];
+    if (!m_leaf.contains_time(sample.time)) {
+      flush_leaf();
+      select_leaf(sample.time);
+    }
+    // Sorted by flush_leaf
+    if (pending.size() && sample.time < pending.back().time) m_pending_unsorted = true;
+    pending.push_back(sample);
+    m_info.times.add(sample.time);
+    m_modified_times.add(sample.time);
+    m_pending_length += pending_length(sample);
+    // Leaf will need splitting anyway;  write it now to bound memory use
+    if (m_pending_length > m_ch.m_max_tile_size) flush_leaf();
+  }
+}
+
+/// Root of the negative or nonnegative tree
+TileIndex &ChannelWriter::root(bool negative) {
+  return negative ? m_info.negative_root_tile_index : m_info.nonnegative_root_tile_index;
+}
+
+/// Random id for a new channel, from /dev/urandom, or the time if that can't be read.  Never zero, which older
+/// channels read as.
+static uint64 new_creation_id() {
+  uint64 id = 0;
+  FILE *in = fopen("/dev/urandom", "rb");
+  if (in) {
+    if (fread(&id, sizeof(id), 1, in) != 1) id = 0;
+    fclose(in);
+  }
+  if (!id) id = microtime();
+  return id;
+}
+
+/// Start a new, empty channel.  Nothing is written until commit().
+void ChannelWriter::create_channel() {
+  memset((void*)&m_info, 0, sizeof(m_info));
+  m_info.magic = ChannelInfo::MAGIC;
+  m_info.version = ChannelInfo::VERSION;
+  m_info.times = Range();
+  m_info.nonnegative_root_tile_index = TileIndex::nonnegative_all();
+  m_unwritten.insert(TileIndex::nonnegative_all());
+  m_info.negative_root_tile_index = TileIndex::null();
+  m_info.duplicate_policy = DUPLICATES_OVERWRITE;
+  m_info.creation_id = new_creation_id();
+  m_channel_exists = true;
+  m_modified = true;
+}
+
+void ChannelWriter::set_duplicate_policy(DuplicatePolicy policy) {
+  if (!m_channel_exists) create_channel();
+  if (m_info.duplicate_policy == (uint32)policy) return;
+  // Samples already buffered are combined under the old policy
+  flush_leaf();
+  m_info.duplicate_policy = policy;
+  m_modified = true;
+}
+
+/// Select the bottom-level tile containing time t to receive buffered samples, creating the channel or the
+/// negative tree, or moving the root upwards, as needed
+void ChannelWriter::select_leaf(double t) {
+  if (!m_channel_exists) create_channel();
+
+  TileIndex &tree_root = root(t < 0);
+  if (tree_root.is_null()) {
+    tree_root = TileIndex::negative_all();
+    m_unwritten.insert(TileIndex::negative_all());
+    m_modified = true;
+  }
+
+  if (!tree_root.contains_time(t)) {
+    TileIndex new_root = tree_root;
+    while (!new_root.contains_time(t)) new_root = new_root.parent();
+    move_root_upwards(tree_root, new_root);
+  }
+
+  // Move downwards from the root to the lowest existing tile
+  TileIndex ti = tree_root;
+  while (1) {
+    TileIndex child = t < ti.left_child().end_time() ? ti.left_child() : ti.right_child();
+    if (child.is_null() || !tile_exists(child)) break;
+    ti = child;
+  }
+  m_leaf = ti;
+}
+
+/// Move root of tree upwards to new_root, an ancestor of the current root.  The siblings of the old root and its
+/// ancestors start out empty, and the ancestors are regenerated by commit();  neither is written until then.
+void ChannelWriter::move_root_upwards(TileIndex &tree_root, TileIndex new_root) {
+  if (Channel::verbosity) log_f("ChannelWriter: %s moving root from %s to %s", m_ch.descriptor().c_str(),
+                                tree_root.to_string().c_str(), new_root.to_string().c_str());
+  for (TileIndex ti = tree_root; ti != new_root; ti = ti.parent()) {
+    m_unwritten.insert(ti.sibling());
+    m_unwritten.insert(ti.parent());
+    m_to_regenerate[ti.parent().level].push_back(ti.parent());
+  }
+  m_root_ranges_known[tree_root.is_negative()] = false;
+  // Tiles under the old root may now be read at a different level of detail
+  m_modified_times.add(Range(tree_root.start_time(), tree_root.end_time()));
+  tree_root = new_root;
+  m_modified = true;
+}
+
+/// Merge buffered samples into the selected leaf, splitting it if needed, and write it
+void ChannelWriter::flush_leaf() {
+  if (m_leaf.is_null()) return;
+  TileIndex ti = m_leaf;
+  m_leaf = TileIndex::null();
+  if (m_pending.double_samples.empty() && m_pending.string_samples.empty()) return;
+
+  Tile tile;
+  read_tile(ti, tile);
+  DuplicatePolicy policy = (DuplicatePolicy)m_info.duplicate_policy;
+  if (m_pending_unsorted) {
+    // Stable, so samples at the same time are combined in the order they were added
+    std::stable_sort(m_pending.double_samples.begin(), m_pending.double_samples.end(),
+                     DataSample<double>::time_lessthan);
+    std::stable_sort(m_pending.string_samples.begin(), m_pending.string_samples.end(),
+                     DataSample<std::string>::time_lessthan);
+    m_pending_unsorted = false;
+  }
+  if (m_pending.double_samples.size()) {
+    tile.insert_samples(&m_pending.double_samples[0], &m_pending.double_samples[m_pending.double_samples.size()],
+                        policy);
+    m_pending.double_samples.clear();
+  }
+  if (m_pending.string_samples.size()) {
+    tile.insert_samples(&m_pending.string_samples[0], &m_pending.string_samples[m_pending.string_samples.size()],
+                        policy);
+    m_pending.string_samples.clear();
+  }
+  m_pending_length = 0;
+
+  // Splitting changes the level of detail of all of the leaf's samples, not only the added ones
+  if (tile.binary_length() > m_ch.m_max_tile_size) m_modified_times.add(Range(ti.start_time(), ti.end_time()));
+  TileIndex new_root = m_ch.split_tile_if_needed(ti, tile);
+  if (new_root != TileIndex::null()) {
+    assert(ti.is_all());
+    if (Channel::verbosity) log_f("ChannelWriter: %s changing root from %s to %s", m_ch.descriptor().c_str(),
+                                  ti.to_string().c_str(), new_root.to_string().c_str());
+    root(ti.is_negative()) = new_root;
+    if (!m_unwritten.erase(ti)) m_ch.delete_tile(ti); // Delete old root
+    ti = new_root;
+  }
+  write_tile(ti, tile);
+  m_modified = true;
+}
+
+/// Regenerate modified tiles from their children, from lowest level to highest.  Each level's tiles are sorted
+/// and deduplicated once, then each is written once and its parent scheduled for the next level.
+void ChannelWriter::regenerate() {
+  while (!m_to_regenerate.empty()) {
+    std::vector<TileIndex> tiles;
+    tiles.swap(m_to_regenerate.begin()->second);
+    m_to_regenerate.erase(m_to_regenerate.begin());
+    std::sort(tiles.begin(), tiles.end());
+    tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+
+    for (unsigned i = 0; i < tiles.size(); i++) {
+      Tile regenerated, children[2];
+      read_tile(tiles[i].left_child(), children[0]);
+      read_tile(tiles[i].right_child(), children[1]);
+      m_ch.create_parent_tile_from_children(tiles[i], regenerated, children);
+      write_tile(tiles[i], regenerated);
+    }
+  }
+}
+
+bool ChannelWriter::tile_exists(TileIndex ti) const {
+  return m_unwritten.count(ti) || m_ch.tile_exists(ti);
+}
+
+/// Read tile, which must be part of the tree.  Tiles not yet written read as empty.
+void ChannelWriter::read_tile(TileIndex ti, Tile &tile) const {
+  if (m_unwritten.count(ti)) {
+    tile = Tile();
+  } else {
+    assert(m_ch.read_tile(ti, tile));
+  }
+}
+
+/// Write tile, and either remember the ranges of a root or schedule regeneration of the parent
+void ChannelWriter::write_tile(TileIndex ti, const Tile &tile) {
+  m_ch.write_tile(ti, tile);
+  m_unwritten.erase(ti);
+  if (ti == root(ti.is_negative())) {
+    m_root_ranges[ti.is_negative()] = tile.ranges;
+    m_root_ranges_known[ti.is_negative()] = true;
+  } else {
+    m_to_regenerate[ti.level + 1].push_back(ti.parent());
+  }
+}
+
+void ChannelWriter::commit(DataRanges *channel_ranges) {
+  flush_leaf();
+
+  // Write empty tiles that never received samples;  their parents are already scheduled for regeneration
+  std::vector<TileIndex> empty_tiles;
+  for (std::set<TileIndex>::iterator i = m_unwritten.begin(); i != m_unwritten.end(); ++i) {
+    if (!tile_exists(i->left_child())) empty_tiles.push_back(*i);
+  }
+  for (unsigned i = 0; i < empty_tiles.size(); i++) write_tile(empty_tiles[i], Tile());
+
+  regenerate();
+  assert(m_unwritten.empty());
+
+  if (!m_modified_times.empty()) {
+    m_info.record_modification(m_modified_times);
+    m_modified_times.clear();
+  }
+
+  // Write metainformation last;  until now, readers see the channel as it was
+  if (m_modified) m_ch.write_info(m_info);
+  m_modified = false;
+
+  if (channel_ranges) {
+    // Report ranges of the whole channel;  read the root of any tree we didn't modify
+    channel_ranges->clear();
+    for (int negative = 0; negative < 2; negative++) {
+      TileIndex tree_root = root(negative);
+      if (!m_channel_exists || tree_root.is_null()) continue;
+      if (!m_root_ranges_known[negative]) {
+        Tile tile;
+        if (!m_ch.read_tile(tree_root, tile)) continue;
+        m_root_ranges[negative] = tile.ranges;
+        m_root_ranges_known[negative] = true;
+      }
+      channel_ranges->add(m_root_ranges[negative]);
+    }
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef CHANNEL_WRITER_INCLUDE_H
+#define CHANNEL_WRITER_INCLUDE_H
+
+// C++
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Local includes
+#include "Channel.h"
+#include "ChannelInfo.h"
+#include "DataSample.h"
+#include "Tile.h"
+#include "TileIndex.h"
+
+/// \class ChannelWriter ChannelWriter.h
+///
+/// Adds samples to a channel incrementally, in chunks, with memory bounded by the channel's maximum tile size.
+///
+/// Samples are buffered for one bottom-level tile at a time.  When a sample arrives for a different tile, or the
+/// buffer grows past the maximum tile size, the buffered samples are merged into the tile, which is split if needed
+/// and written.  Ancestors of written tiles are regenerated once, and the channel's metainformation written, by
+/// commit().
+///
+/// Tiles created by moving a root upwards aren't written until they're first needed, so each tile is written once
+/// per commit unless out-of-order samples or a full buffer force a bottom-level tile to be written again.  The
+/// metainformation is written last, so readers see the new tiles only once they're all in place.  Each commit that
+/// changes samples counts one modification of the channel, recording the times that changed (see ChannelInfo).
+///
+/// Chunks should arrive in ascending time.  Out-of-order samples within the buffered tile are sorted when it's
+/// written;  a sample for a different tile forces the buffered tile to be written and later re-read.
+///
+/// Locking:  the channel is locked from construction until destruction.  The destructor commits any uncommitted
+/// samples.
+class ChannelWriter {
+public:
+  ChannelWriter(Channel &ch);
+  ~ChannelWriter();
+
+  /// Set how samples at the same time as existing samples are combined, for this and future writes to the channel.
+  /// Creates the channel if it doesn't exist.
+  void set_duplicate_policy(DuplicatePolicy policy);
+
+  void add_data(const std::vector<DataSample<double> > &data);
+  void add_data(const std::vector<DataSample<std::string> > &data);
+
+  /// Write buffered samples, regenerate ancestors of modified tiles, and write channel metainformation
+  /// \param channel_ranges If non-NULL, returns ranges of the whole channel
+  void commit(DataRanges *channel_ranges = NULL);
+
+private:
+  Channel &m_ch;
+  Channel::Locker m_lock;
+  ChannelInfo m_info;
+  bool m_channel_exists;
+  bool m_modified;
+  /// Bottom-level tile receiving buffered samples, or TileIndex::null() if none
+  TileIndex m_leaf;
+  /// Samples buffered for m_leaf
+  Tile m_pending;
+  size_t m_pending_length;
+  /// Set if samples were buffered out of order
+  bool m_pending_unsorted;
+  /// Times whose samples, or the tiles holding them, changed since the last commit
+  Range m_modified_times;
+  /// Tiles to regenerate from their children, by level
+  std::map<int, std::vector<TileIndex> > m_to_regenerate;
+  /// Tiles that are part of the tree but haven't been written yet;  they read as empty
+  std::set<TileIndex> m_unwritten;
+  /// Ranges of the negative and nonnegative roots, when known
+  DataRanges m_root_ranges[2];
+  bool m_root_ranges_known[2];
+
+  template <class T>
+  void add_data_internal(const std::vector<DataSample<T> > &data);
+  TileIndex &root(bool negative);
+  void create_channel();
+  void select_leaf(double t);
+  void move_root_upwards(TileIndex &tree_root, TileIndex new_root);
+  void flush_leaf();
+  void regenerate();
+  bool tile_exists(TileIndex ti) const;
+  void read_tile(TileIndex ti, Tile &tile) const;
+  void write_tile(TileIndex ti, const Tile &tile);
+};
+
+#endif
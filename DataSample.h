@@ -43,6 +43,38 @@ inline bool DataSample<std::string>::is_deletion_value() const {
   return false;
 }
 
+/// How to combine a sample added at the same time as an existing sample.  Stored per channel in ChannelInfo.
+enum DuplicatePolicy {
+  DUPLICATES_OVERWRITE = 0,  // Later sample replaces earlier
+  DUPLICATES_KEEP_FIRST = 1, // Earlier sample is kept
+  DUPLICATES_MEAN = 2,       // Weighted mean of the samples
+  DUPLICATES_SUM = 3,        // Sum of the values
+  DUPLICATES_MAX = 4         // Sample with the greatest value
+};
+
+inline const char *duplicate_policy_name(DuplicatePolicy policy) {
+  switch (policy) {
+  case DUPLICATES_OVERWRITE: return "overwrite";
+  case DUPLICATES_KEEP_FIRST: return "keep-first";
+  case DUPLICATES_MEAN: return "mean";
+  case DUPLICATES_SUM: return "sum";
+  case DUPLICATES_MAX: return "max";
+  }
+  return "unknown";
+}
+
+/// Parse policy name, as returned by duplicate_policy_name
+/// \return true if name is a valid policy
+inline bool parse_duplicate_policy(const std::string &name, DuplicatePolicy &policy) {
+  for (int i = DUPLICATES_OVERWRITE; i <= DUPLICATES_MAX; i++) {
+    if (name == duplicate_policy_name((DuplicatePolicy)i)) {
+      policy = (DuplicatePolicy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
 template <class V>
 struct DataAccumulator {
   DataAccumulator() : timesum(0), sum(V()), sumsq(V()), weight(0) {}
@@ -95,7 +127,7 @@ private:
     if (lhs.weight==0) {
       lhs.sum=rhs.value;
     } else if (lhs.sum != rhs.value) {
-      lhs.sum="<multiple>"; // TODO: should we do some hashing to speed keyword search?
+      lhs.sum="<multiple>"; // Keyword searches use the tiles' token filters instead (see TokenFilter)
     }
     lhs.weight += rhs.weight;
   }
@@ -111,6 +143,47 @@ private:
   }
 };
 
+/// Combine incoming with existing, a sample at the same time, according to policy
+inline void combine_duplicate(DataSample<double> &existing, const DataSample<double> &incoming,
+                              DuplicatePolicy policy) {
+  switch (policy) {
+  case DUPLICATES_KEEP_FIRST:
+    break;
+  case DUPLICATES_MEAN: {
+    DataAccumulator<double> acc;
+    acc += existing;
+    acc += incoming;
+    double time = existing.time;
+    existing = acc.get_sample();
+    existing.time = time;
+    break;
+  }
+  case DUPLICATES_SUM:
+    existing.value += incoming.value;
+    break;
+  case DUPLICATES_MAX:
+    if (incoming.value > existing.value) existing = incoming;
+    break;
+  default:
+    existing = incoming;
+  }
+}
+
+/// Combine incoming with existing, a sample at the same time, according to policy.  Text can't be averaged or
+/// summed, so mean and sum overwrite;  max selects the lexically greatest.
+inline void combine_duplicate(DataSample<std::string> &existing, const DataSample<std::string> &incoming,
+                              DuplicatePolicy policy) {
+  switch (policy) {
+  case DUPLICATES_KEEP_FIRST:
+    break;
+  case DUPLICATES_MAX:
+    if (incoming.value > existing.value) existing = incoming;
+    break;
+  default:
+    existing = incoming;
+  }
+}
+
 struct DataRanges {
   Range times;
   Range double_samples;
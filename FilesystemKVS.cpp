@@ -6,6 +6,7 @@
 #include <string.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 // C++
@@ -18,9 +19,18 @@
 // Self
 #include "FilesystemKVS.h"
 
+#ifdef __APPLE__
+#define ST_MTIM st_mtimespec
+#define ST_CTIM st_ctimespec
+#else
+#define ST_MTIM st_mtim
+#define ST_CTIM st_ctim
+#endif
+
 // \brief Instantiate FilesystemKVS
 // \param root Directory to use as root of store.  Should already exist
-FilesystemKVS::FilesystemKVS(const char *root) : m_root(root) {
+FilesystemKVS::FilesystemKVS(const char *root) : m_root(root), m_cache_max_bytes(0), m_cacheable(0), m_cache_bytes(0) {
+  pthread_mutex_init(&m_cache_mutex, NULL);
   if (m_root == "" || m_root[m_root.size()-1] == '/')
     throw std::runtime_error("store path " + std::string(root) + " shouldn't end with '/'");
   if (!filename_exists(root))
@@ -28,6 +38,19 @@ FilesystemKVS::FilesystemKVS(const char *root) : m_root(root) {
   if (m_verbose) log_f("FilesystemKVS: opening %s", root);
 }
 
+FilesystemKVS::~FilesystemKVS() {
+  pthread_mutex_destroy(&m_cache_mutex);
+}
+
+/// Call before sharing the store between threads
+void FilesystemKVS::set_cache_size(size_t max_bytes, bool (*cacheable)(const std::string &key)) {
+  pthread_mutex_lock(&m_cache_mutex);
+  m_cache_max_bytes = max_bytes;
+  m_cacheable = cacheable;
+  cache_evict();
+  pthread_mutex_unlock(&m_cache_mutex);
+}
+
 /// \brief Check if key exists
 /// \param key
 /// \return Returns true if found, false if not
@@ -56,6 +79,7 @@ void FilesystemKVS::set(const std::string &key, const std::string &value) {
   }
   if (m_verbose) log_f("FilesystemKVS::set(%s) wrote %zd bytes to %s", key.c_str(), value.length(), path.c_str());
   fclose(out);
+  cache_erase(key);
 }
 
 /// \brief Get value
@@ -66,12 +90,17 @@ void FilesystemKVS::set(const std::string &key, const std::string &value) {
 /// See FilesystemKVS class description for the mapping between datastore and filesystem.
 bool FilesystemKVS::get(const std::string &key, std::string &value) const {
   std::string path = value_key_to_path(key);
+  struct stat statbuf;
+  bool use_cache = m_cache_max_bytes && (!m_cacheable || m_cacheable(key));
+  if (use_cache && 0 == stat(path.c_str(), &statbuf) && cache_lookup(key, statbuf, value)) {
+    if (m_verbose) log_f("FilesystemKVS::get(%s) found %zd bytes in cache", key.c_str(), value.length());
+    return true;
+  }
   FILE *in = fopen(path.c_str(), "rb");
   if (!in) {
     if (m_verbose) log_f("FilesystemKVS::get(%s) found no file at %s, returning false", key.c_str(), path.c_str());
     return false;
   }
-  struct stat statbuf;
   if (0 != fstat(fileno(in), &statbuf)) {
     fclose(in);
     throw std::runtime_error("fstat " + path);
@@ -85,6 +114,14 @@ bool FilesystemKVS::get(const std::string &key, std::string &value) const {
   }
   fclose(in);
   if (m_verbose) log_f("FilesystemKVS::get(%s) read %zd bytes from %s", key.c_str(), value.length(), path.c_str());
+  if (use_cache) {
+    // A file changed this recently may be rewritten again without its stat changing
+    if (statbuf.ST_CTIM.tv_sec < time(NULL) - 1) {
+      cache_insert(key, statbuf, value);
+    } else {
+      cache_erase(key);
+    }
+  }
   return true;
 }
 
@@ -93,6 +130,7 @@ bool FilesystemKVS::get(const std::string &key, std::string &value) const {
 /// \return Returns true if deleted, false if not present
 bool FilesystemKVS::del(const std::string &key) {
   std::string path = value_key_to_path(key);
+  cache_erase(key);
   return unlink(path.c_str()) == 0;
 }
 
@@ -172,6 +210,75 @@ void FilesystemKVS::unlock(void *lock) {
   if (m_verbose) log_f("FilesystemKVS::unlock unlocked fd %d", fd);
 }
 
+/// True if both stats describe the same version of the same file
+static bool same_file_version(const struct stat &a, const struct stat &b) {
+  return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+    a.ST_MTIM.tv_sec == b.ST_MTIM.tv_sec && a.ST_MTIM.tv_nsec == b.ST_MTIM.tv_nsec &&
+    a.ST_CTIM.tv_sec == b.ST_CTIM.tv_sec && a.ST_CTIM.tv_nsec == b.ST_CTIM.tv_nsec;
+}
+
+/// Get cached value of key, if present and file is unchanged since it was cached
+/// \param statbuf Current stat of the file storing key's value
+/// \return Returns true if found
+bool FilesystemKVS::cache_lookup(const std::string &key, const struct stat &statbuf, std::string &value) const {
+  bool found = false;
+  pthread_mutex_lock(&m_cache_mutex);
+  std::map<std::string, CacheEntry>::iterator entry = m_cache.find(key);
+  if (entry != m_cache.end() && same_file_version(entry->second.statbuf, statbuf)) {
+    value = entry->second.value;
+    m_cache_lru.splice(m_cache_lru.begin(), m_cache_lru, entry->second.lru_position);
+    found = true;
+  }
+  pthread_mutex_unlock(&m_cache_mutex);
+  return found;
+}
+
+/// Cache value of key, then evict least recently used values until the cache fits.  Values larger than a quarter of
+/// the cache aren't cached.
+/// \param statbuf Stat of the file value was read from
+void FilesystemKVS::cache_insert(const std::string &key, const struct stat &statbuf, const std::string &value) const {
+  pthread_mutex_lock(&m_cache_mutex);
+  if (value.size() <= m_cache_max_bytes / 4) {
+    std::map<std::string, CacheEntry>::iterator entry = m_cache.find(key);
+    if (entry == m_cache.end()) {
+      entry = m_cache.insert(std::make_pair(key, CacheEntry())).first;
+      m_cache_lru.push_front(key);
+    } else {
+      m_cache_bytes -= entry->second.value.size();
+      m_cache_lru.erase(entry->second.lru_position);
+      m_cache_lru.push_front(key);
+    }
+    entry->second.value = value;
+    entry->second.statbuf = statbuf;
+    entry->second.lru_position = m_cache_lru.begin();
+    m_cache_bytes += value.size();
+  }
+  cache_evict();
+  pthread_mutex_unlock(&m_cache_mutex);
+}
+
+/// Evict least recently used values until the cache fits.  Call with m_cache_mutex locked.
+void FilesystemKVS::cache_evict() const {
+  while (m_cache_bytes > m_cache_max_bytes) {
+    std::map<std::string, CacheEntry>::iterator entry = m_cache.find(m_cache_lru.back());
+    m_cache_bytes -= entry->second.value.size();
+    m_cache.erase(entry);
+    m_cache_lru.pop_back();
+  }
+}
+
+void FilesystemKVS::cache_erase(const std::string &key) const {
+  if (!m_cache_max_bytes) return;
+  pthread_mutex_lock(&m_cache_mutex);
+  std::map<std::string, CacheEntry>::iterator entry = m_cache.find(key);
+  if (entry != m_cache.end()) {
+    m_cache_bytes -= entry->second.value.size();
+    m_cache_lru.erase(entry->second.lru_position);
+    m_cache.erase(entry);
+  }
+  pthread_mutex_unlock(&m_cache_mutex);
+}
+
 /// Return path to file that stores the value associated with key
 /// \param key Key
 /// \return Returns path to file that stores value associated with key
@@ -1,6 +1,16 @@
 #ifndef FILESYSTEM_KVS_H
 #define FILESYSTEM_KVS_H
 
+// C++
+#include <list>
+#include <map>
+#include <string>
+
+// C
+#include <pthread.h>
+#include <sys/stat.h>
+
+// Local
 #include "KVS.h"
 
 /// \class FilesystemKVS FilesystemKVS.h
@@ -8,6 +18,15 @@
 ///
 /// Filesystem layout:
 /// Each key corresponds to a file in the filesystem.  Keys names are translated to file path by converting all "." characters to "/".
+///
+/// Value cache:
+/// Long-running processes can keep recently read values in memory with set_cache_size().  Each get() still stats the file,
+/// and uses the cached value only if the file's inode, size and modification and change times are unchanged, so writes
+/// from other processes are seen.  set() rewrites files in place, so a rewrite within one tick of the filesystem's clock
+/// can leave all of those unchanged;  values of files changed in the last couple of seconds aren't cached, so a cached
+/// value's file was already old when read, and any later write changes its times.  That relies on the filesystem's clock
+/// agreeing with ours;  keys that must never be stale can be left out of the cache (see set_cache_size).  The cache is
+/// safe to use from multiple threads.
 
 class FilesystemKVS : public KVS {
 public:
@@ -18,10 +37,32 @@ public:
   virtual bool del(const std::string &key);
   virtual void get_subkeys(const std::string &key, std::vector<std::string> &keys, 
 			   unsigned int nlevels=-1, bool (*subdir_filter)(const char *subdirname)=0) const;
-  virtual ~FilesystemKVS() {}
+  virtual ~FilesystemKVS();
+
+  /// Keep up to max_bytes of recently read values in memory.  0 (the default) disables the cache.
+  /// \param cacheable If non-NULL, only keys for which it returns true are cached
+  void set_cache_size(size_t max_bytes, bool (*cacheable)(const std::string &key)=0);
 private:
   std::string m_root;
 
+  struct CacheEntry {
+    std::string value;
+    struct stat statbuf;
+    std::list<std::string>::iterator lru_position;
+  };
+  size_t m_cache_max_bytes;
+  bool (*m_cacheable)(const std::string &key);
+  mutable size_t m_cache_bytes;
+  /// Most recently used key first
+  mutable std::list<std::string> m_cache_lru;
+  mutable std::map<std::string, CacheEntry> m_cache;
+  mutable pthread_mutex_t m_cache_mutex;
+
+  bool cache_lookup(const std::string &key, const struct stat &statbuf, std::string &value) const;
+  void cache_insert(const std::string &key, const struct stat &statbuf, const std::string &value) const;
+  void cache_erase(const std::string &key) const;
+  void cache_evict() const;
+
   std::string value_key_to_path(const std::string &key) const;
   std::string directory_key_to_path(const std::string &key) const;
   static void make_parent_directories(const std::string &path);
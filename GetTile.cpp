@@ -0,0 +1,580 @@
+// C++
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// C
+#include <math.h>
+#include <pthread.h>
+
+// Local
+#include "Binning.h"
+#include "Channel.h"
+#include "JsonWriter.h"
+#include "Log.h"
+#include "simple_shared_ptr.h"
+#include "ThreadPool.h"
+#include "utils.h"
+
+// Self
+#include "GetTile.h"
+
+/// Translation between tile request and tilestore:
+/// tile: level 0 is 512 samples in 512 seconds
+/// store: level 0 is 65536 samples in 1 second
+/// for tile level 0, we want to get store level 14, which is 65536 samples in 16384 seconds
+/// Levels differ by 9 between client and server
+TileIndex client_to_store_tile_index(int tile_level, long long tile_offset) {
+  return TileIndex(tile_level+9, tile_offset);
+}
+
+/// Read the closest existing ancestor of requested_index once, keeping both the double and string samples within
+/// client_tile_index
+/// \param samples Returns samples in double_samples and string_samples
+void read_client_tile(KVS &store, int uid, const std::string &full_channel_name, TileIndex requested_index,
+                      TileIndex client_tile_index, Tile &samples)
+{
+  simple_shared_ptr<Channel> ch;
+  if (uid == -1) {
+    ch.reset(new Channel(store, full_channel_name));
+  } else {
+    ch.reset(new Channel(store, uid, full_channel_name));
+  }
+  Tile tile;
+  TileIndex actual_index;
+  bool success = ch->read_tile_or_closest_ancestor(requested_index, actual_index, tile);
+  
+  if (!success) {
+    log_f("gettile: no tile found for %s", requested_index.to_string().c_str());
+  } else {
+    log_f("gettile: requested %s: found %s", requested_index.to_string().c_str(), actual_index.to_string().c_str());
+    for (unsigned i = 0; i < tile.double_samples.size(); i++) {
+      DataSample<double> &sample=tile.double_samples[i];
+      if (client_tile_index.contains_time(sample.time)) samples.double_samples.push_back(sample);
+    }
+    for (unsigned i = 0; i < tile.string_samples.size(); i++) {
+      DataSample<std::string> &sample=tile.string_samples[i];
+      if (client_tile_index.contains_time(sample.time)) samples.string_samples.push_back(sample);
+    }
+  }
+}
+
+/// Bin samples into 512 bins if there are more than 512, or always if force_regular_binning is set
+/// \param force_regular_binning If set, returns exactly 512 samples, centered in their bins, even if empty
+/// \param binned Returns true if samples were binned
+template <typename T>
+void bin_tile_samples(TileIndex client_tile_index, bool force_regular_binning,
+                      std::vector<DataSample<T> > &samples, bool &binned)
+{
+  if (samples.size() <= 512 && !force_regular_binning) {
+    binned = false;
+  } else {
+    // Bin
+    binned = true;
+    std::vector<DataAccumulator<T> > bins(512);
+    if (samples.size()) bin_samples(client_tile_index, &samples[0], &samples[0] + samples.size(), bins);
+    samples.clear();
+    for (unsigned i = 0; i < bins.size(); i++) {
+      if (bins[i].weight > 0 || force_regular_binning) {
+        DataSample<T> sample = bins[i].get_sample();
+        if (force_regular_binning) {
+          sample.time = client_tile_index.start_time() + 
+            client_tile_index.duration() * (i + 0.5) / 512.0;
+        }
+        samples.push_back(sample);
+      }
+    }
+  }
+}
+
+/// Arguments and results of read_client_tile, for running on a worker thread
+struct ClientTileRead {
+  KVS *store;
+  int uid;
+  std::string full_channel_name;
+  TileIndex requested_index;
+  TileIndex client_tile_index;
+  Tile samples;
+  std::string error;
+};
+
+static void run_client_tile_read(void *arg) {
+  ClientTileRead *read = (ClientTileRead*)arg;
+  try {
+    read_client_tile(*read->store, read->uid, read->full_channel_name, read->requested_index,
+                     read->client_tile_index, read->samples);
+  } catch (const std::exception &e) {
+    read->error = e.what();
+    if (read->error == "") read->error = "unknown error";
+  }
+}
+
+/// Workers that help multi-channel requests read their channels, shared by all requests so none starts threads of its
+/// own.  Sized by the first request's max_parallel_reads;  gettile and tileserver pass the same value to every request.
+static ThreadPool *read_pool(int max_parallel_reads) {
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  static ThreadPool *pool = NULL;
+  pthread_mutex_lock(&mutex);
+  if (!pool) pool = new ThreadPool(std::max(1, max_parallel_reads - 1));
+  pthread_mutex_unlock(&mutex);
+  return pool;
+}
+
+/// Read, then bin doubles into exactly 512 regular bins, as for multi_gettile_json
+static void run_binned_client_tile_read(void *arg) {
+  ClientTileRead *read = (ClientTileRead*)arg;
+  run_client_tile_read(read);
+  if (read->error != "") return;
+  bool binned;
+  bin_tile_samples(read->client_tile_index, true, read->samples.double_samples, binned);
+}
+
+struct GraphSample {
+  double time;
+  bool has_value;
+  double value;
+  double stddev;
+  double weight;
+  /// Points into the string samples the row was made from;  NULL if the row has no comment
+  const std::string *comment;
+  GraphSample(const DataSample<double> &x, const std::string *comment = NULL)
+    : time(x.time), has_value(true), value(x.value), stddev(x.stddev), weight(x.weight), comment(comment) {}
+  GraphSample(const DataSample<std::string> &x) : time(x.time), has_value(false), value(0), stddev(x.stddev),
+                                                  weight(x.weight), comment(&x.value) {}
+};
+
+/// Merge two time-sorted sequences of string samples, taking a's first at equal times
+static void merge_string_samples(const std::vector<DataSample<std::string> > &a,
+                                 const std::vector<DataSample<std::string> > &b,
+                                 std::vector<const DataSample<std::string>*> &merged) {
+  merged.clear();
+  merged.reserve(a.size() + b.size());
+  size_t i = 0, j = 0;
+  while (i < a.size() || j < b.size()) {
+    if (j == b.size() || (i < a.size() && a[i].time <= b[j].time)) {
+      merged.push_back(&a[i++]);
+    } else {
+      merged.push_back(&b[j++]);
+    }
+  }
+}
+
+/// Merge time-sorted doubles and strings into rows.  A string at the same time as doubles becomes the comment of the
+/// last of them, and those doubles have no rows of their own;  other strings become rows without values.
+static void merge_graph_samples(const std::vector<DataSample<double> > &doubles,
+                                const std::vector<const DataSample<std::string>*> &strings,
+                                std::vector<GraphSample> &graph_samples) {
+  graph_samples.clear();
+  graph_samples.reserve(doubles.size() + strings.size());
+  size_t i = 0, j = 0;
+  while (i < doubles.size() || j < strings.size()) {
+    if (j < strings.size() && (i == doubles.size() || strings[j]->time <= doubles[i].time)) {
+      double t = strings[j]->time;
+      const DataSample<double> *match = NULL;
+      for (; i < doubles.size() && doubles[i].time == t; i++) match = &doubles[i];
+      for (; j < strings.size() && strings[j]->time == t; j++) {
+        graph_samples.push_back(match ? GraphSample(*match, &strings[j]->value) : GraphSample(*strings[j]));
+      }
+    } else {
+      graph_samples.push_back(GraphSample(doubles[i++]));
+    }
+  }
+}
+
+/// Read multiple channels' tiles, binned into 512 regular bins, and find the bins in which at least one channel has
+/// data.  Up to max_parallel_reads channels are read at once.
+void read_multi_tile(KVS &store, int uid, const std::vector<std::string> &full_channel_names,
+                     int tile_level, long long tile_offset, int max_parallel_reads, MultiTile &ret) {
+  TileIndex client_tile_index = client_to_store_tile_index(tile_level, tile_offset);
+  // 5th ancestor
+  TileIndex requested_index = client_tile_index.parent().parent().parent().parent().parent();
+  
+  const int TILE_BINS = 512;
+
+  std::vector<ClientTileRead> reads(full_channel_names.size());
+  std::vector<void*> args(reads.size());
+  for (unsigned i = 0; i < full_channel_names.size(); i++) {
+    reads[i].store = &store;
+    reads[i].uid = uid;
+    reads[i].full_channel_name = full_channel_names[i];
+    reads[i].requested_index = requested_index;
+    reads[i].client_tile_index = client_tile_index;
+    args[i] = &reads[i];
+  }
+  read_pool(max_parallel_reads)->run_all(run_binned_client_tile_read, args, max_parallel_reads - 1);
+
+  ret.level = tile_level;
+  ret.offset = tile_offset;
+  ret.sample_width = client_tile_index.duration() / TILE_BINS;
+  ret.full_channel_names = full_channel_names;
+  ret.bins.resize(reads.size());
+  for (unsigned i = 0; i < reads.size(); i++) {
+    if (reads[i].error != "") throw std::runtime_error(reads[i].error);
+    assert(reads[i].samples.double_samples.size() == TILE_BINS);
+    ret.bins[i].swap(reads[i].samples.double_samples);
+  }
+
+  for (unsigned i = 0; i < TILE_BINS; i++) {
+    // don't bother returning this record if all the values are null
+    bool hasAtLeastOneNonNullField = false;
+    for (unsigned j = 0; j < ret.bins.size(); j++) {
+      DataSample<double> &sample = ret.bins[j][i];
+      assert(sample.time == ret.bins[0][i].time);
+      if (sample.weight > 0) hasAtLeastOneNonNullField = true;
+    }
+    if (hasAtLeastOneNonNullField) ret.rows.push_back(i);
+  }
+}
+
+/// Render tile of multiple channels as JSON, as output by gettile --multi.  Each channel is binned into 512 regular
+/// bins, and a row is output for each bin in which at least one channel has data.
+/// \param uid Owner of channels, or -1 if each of full_channel_names starts with UID
+/// \param tile_level Client tile level;  client level 0 is 512 samples in 512 seconds
+/// \param tile_offset Client tile offset
+/// \param max_parallel_reads Maximum number of channels to read at once
+/// \return JSON, including trailing newline
+std::string multi_gettile_json(KVS &store, int uid, const std::vector<std::string> &full_channel_names,
+                               int tile_level, long long tile_offset, int max_parallel_reads) {
+  MultiTile tile;
+  read_multi_tile(store, uid, full_channel_names, tile_level, tile_offset, max_parallel_reads, tile);
+
+  // Members in alphabetical order, as Json::FastWriter would write them
+  std::string out;
+  out.reserve(64 * tile.rows.size() + 64);
+  JsonWriter json(out);
+  json.begin_object();
+  json.key("data");
+  json.begin_array();
+  for (unsigned r = 0; r < tile.rows.size(); r++) {
+    unsigned i = tile.rows[r];
+    json.begin_array();
+    json.value(tile.bins[0][i].time);
+    for (unsigned j = 0; j < tile.bins.size(); j++) {
+      DataSample<double> &sample = tile.bins[j][i];
+      if (sample.weight > 0) {
+        json.value(sample.value);
+      } else {
+        json.null_value(); // NULL means no data
+      }
+    }
+    json.end_array();
+  }
+  json.end_array();
+
+  json.key("full_channel_names");
+  json.begin_array();
+  for (unsigned i = 0; i < full_channel_names.size(); i++) json.value(full_channel_names[i]);
+  json.end_array();
+  json.end_object();
+  out += "\n";
+  return out;
+}
+
+template <class T>
+static void append_binary(std::string &out, const T &value) {
+  out.append((const char*)&value, sizeof(value));
+}
+
+static void append_binary(std::string &out, const std::vector<double> &values) {
+  if (values.size()) out.append((const char*)&values[0], values.size() * sizeof(double));
+}
+
+/// Append zeros until out's length is a multiple of alignment
+static void append_padding(std::string &out, size_t alignment) {
+  out.append((alignment - out.size() % alignment) % alignment, '\0');
+}
+
+/// Append header of binary tile format;  see GetTile.h
+static void append_binary_header(std::string &out, const std::vector<std::string> &fields, unsigned nrows,
+                                 int level, long long offset, double sample_width) {
+  out.append(BINARY_TILE_MAGIC, 4);
+  append_binary(out, (uint32)fields.size());
+  append_binary(out, (uint32)nrows);
+  append_binary(out, (int32)level);
+  append_binary(out, (int64)offset);
+  append_binary(out, sample_width);
+  for (unsigned i = 0; i < fields.size(); i++) out.append(fields[i].c_str(), fields[i].length() + 1);
+  append_padding(out, 8);
+}
+
+/// Render tile of one channel in binary tile format, with the same rows as gettile_json
+std::string gettile_binary(KVS &store, int uid, const std::string &full_channel_name, int tile_level, long long tile_offset) {
+  GraphTile tile;
+  bool found = read_graph_tile(store, uid, full_channel_name, tile_level, tile_offset, tile);
+  std::vector<std::string> fields(GraphTile::FIELDS, GraphTile::FIELDS + tile.field_count());
+  std::string out;
+  out.reserve(64 + tile.time.size() * (4 * sizeof(double) + 5));
+  append_binary_header(out, fields, tile.time.size(), tile_level, tile_offset,
+                       found && tile.binned ? tile.sample_width : NAN);
+  append_binary(out, tile.time);
+  append_binary(out, tile.mean);
+  append_binary(out, tile.stddev);
+  append_binary(out, tile.count);
+  if (tile.has_comments) {
+    std::string blob;
+    for (unsigned i = 0; i < tile.time.size(); i++) append_binary(out, (unsigned char)tile.has_comment[i]);
+    append_padding(out, 4);
+    for (unsigned i = 0; i < tile.time.size(); i++) {
+      append_binary(out, (uint32)blob.size());
+      blob += tile.comment[i];
+    }
+    append_binary(out, (uint32)blob.size());
+    out += blob;
+  }
+  return out;
+}
+
+/// Render tile of multiple channels in binary tile format, with the same rows as multi_gettile_json.  Bins with no
+/// data for a channel have value NaN.
+std::string multi_gettile_binary(KVS &store, int uid, const std::vector<std::string> &full_channel_names,
+                                 int tile_level, long long tile_offset, int max_parallel_reads) {
+  MultiTile tile;
+  read_multi_tile(store, uid, full_channel_names, tile_level, tile_offset, max_parallel_reads, tile);
+  std::vector<std::string> fields;
+  fields.push_back("time");
+  fields.insert(fields.end(), full_channel_names.begin(), full_channel_names.end());
+  std::string out;
+  out.reserve(64 + fields.size() * (16 + tile.rows.size() * sizeof(double)));
+  append_binary_header(out, fields, tile.rows.size(), tile_level, tile_offset, tile.sample_width);
+  for (unsigned r = 0; r < tile.rows.size(); r++) append_binary(out, tile.bins[0][tile.rows[r]].time);
+  for (unsigned j = 0; j < tile.bins.size(); j++) {
+    for (unsigned r = 0; r < tile.rows.size(); r++) {
+      DataSample<double> &sample = tile.bins[j][tile.rows[r]];
+      append_binary(out, sample.weight > 0 ? sample.value : NAN);
+    }
+  }
+  return out;
+}
+
+/// Read one channel's tile and its comments, and compute the rows gettile outputs, including line breaks
+/// \return false if the tile has no samples
+bool read_graph_tile(KVS &store, int uid, const std::string &full_channel_name, int tile_level, long long tile_offset,
+                     GraphTile &ret) {
+  TileIndex client_tile_index = client_to_store_tile_index(tile_level, tile_offset);
+  // 5th ancestor
+  TileIndex requested_index = client_tile_index.parent().parent().parent().parent().parent();
+
+  std::vector<DataSample<double> > double_samples;
+  std::vector<DataSample<std::string> > string_samples;
+  std::vector<DataSample<std::string> > comments;
+
+  bool doubles_binned, strings_binned, comments_binned;
+  // TODO: If writing FFT, ***get more data***
+  // TODO: Use min_time_required and max_time_required, get max-res data
+
+  // The comment channel rarely exists, so it's read inline rather than handed to another thread
+  Tile samples, comment_samples;
+  read_client_tile(store, uid, full_channel_name, requested_index, client_tile_index, samples);
+  read_client_tile(store, uid, full_channel_name+"._comment", requested_index, client_tile_index, comment_samples);
+  double_samples.swap(samples.double_samples);
+  string_samples.swap(samples.string_samples);
+  comments.swap(comment_samples.string_samples);
+
+  bin_tile_samples(client_tile_index, false, double_samples, doubles_binned);
+  bin_tile_samples(client_tile_index, false, string_samples, strings_binned);
+  bin_tile_samples(client_tile_index, false, comments, comments_binned);
+
+  // Samples are sorted by time, so rows are assembled by merging, without copying comments
+  std::vector<const DataSample<std::string>*> strings;
+  merge_string_samples(string_samples, comments, strings);
+  std::vector<GraphSample> graph_samples;
+  merge_graph_samples(double_samples, strings, graph_samples);
+  bool has_fifth_col = strings.size()>0;
+
+  double bin_width = client_tile_index.duration() / 512.0;
+  
+  double line_break_threshold = bin_width * 4.0;
+  if (!doubles_binned && double_samples.size() > 1) {
+    // Find the median distance between samples
+    std::vector<double> spacing(double_samples.size()-1);
+    for (size_t i = 0; i < double_samples.size()-1; i++) {
+      spacing[i] = double_samples[i+1].time - double_samples[i].time;
+    }
+    std::nth_element(spacing.begin(), spacing.begin() + spacing.size()/2, spacing.end());
+    double median_spacing = spacing[spacing.size()/2];
+    // Set line_break_threshold to larger of 4*median_spacing and 4*bin_width
+    line_break_threshold = std::max(line_break_threshold, median_spacing * 4);
+  }
+
+  if (!graph_samples.size()) {
+    log_f("gettile: no samples");
+    return false;
+  }
+
+  log_f("gettile: outputting %zd samples", graph_samples.size());
+  ret.level = tile_level;
+  ret.offset = tile_offset;
+  ret.has_comments = has_fifth_col;
+  // only include the sample_width field if we actually binned
+  ret.binned = doubles_binned;
+  ret.sample_width = bin_width;
+
+  double previous_sample_time = client_tile_index.start_time();
+  bool previous_had_value = true;
+  const std::string no_comment;
+
+  for (unsigned i = 0; i < graph_samples.size(); i++) {
+    // TODO: improve linebreak calculations:
+    // 1) observe channel specs line break size from database (expressed in time;  some observations have long time periods and others short)
+    // 2) insert breaks at beginning or end of tile if needed
+    // 3) should client be the one to decide where line breaks are (if we give it the threshold?)
+    if (graph_samples[i].time - previous_sample_time > line_break_threshold ||
+        !graph_samples[i].has_value || !previous_had_value) {
+      ret.add_line_break(0.5*(graph_samples[i].time+previous_sample_time));
+    }
+    previous_sample_time = graph_samples[i].time;
+    previous_had_value = graph_samples[i].has_value;
+    // TODO: fix datastore so we never see NAN crop up here!
+    ret.add_row(graph_samples[i].time, graph_samples[i].has_value ? graph_samples[i].value : 0.0,
+                isnan(graph_samples[i].stddev) ? 0 : graph_samples[i].stddev, graph_samples[i].weight,
+                graph_samples[i].comment != NULL, graph_samples[i].comment ? *graph_samples[i].comment : no_comment);
+  }
+  if (client_tile_index.end_time() - previous_sample_time > line_break_threshold ||
+      !previous_had_value) {
+    ret.add_line_break(0.5*(previous_sample_time + client_tile_index.end_time()));
+  }
+  return true;
+}
+
+void GraphTile::add_row(double t, double mean_value, double stddev_value, double count_value,
+                        bool row_has_comment, const std::string &row_comment) {
+  time.push_back(t);
+  mean.push_back(mean_value);
+  stddev.push_back(stddev_value);
+  count.push_back(count_value);
+  has_comment.push_back(row_has_comment);
+  comment.push_back(row_has_comment ? row_comment : std::string());
+}
+
+const char *GraphTile::FIELDS[5] = { "time", "mean", "stddev", "count", "comment" };
+
+/// Line breaks have value -1e+308
+void GraphTile::add_line_break(double t) {
+  add_row(t, -1e308, 0, 0, false, "");
+}
+
+/// Render tile of one channel as JSON, as output by gettile.  Includes comments from the channel's _comment subchannel.
+/// \param uid Owner of channel, or -1 if full_channel_name starts with UID
+/// \param tile_level Client tile level;  client level 0 is 512 samples in 512 seconds
+/// \param tile_offset Client tile offset
+/// \return JSON, including trailing newline, or "{}" without newline if the tile has no samples
+std::string gettile_json(KVS &store, int uid, const std::string &full_channel_name, int tile_level, long long tile_offset) {
+  GraphTile tile;
+  if (!read_graph_tile(store, uid, full_channel_name, tile_level, tile_offset, tile)) return "{}";
+
+  // Members in alphabetical order, as Json::FastWriter would write them
+  std::string out;
+  out.reserve(64 * (tile.time.size() + 2));
+  JsonWriter json(out);
+  json.begin_object();
+  json.key("data");
+  json.begin_array();
+  for (unsigned i = 0; i < tile.time.size(); i++) {
+    json.begin_array();
+    json.value(tile.time[i]);
+    json.value(tile.mean[i]);
+    json.value(tile.stddev[i]);
+    json.value(tile.count[i]);
+    if (tile.has_comments) {
+      if (tile.has_comment[i]) {
+        json.value(tile.comment[i]);
+      } else {
+        json.null_value();
+      }
+    }
+    json.end_array();
+  }
+  json.end_array();
+
+  json.key("fields");
+  json.begin_array();
+  for (unsigned i = 0; i < tile.field_count(); i++) json.value(std::string(GraphTile::FIELDS[i]));
+  json.end_array();
+
+  json.key("level");
+  json.value(tile.level);
+  // An aside about offset type and precision:
+  // JSONCPP doesn't have a long long type;  to preserve full resolution we need to convert to double here.  As Javascript itself
+  // will read this as a double-precision value, we're not introducing a problem.
+  // For a detailed discussion, see https://sites.google.com/a/bodytrack.org/wiki/website/tile-coordinates-and-numeric-precision
+  // Irritatingly, JSONCPP wants to add ".0" to the end of floating-point numbers that don't need it.  This is inconsistent
+  // with Javascript itself and simply introduces extra bytes to the representation
+  json.key("offset");
+  json.value((double)tile.offset);
+
+  if (tile.binned) {
+    json.key("sample_width");
+    json.value(tile.sample_width);
+  }
+  json.end_object();
+  out += "\n";
+  return out;
+}
+
+std::string gettile_response(KVS &store, int uid, const std::vector<std::string> &full_channel_names, bool multi,
+                             bool binary, int tile_level, long long tile_offset, int max_parallel_reads) {
+  if (multi) {
+    return binary ?
+      multi_gettile_binary(store, uid, full_channel_names, tile_level, tile_offset, max_parallel_reads) :
+      multi_gettile_json(store, uid, full_channel_names, tile_level, tile_offset, max_parallel_reads);
+  } else {
+    return binary ? gettile_binary(store, uid, full_channel_names[0], tile_level, tile_offset)
+                  : gettile_json(store, uid, full_channel_names[0], tile_level, tile_offset);
+  }
+}
+
+/// Read metainformation of the channels a tile is rendered from:  the channels, plus a single channel's comments.
+/// Channels that don't exist read as never modified.
+static void read_source_channel_infos(KVS &store, int uid, const std::vector<std::string> &full_channel_names,
+                                      bool multi, std::vector<ChannelInfo> &infos) {
+  std::vector<std::string> names = full_channel_names;
+  if (!multi) names.push_back(full_channel_names[0] + "._comment");
+  infos.resize(names.size());
+  for (unsigned i = 0; i < names.size(); i++) {
+    simple_shared_ptr<Channel> ch(uid == -1 ? new Channel(store, names[i]) : new Channel(store, uid, names[i]));
+    if (!ch->read_info(infos[i])) infos[i] = ChannelInfo();
+  }
+}
+
+std::string cached_gettile_response(TileCache &cache, KVS &store, int uid,
+                                    const std::vector<std::string> &full_channel_names, bool multi, bool binary,
+                                    int tile_level, long long tile_offset, int max_parallel_reads, bool *cached) {
+  std::string key = string_printf("%d|%d|%lld|%d|%d", uid, tile_level, tile_offset, (int)multi, (int)binary);
+  for (unsigned i = 0; i < full_channel_names.size(); i++) key += "|" + full_channel_names[i];
+
+  // Read before rendering:  imports write metainformation last, so a response rendered during an import is cached
+  // with the counts from before it, and the import's end invalidates it
+  std::vector<ChannelInfo> infos;
+  read_source_channel_infos(store, uid, full_channel_names, multi, infos);
+  // Each channel's creation id, then its modification count
+  std::vector<uint64> current;
+  for (unsigned i = 0; i < infos.size(); i++) {
+    current.push_back(infos[i].creation_id);
+    current.push_back(infos[i].modification_count);
+  }
+
+  TileIndex client_tile_index = client_to_store_tile_index(tile_level, tile_offset);
+  Range times(client_tile_index.start_time(), client_tile_index.end_time());
+  std::vector<uint64> versions;
+  std::string body;
+  if (cache.lookup(key, versions, body)) {
+    bool modified = versions.size() != current.size();
+    for (unsigned i = 0; i < infos.size() && !modified; i++) {
+      modified = versions[2*i] != infos[i].creation_id || infos[i].modified_since(versions[2*i+1], times);
+    }
+    if (!modified) {
+      // Store the current counts, so later lookups needn't look as far back
+      if (versions != current) cache.insert(key, current, body);
+      if (cached) *cached = true;
+      return body;
+    }
+    // Don't keep the out-of-date response if rendering fails
+    cache.remove(key);
+  }
+
+  body = gettile_response(store, uid, full_channel_names, multi, binary, tile_level, tile_offset, max_parallel_reads);
+  cache.insert(key, current, body);
+  if (cached) *cached = false;
+  return body;
+}
@@ -0,0 +1,110 @@
+#ifndef GET_TILE_INCLUDE_H
+#define GET_TILE_INCLUDE_H
+
+// C++
+#include <string>
+#include <vector>
+
+// Local
+#include "DataSample.h"
+#include "KVS.h"
+#include "TileCache.h"
+#include "TileIndex.h"
+#include "sizes.h"
+
+/// Store tile index for a client tile.  Client tile level 0 is 512 samples in 512 seconds;  store level 0 is 65536
+/// samples in 1 second.
+TileIndex client_to_store_tile_index(int tile_level, long long tile_offset);
+
+/// Rows of a single-channel tile, as output by gettile.  Columns are stored separately.
+struct GraphTile {
+  /// Names of time, mean, stddev, count and comment columns
+  static const char *FIELDS[5];
+  int level;
+  long long offset;
+  std::vector<double> time, mean, stddev, count;
+  /// True if any row has a comment;  if so, there's a fifth column
+  bool has_comments;
+  std::vector<bool> has_comment;
+  std::vector<std::string> comment;
+  /// True if samples were binned, in bins of sample_width seconds
+  bool binned;
+  double sample_width;
+
+  GraphTile() : level(0), offset(0), has_comments(false), binned(false), sample_width(0) {}
+  unsigned field_count() const { return has_comments ? 5 : 4; }
+  void add_row(double t, double mean_value, double stddev_value, double count_value,
+               bool row_has_comment, const std::string &row_comment);
+  void add_line_break(double t);
+};
+
+bool read_graph_tile(KVS &store, int uid, const std::string &full_channel_name, int tile_level, long long tile_offset,
+                     GraphTile &ret);
+
+/// Multiple channels' samples in a tile, binned into 512 regular bins, as output by gettile --multi
+struct MultiTile {
+  int level;
+  long long offset;
+  double sample_width;
+  std::vector<std::string> full_channel_names;
+  /// For each channel, 512 bins;  bins with zero weight have no data
+  std::vector<std::vector<DataSample<double> > > bins;
+  /// Indices of bins in which at least one channel has data
+  std::vector<unsigned> rows;
+};
+
+void read_multi_tile(KVS &store, int uid, const std::vector<std::string> &full_channel_names,
+                     int tile_level, long long tile_offset, int max_parallel_reads, MultiTile &ret);
+
+/// Channels read at once by multi_gettile_json, unless otherwise specified
+const int DEFAULT_MAX_PARALLEL_READS = 8;
+
+std::string gettile_json(KVS &store, int uid, const std::string &full_channel_name, int tile_level, long long tile_offset);
+
+std::string multi_gettile_json(KVS &store, int uid, const std::vector<std::string> &full_channel_names,
+                               int tile_level, long long tile_offset,
+                               int max_parallel_reads = DEFAULT_MAX_PARALLEL_READS);
+
+/// Binary tile format, an alternative to JSON for clients that read columns directly, e.g. as Float64Arrays.
+/// Little-endian, with the same rows, including line breaks, as the JSON output:
+///
+///     char[4]   "BTB1"
+///     uint32    number of fields
+///     uint32    number of rows
+///     int32     level
+///     int64     offset
+///     double    sample_width, or NaN if samples weren't binned
+///     NUL-terminated field names, then zeros to pad to a multiple of 8 bytes
+///     double[rows] for each field except comment, in order
+///
+/// If the last field is "comment", there follow:
+///
+///     uint8[rows]     1 if row has a comment, 0 if null;  then zeros to pad to a multiple of 4 bytes
+///     uint32[rows+1]  start of each row's comment in the blob, then the blob's length
+///     blob            comments, concatenated
+///
+/// Single-channel fields are time, mean, stddev, count and optionally comment.  A tile with no samples has no rows.
+/// Multi-channel fields are time and each channel's name;  bins with no data for a channel have value NaN.
+const char BINARY_TILE_MAGIC[] = "BTB1";
+
+std::string gettile_binary(KVS &store, int uid, const std::string &full_channel_name, int tile_level, long long tile_offset);
+
+std::string multi_gettile_binary(KVS &store, int uid, const std::vector<std::string> &full_channel_names,
+                                 int tile_level, long long tile_offset,
+                                 int max_parallel_reads = DEFAULT_MAX_PARALLEL_READS);
+
+/// Any of the above:  as gettile --multi if multi is set, and otherwise for the one channel in full_channel_names
+std::string gettile_response(KVS &store, int uid, const std::vector<std::string> &full_channel_names, bool multi,
+                             bool binary, int tile_level, long long tile_offset,
+                             int max_parallel_reads = DEFAULT_MAX_PARALLEL_READS);
+
+/// As gettile_response, using a cached response unless samples within the tile have changed since it was rendered.
+/// Responses are cached with the creation ids and modification counts of the channels they're rendered from, so an
+/// import only invalidates the tiles overlapping the times it changed, and a recreated store invalidates them all.
+/// \param cached If non-NULL, returns true if the response came from cache
+std::string cached_gettile_response(TileCache &cache, KVS &store, int uid,
+                                    const std::vector<std::string> &full_channel_names, bool multi, bool binary,
+                                    int tile_level, long long tile_offset,
+                                    int max_parallel_reads = DEFAULT_MAX_PARALLEL_READS, bool *cached = NULL);
+
+#endif
@@ -1,140 +1,294 @@
 // C++
+#include <limits>
 #include <map>
 #include <vector>
-#include <fstream>
-#include <limits>
 
 // C
+#include <ctype.h>
 #include <stdio.h>
 
-#include "simple_shared_ptr.h"
-
 // Local
-#include "Channel.h"
 #include "DataSample.h"
+#include "utils.h"
 
 // Self
 #include "ImportJson.h"
 
+/// Reads a JSON document from a file piece by piece:  the punctuation of the outer levels a character at a time, and
+/// smaller values, such as one row of data, whole.  Only the value being read is held in memory.
+class JsonStream {
+public:
+  JsonStream(FILE *in) : m_in(in), m_pos(0), m_len(0), m_offset(0) {}
 
-template <typename A, typename B>
-void erase_empty_data(std::map<A, B> &m) {
+  /// \return Next character after any whitespace, without consuming it;  EOF at the end
+  int peek() {
+    skip_whitespace();
+    return peek_raw();
+  }
 
-  for (typename std::map<A, B>::iterator i = m.begin(); i != m.end();) {
-    if (!i->second->size()) {
-      m.erase(i++);
-    } else {
-      i++;
+  /// \return Next character after any whitespace;  EOF at the end
+  int get() {
+    skip_whitespace();
+    return next();
+  }
+
+  /// Consume c, after any whitespace
+  void expect(char c) {
+    if (get() != c) fail(string_printf("expected '%c'", c));
+  }
+
+  Json::Value read_value() {
+    std::string text;
+    read_value_text(text);
+    Json::Value value;
+    if (!Json::Reader().parse(text, value, false)) fail("malformed value");
+    return value;
+  }
+
+  void skip_value() {
+    std::string text;
+    read_value_text(text);
+  }
+
+  void fail(const std::string &msg) const {
+    throw ParseError("Failed to parse JSON file: %s at byte %lld", msg.c_str(), m_offset);
+  }
+
+private:
+  FILE *m_in;
+  char m_buf[65536];
+  size_t m_pos, m_len;
+  /// Offset in file of next character
+  long long m_offset;
+
+  int peek_raw() {
+    if (m_pos == m_len) {
+      m_len = fread(m_buf, 1, sizeof(m_buf), m_in);
+      m_pos = 0;
+      if (!m_len) return EOF;
     }
+    return (unsigned char)m_buf[m_pos];
   }
-}
 
-void parse_json_single(Json::Value json,
-		       std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > &numeric_data,
-		       std::map<std::string, simple_shared_ptr<std::vector<DataSample<std::string> > > > &string_data,
-		       std::vector<ParseError> &errors,
-		       ParseInfo &info)
-{
-  Json::Value channel_names = json["channel_names"];
-  Json::Value numeric_channel_names = json["numeric_ch_names"];
+  int next() {
+    int c = peek_raw();
+    if (c != EOF) {
+      m_pos++;
+      m_offset++;
+    }
+    return c;
+  }
+
+  void skip_whitespace() {
+    while (isspace(peek_raw())) next();
+  }
+
+  /// Append the text of the next value to text:  a string, or an array or object through its closing bracket, or
+  /// anything else up to the punctuation or whitespace that ends it
+  void read_value_text(std::string &text) {
+    skip_whitespace();
+    int depth = 0;
+    bool in_string = false;
+    while (1) {
+      int c = peek_raw();
+      if (c == EOF) {
+        if (depth || in_string || text.empty()) fail("unexpected end");
+        return;
+      }
+      if (!in_string && !depth && !text.empty() && (c == ',' || c == ']' || c == '}' || isspace(c))) return;
+      text += (char)next();
+      if (in_string) {
+        if (c == '\\') {
+          int escaped = next();
+          if (escaped == EOF) fail("unexpected end");
+          text += (char)escaped;
+        } else if (c == '"') {
+          in_string = false;
+          if (!depth) return;
+        }
+      } else if (c == '"') {
+        in_string = true;
+      } else if (c == '[' || c == '{') {
+        depth++;
+      } else if (c == ']' || c == '}') {
+        if (--depth < 0) fail("unexpected bracket");
+        if (!depth) return;
+      }
+    }
+  }
+};
 
-  std::vector<simple_shared_ptr<std::vector<DataSample<double> > > > vector_numeric_data;
-  std::vector<simple_shared_ptr<std::vector<DataSample<std::string> > > > vector_string_data;
+/// Turns the rows of one object's data into samples, passing them to the receiver a chunk at a time.  Rows that
+/// arrive before channel_names are held until it does.
+class JsonRows {
+public:
+  JsonRows(JsonParserReceiver &receiver) : m_receiver(receiver), m_has_names(false), m_rows(0), m_chunk_rows(0) {}
 
-  // Create channels as needed, and record pointers to them in vector_{numeric|string}_data for fast loading
-  for (unsigned i = 0; i < channel_names.size(); i++) {
-    std::string channel_name = channel_names[i].asString();
-    if (numeric_data.find(channel_name) == numeric_data.end()) {
-      numeric_data[channel_name] = simple_shared_ptr<std::vector<DataSample<double> > >(new std::vector<DataSample<double> >());
+  void set_channel_names(const Json::Value &channel_names) {
+    // Columns naming the same channel share its samples, in row order
+    std::map<std::string, unsigned> channel_indexes;
+    for (unsigned i = 0; i < channel_names.size(); i++) {
+      std::string channel_name = channel_names[i].asString();
+      if (!channel_indexes.count(channel_name)) {
+        channel_indexes[channel_name] = m_channels.size();
+        m_channels.push_back(channel_name);
+      }
+      m_column_channels.push_back(channel_indexes[channel_name]);
     }
-    vector_numeric_data.push_back(numeric_data[channel_name]);
-    if (string_data.find(channel_name) == string_data.end()) {
-      string_data[channel_name] = simple_shared_ptr<std::vector<DataSample<std::string> > >(new std::vector<DataSample<std::string> >());
+    m_numeric.resize(m_channels.size());
+    m_strings.resize(m_channels.size());
+    m_has_names = true;
+    for (unsigned i = 0; i < m_held.size(); i++) add(m_held[i]);
+    m_held.clear();
+  }
+
+  void add(const Json::Value &row) {
+    if (!m_has_names) {
+      m_held.push_back(row);
+      return;
     }
-    vector_string_data.push_back(string_data[channel_name]);
+    parse_row(row);
+    if (++m_chunk_rows == JSON_ROWS_PER_CHUNK) flush();
   }
-  
-  Json::Value datajson = json["data"];
 
-  Json::FastWriter foo;
+  /// Pass on the remaining samples
+  void finish() {
+    // Without channel_names, only rows without values can be parsed
+    for (unsigned i = 0; i < m_held.size(); i++) parse_row(m_held[i]);
+    m_held.clear();
+    flush();
+  }
 
-  for (unsigned i = 0; i < datajson.size(); i++) {
-    Json::Value row = datajson[i];
+private:
+  JsonParserReceiver &m_receiver;
+  bool m_has_names;
+  /// Channels, without repeats
+  std::vector<std::string> m_channels;
+  /// Index in m_channels of each column after the time
+  std::vector<unsigned> m_column_channels;
+  /// Samples of the current chunk, by index in m_channels
+  std::vector<std::vector<DataSample<double> > > m_numeric;
+  std::vector<std::vector<DataSample<std::string> > > m_strings;
+  std::vector<Json::Value> m_held;
+  /// Rows parsed so far, and since the last chunk was passed on
+  unsigned m_rows, m_chunk_rows;
+
+  void parse_row(const Json::Value &row) {
+    unsigned i = m_rows++;
     double timestamp;
     try {
       timestamp = row[(unsigned int)0].asDouble();
     } catch (std::exception &e) {
       try {
-	// HACK!  parse
-	timestamp = atof(row[(unsigned int)0].asString().c_str());
-	if (timestamp == 0) throw ParseError("zero timestamp");
+        // HACK!  parse
+        timestamp = atof(row[(unsigned int)0].asString().c_str());
+        if (timestamp == 0) throw ParseError("zero timestamp");
       } catch (std::exception &e) {
-	std::string msg =
-	  string_printf("In row %d, cannot parse timestamp (first col) of %s as double-precision",
-			i, rtrim(Json::FastWriter().write(row)).c_str());
-	throw ParseError(msg.c_str());
+        throw ParseError("In row %d, cannot parse timestamp (first col) of %s as double-precision",
+                         i, rtrim(Json::FastWriter().write(row)).c_str());
       }
     }
 
     for (unsigned j = 1; j < row.size(); j++) {
       if (row[j].type() == Json::nullValue) {
-	// skip "null" sample
-      } else if (row[j].type() == Json::stringValue) {
-        vector_string_data[j-1]->push_back(DataSample<std::string>(timestamp, row[j].asString()));
+        // skip "null" sample
+        continue;
+      }
+      if (j - 1 >= m_column_channels.size()) throw ParseError("In row %d, col %d: no channel name", i, j);
+      unsigned channel = m_column_channels[j - 1];
+      if (row[j].type() == Json::stringValue) {
+        m_strings[channel].push_back(DataSample<std::string>(timestamp, row[j].asString()));
       } else if (row[j].type() == Json::booleanValue) {
         if (!row[j].asBool()) {
           // false means delete the sample.  Ingest this as NaN.
-          vector_numeric_data[j-1]->push_back(DataSample<double>(timestamp, std::numeric_limits<double>::quiet_NaN()));
+          m_numeric[channel].push_back(DataSample<double>(timestamp, std::numeric_limits<double>::quiet_NaN()));
         } else {
-          std::string msg =
-            string_printf("In row %d, col %d: cannot ingest boolean 'true'", i, j);
-          throw ParseError(msg.c_str());
-          // skip "true" sample
+          throw ParseError("In row %d, col %d: cannot ingest boolean 'true'", i, j);
         }
       } else {
-        vector_numeric_data[j-1]->push_back(DataSample<double>(timestamp, row[j].asDouble()));
+        m_numeric[channel].push_back(DataSample<double>(timestamp, row[j].asDouble()));
       }
     }
   }
 
-  // Remove vectors of size 0
-  
-  erase_empty_data(numeric_data);
-  erase_empty_data(string_data);
-  
-  info.good_records++;
-}
-
-void parse_json(Json::Value json,
-		std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > &numeric_data,
-		std::map<std::string, simple_shared_ptr<std::vector<DataSample<std::string> > > > &string_data,
-		std::vector<ParseError> &errors,
-		ParseInfo &info)
-{  
-  if (json.isArray()) {
-    for (unsigned i = 0; i < json.size(); i++) {
-      parse_json_single(json[i], numeric_data, string_data, errors, info);
+  void flush() {
+    for (unsigned i = 0; i < m_channels.size(); i++) {
+      if (m_numeric[i].size()) m_receiver.receive_data_samples(m_channels[i], m_numeric[i]);
+      m_numeric[i].clear();
+      if (m_strings[i].size()) m_receiver.receive_string_samples(m_channels[i], m_strings[i]);
+      m_strings[i].clear();
     }
+    m_chunk_rows = 0;
+  }
+};
+
+/// Parse one {"channel_names": ..., "data": ...} object
+static void parse_json_object(JsonStream &in, JsonParserReceiver &receiver, ParseInfo &info) {
+  JsonRows rows(receiver);
+  in.expect('{');
+  if (in.peek() == '}') {
+    in.get();
   } else {
-    parse_json_single(json, numeric_data, string_data, errors, info);
+    while (1) {
+      Json::Value key = in.read_value();
+      if (!key.isString()) in.fail("expected key");
+      in.expect(':');
+      if (key.asString() == "channel_names") {
+        rows.set_channel_names(in.read_value());
+      } else if (key.asString() == "data" && in.peek() == '[') {
+        in.expect('[');
+        if (in.peek() == ']') {
+          in.get();
+        } else {
+          while (1) {
+            rows.add(in.read_value());
+            int c = in.get();
+            if (c == ']') break;
+            if (c != ',') in.fail("expected ',' or ']'");
+          }
+        }
+      } else {
+        in.skip_value();
+      }
+      int c = in.get();
+      if (c == '}') break;
+      if (c != ',') in.fail("expected ',' or '}'");
+    }
   }
+  rows.finish();
+  info.good_records++;
 }
 
 void parse_json_file(const std::string &infile,
-		     std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > &numeric_data,
-		     std::map<std::string, simple_shared_ptr<std::vector<DataSample<std::string> > > > &string_data,
-		     std::vector<ParseError> &errors,
-		     ParseInfo &info)
+                     JsonParserReceiver &receiver,
+                     std::vector<ParseError> &errors,
+                     ParseInfo &info)
 {
   info.good_records = 0;
   info.bad_records = 0;
 
-  Json::Reader reader;
-  std::ifstream instream(infile.c_str(), std::ios::binary);
-  Json::Value json;
-  if (!reader.parse(instream, json)) {
-    throw ParseError("Failed to parse JSON file");
+  FILE *in = fopen(infile.c_str(), "rb");
+  if (!in) throw ParseError("Failed to parse JSON file");
+  try {
+    JsonStream stream(in);
+    if (stream.peek() == '[') {
+      stream.get();
+      if (stream.peek() == ']') {
+        stream.get();
+      } else {
+        while (1) {
+          parse_json_object(stream, receiver, info);
+          int c = stream.get();
+          if (c == ']') break;
+          if (c != ',') stream.fail("expected ',' or ']'");
+        }
+      }
+    } else {
+      parse_json_object(stream, receiver, info);
+    }
+  } catch (...) {
+    fclose(in);
+    throw;
   }
-  
-  parse_json(json, numeric_data, string_data, errors, info);
+  fclose(in);
 }
@@ -3,15 +3,31 @@
 
 // C++
 #include <string>
+#include <vector>
 
 // Local includes
 #include "KVS.h"
 #include "Parse.h"
 
+/// Receives samples from parse_json_file as they're parsed, a chunk of one channel's samples at a time, in file order
+class JsonParserReceiver {
+public:
+  virtual void receive_data_samples(const std::string &channel_name,
+                                    const std::vector<DataSample<double> > &samples) = 0;
+  virtual void receive_string_samples(const std::string &channel_name,
+                                      const std::vector<DataSample<std::string> > &samples) = 0;
+};
+
+/// Parse a JSON file of the form {"channel_names": [...], "data": [[time, value, ...], ...]}, or an array of them,
+/// without reading the whole file into memory.  Rows are parsed one at a time and passed on in chunks of up to
+/// JSON_ROWS_PER_CHUNK rows;  if channel_names comes after data, the rows before it are held until it arrives.
 void parse_json_file(const std::string &infile,
-		     std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > &numeric_data,
-		     std::map<std::string, simple_shared_ptr<std::vector<DataSample<std::string> > > > &string_data,
-		     std::vector<ParseError> &errors,
-		     ParseInfo &info);
+                     JsonParserReceiver &receiver,
+                     std::vector<ParseError> &errors,
+                     ParseInfo &info);
+
+enum {
+  JSON_ROWS_PER_CHUNK = 10000
+};
 
 #endif
@@ -0,0 +1,73 @@
+// C
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// JSON
+#include <json/json.h>
+
+// Self
+#include "JsonWriter.h"
+
+void JsonWriter::key(const char *name) {
+  separate();
+  m_out += Json::valueToQuotedString(name);
+  m_out += ':';
+  m_need_comma = false;
+}
+
+void JsonWriter::value(int x) {
+  separate();
+  char buffer[16];
+  m_out.append(buffer, snprintf(buffer, sizeof(buffer), "%d", x));
+  m_need_comma = true;
+}
+
+void JsonWriter::value(const std::string &x) {
+  separate();
+  // Like Json::Value, stop at the first NUL
+  m_out += Json::valueToQuotedString(x.c_str());
+  m_need_comma = true;
+}
+
+void JsonWriter::append_double(std::string &out, double x) {
+  // Fast path for integers:  "%#.16g" prints all their digits, and Json::valueToString then strips the
+  // fractional zeros and decimal point
+  if (fabs(x) < 1e15 && x == (double)(long long)x && !(x == 0 && signbit(x))) {
+    char digits[24];
+    char *end = digits + sizeof(digits), *begin = end;
+    long long n = (long long)x;
+    unsigned long long magnitude = n < 0 ? -(unsigned long long)n : n;
+    do {
+      *--begin = '0' + magnitude % 10;
+      magnitude /= 10;
+    } while (magnitude);
+    if (n < 0) *--begin = '-';
+    out.append(begin, end - begin);
+    return;
+  }
+
+  // Same as Json::valueToString(double), without its temporary strings
+  char buffer[40];
+  snprintf(buffer, sizeof(buffer), "%#.16g", x);
+
+  // Set aside exponent, if present, before looking for trailing zeros;  remove leading + in exponent, if any
+  char *exp = strchr(buffer, 'e');
+  size_t mantissa_length = exp ? exp - buffer : strlen(buffer);
+
+  char *ch = buffer + mantissa_length - 1;
+  if (*ch == '0') {
+    while (ch > buffer && *ch == '0') --ch;
+    char *last_nonzero = ch;
+    while (ch >= buffer && '0' <= *ch && *ch <= '9') --ch;
+    if (ch >= buffer && *ch == '.') {
+      // Number is of form XYZ.000, or XY.Z00;  truncate zeros, and the decimal point if nothing follows it
+      mantissa_length = (ch == last_nonzero ? last_nonzero : last_nonzero + 1) - buffer;
+    }
+  }
+  out.append(buffer, mantissa_length);
+  if (exp) {
+    out += 'e';
+    out += exp[1] == '+' ? exp + 2 : exp + 1;
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef JSON_WRITER_INCLUDE_H
+#define JSON_WRITER_INCLUDE_H
+
+// C++
+#include <string>
+
+/// \class JsonWriter JsonWriter.h
+///
+/// Appends JSON directly to a string, without building a Json::Value tree.  Output is byte-identical to
+/// Json::FastWriter's for the same values, including its formatting of doubles.
+///
+/// The caller is responsible for nesting:  each begin_array or begin_object needs a matching end, and each value
+/// in an object needs a preceding key.  Commas are inserted automatically.
+class JsonWriter {
+public:
+  /// \param out String to append to;  reserve space in it to avoid reallocation
+  JsonWriter(std::string &out) : m_out(out), m_need_comma(false) {}
+
+  void begin_array()  { separate(); m_out += '['; m_need_comma = false; }
+  void end_array()    { m_out += ']'; m_need_comma = true; }
+  void begin_object() { separate(); m_out += '{'; m_need_comma = false; }
+  void end_object()   { m_out += '}'; m_need_comma = true; }
+  void key(const char *name);
+
+  void null_value()   { separate(); m_out += "null"; m_need_comma = true; }
+  void value(int x);
+  void value(double x) { separate(); append_double(m_out, x); m_need_comma = true; }
+  void value(const std::string &x);
+
+  /// Append x formatted as by Json::valueToString(double)
+  static void append_double(std::string &out, double x);
+
+private:
+  std::string &m_out;
+  bool m_need_comma;
+
+  void separate() { if (m_need_comma) m_out += ','; }
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include <vector>
 
 // C
+#include <pthread.h>
 #include <stdio.h>
 
 // Local
@@ -16,30 +17,37 @@ static std::vector<std::string> log_record;
 
 bool record_log = true;
 
+// Guards log_prefix and log_record, so that log_f can be called from multiple threads
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 
 void log_f(const char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
   std::string msg = string_vprintf(fmt, args);
   va_end(args);
+  pthread_mutex_lock(&log_mutex);
   msg = string_printf("%.6f %s%s\n", doubletime(), log_prefix.c_str(), msg.c_str());
   fprintf(stderr, "%s", msg.c_str());
   if (record_log) {
-    // Add mutex here for multithreading
     log_record.push_back(msg);
   }
+  pthread_mutex_unlock(&log_mutex);
 }
 
 void set_log_prefix(const std::string &prefix) {
+  pthread_mutex_lock(&log_mutex);
   log_prefix = prefix;
+  pthread_mutex_unlock(&log_mutex);
 }
 
 std::string recorded_log() {
-  // Add mutex here for multithreading
+  pthread_mutex_lock(&log_mutex);
   size_t len = 0;
   for (unsigned i = 0; i < log_record.size(); i++) len += log_record[i].length();
   std::string ret;
   ret.reserve(len);
   for (unsigned i = 0; i < log_record.size(); i++) ret += log_record[i];
+  pthread_mutex_unlock(&log_mutex);
   return ret;
 }
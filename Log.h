@@ -8,4 +8,7 @@ void log_f(const char *fmt, ...);
 void set_log_prefix(const std::string &prefix);
 std::string recorded_log();
 
+/// If true (the default), log_f records each message for recorded_log().  Long-running processes should turn this off.
+extern bool record_log;
+
 #endif
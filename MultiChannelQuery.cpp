@@ -0,0 +1,93 @@
+// C++
+#include <algorithm>
+#include <stdexcept>
+
+// C
+#include <math.h>
+
+// Self
+#include "MultiChannelQuery.h"
+
+MultiChannelQuery::MultiChannelQuery(KVS &store, int uid, const std::vector<std::string> &full_channel_names,
+                                     double start, double end, unsigned n_bins)
+  : m_start(start), m_end(end), m_n_bins(n_bins), m_next_bin(0), m_cursors(full_channel_names.size()) {
+  if (!(start < end) || n_bins == 0) throw std::runtime_error("MultiChannelQuery: empty grid");
+  m_scale = n_bins / (end - start);
+  double bin_width = (end - start) / n_bins;
+  m_level = (int)floor(TileIndex::duration_to_level(bin_width)) +
+    (int)TileIndex::duration_to_level(BT_CHANNEL_DOUBLE_SAMPLES);
+
+  for (unsigned i = 0; i < m_cursors.size(); i++) {
+    Cursor &cursor = m_cursors[i];
+    cursor.channel.reset(uid == -1 ? new Channel(store, full_channel_names[i]) :
+                         new Channel(store, uid, full_channel_names[i]));
+    cursor.ti = TileIndex::null();
+    cursor.index = 0;
+    bool exists;
+    {
+      Channel::Locker lock(*cursor.channel);
+      exists = cursor.channel->read_info(cursor.info);
+    }
+    if (exists && cursor.info.times.intersects(Range(start, end))) {
+      read_tile(cursor, cursor.channel->find_first_tile(cursor.info, start, m_level));
+      // Skip samples before start
+      while (!cursor.ti.is_null() && cursor.index == cursor.tile.double_samples.size()) {
+        read_tile(cursor, cursor.channel->find_next_tile(cursor.info, cursor.ti, m_level));
+      }
+      if (!cursor.ti.is_null()) {
+        std::vector<DataSample<double> > &samples = cursor.tile.double_samples;
+        cursor.index = std::lower_bound(samples.begin(), samples.end(), DataSample<double>(start, 0),
+                                        DataSample<double>::time_lessthan) - samples.begin();
+      }
+    }
+  }
+}
+
+double MultiChannelQuery::bin_start_time(unsigned bin) const {
+  return m_start + (m_end - m_start) * bin / m_n_bins;
+}
+
+bool MultiChannelQuery::next(unsigned &bin, std::vector<DataSample<double> > &samples) {
+  if (m_next_bin == m_n_bins) return false;
+  bin = m_next_bin++;
+  samples.resize(m_cursors.size());
+  for (unsigned i = 0; i < m_cursors.size(); i++) {
+    Cursor &cursor = m_cursors[i];
+    DataAccumulator<double> acc;
+    while (!cursor.ti.is_null()) {
+      const std::vector<DataSample<double> > &tile_samples = cursor.tile.double_samples;
+      for (; cursor.index < tile_samples.size(); cursor.index++) {
+        const DataSample<double> &sample = tile_samples[cursor.index];
+        if (sample.time >= m_end || bin_containing(sample.time) > bin) break;
+        acc += sample;
+      }
+      if (cursor.index < tile_samples.size()) break;
+      read_tile(cursor, cursor.channel->find_next_tile(cursor.info, cursor.ti, m_level));
+    }
+    if (acc.weight > 0) {
+      samples[i] = acc.get_sample();
+    } else {
+      samples[i] = DataSample<double>(bin_start_time(bin), 0, 0, 0);
+    }
+  }
+  return true;
+}
+
+/// Bin containing time t;  times outside the grid give the first or last bin
+unsigned MultiChannelQuery::bin_containing(double t) const {
+  if (t <= m_start) return 0;
+  return std::min<unsigned>((unsigned)((t - m_start) * m_scale), m_n_bins - 1);
+}
+
+/// Make ti the cursor's current tile, or end the cursor if ti is null, starts at or after end, or can't be read
+void MultiChannelQuery::read_tile(Cursor &cursor, TileIndex ti) {
+  cursor.index = 0;
+  cursor.tile = Tile();
+  cursor.ti = ti;
+  if (ti.is_null() || ti.start_time() >= m_end) {
+    cursor.ti = TileIndex::null();
+    return;
+  }
+  Channel::Locker lock(*cursor.channel);
+  if (!cursor.channel->read_tile(ti, cursor.tile)) cursor.ti = TileIndex::null();
+}
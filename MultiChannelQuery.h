@@ -0,0 +1,65 @@
+#ifndef MULTI_CHANNEL_QUERY_INCLUDE_H
+#define MULTI_CHANNEL_QUERY_INCLUDE_H
+
+// C++
+#include <string>
+#include <vector>
+
+// Local
+#include "Channel.h"
+#include "DataSample.h"
+#include "KVS.h"
+#include "simple_shared_ptr.h"
+#include "Tile.h"
+#include "TileIndex.h"
+
+/// \class MultiChannelQuery MultiChannelQuery.h
+///
+/// Resamples several channels' numeric samples onto a common grid:  n_bins equal-width bins spanning [start, end).
+/// Bins are returned one at a time by next().  Each channel keeps one tile in memory and moves through its tiles in
+/// time order, in step with the bins, so memory doesn't grow with the number of bins and each tile is read once.
+///
+/// Channels are read at the highest level whose summaries are no coarser than the bins:  a summary tile holds up
+/// to BT_CHANNEL_DOUBLE_SAMPLES samples, so that's level floor(log2(bin width)) + 15.  Channels without tiles that
+/// deep are read at their bottom level.  A summary sample falls in the bin containing its mean time.
+class MultiChannelQuery {
+public:
+  /// \param uid Owner of channels, or -1 if full_channel_names are of form UID.device.channel
+  MultiChannelQuery(KVS &store, int uid, const std::vector<std::string> &full_channel_names,
+                    double start, double end, unsigned n_bins);
+
+  /// Level channels are read at, where they have tiles that deep
+  int level() const { return m_level; }
+
+  double bin_start_time(unsigned bin) const;
+
+  /// Combine each channel's samples in the next bin
+  /// \param bin Returns the bin's index;  bins are returned in order, from 0 to n_bins - 1
+  /// \param samples Returns one sample per channel, with the mean time and value of its samples in the bin, and
+  /// their total weight;  weight is 0 if the channel has no samples in the bin
+  /// \return false once every bin has been returned
+  bool next(unsigned &bin, std::vector<DataSample<double> > &samples);
+
+private:
+  /// Position in one channel's tiles
+  struct Cursor {
+    simple_shared_ptr<Channel> channel;
+    ChannelInfo info;
+    /// Current tile, or TileIndex::null() once the channel has no more tiles before end
+    TileIndex ti;
+    Tile tile;
+    size_t index;
+  };
+  double m_start, m_end;
+  unsigned m_n_bins;
+  /// Bins per second
+  double m_scale;
+  int m_level;
+  unsigned m_next_bin;
+  std::vector<Cursor> m_cursors;
+
+  unsigned bin_containing(double t) const;
+  void read_tile(Cursor &cursor, TileIndex ti);
+};
+
+#endif
@@ -0,0 +1,196 @@
+// C++
+#include <cfloat>
+#include <stdexcept>
+
+// C
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Local
+#include "sizes.h"
+#include "utils.h"
+
+// Self
+#include "OutputBuffer.h"
+
+// Powers of ten, exact in a long double with at least a 64-bit mantissa
+static const long double POW10[] = {
+  1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L,
+  1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L
+};
+static const int MAX_POW10 = sizeof(POW10) / sizeof(POW10[0]) - 1;
+
+// Scaled values are below 1e16, so one long double multiply is within 6e-4 of exact;  fractions closer than
+// this to a half are left to snprintf
+static const long double TIE_TOLERANCE = 1e-3L;
+
+/// Round a * 10^k (a >= 0, a * 10^k < 1e16) to the nearest integer, or return false if too close to a tie to tell
+static bool round_scaled(double a, int k, long double &y, uint64 &m) {
+  y = a * POW10[k];
+  long double whole = floorl(y);
+  long double fraction = y - whole;
+  if (fabsl(fraction - 0.5L) < TIE_TOLERANCE) return false;
+  m = (uint64)whole + (fraction > 0.5L ? 1 : 0);
+  return true;
+}
+
+/// %g for values that print in fixed notation.  Returns 0 if v needs exponent notation or can't be rounded quickly.
+static size_t format_double_fast(char *dest, double v, int digits) {
+  char *out = dest;
+  if (signbit(v)) *out++ = '-';
+  double a = fabs(v);
+  if (a == 0) {
+    *out++ = '0';
+    return out - dest;
+  }
+  // %g uses exponent notation below 1e-4
+  if (a < 1e-4) return 0;
+
+  // Scale so that the digits to keep are the integer part, correcting the estimate of the exponent if needed
+  int exponent = (int)floor(log10(a));
+  long double y = 0;
+  uint64 m = 0;
+  for (int tries = 0; ; tries++) {
+    int k = digits - 1 - exponent;
+    if (tries == 3 || k < 0 || k > MAX_POW10) return 0;
+    y = a * POW10[k];
+    if (y < POW10[digits - 1]) {
+      exponent--;
+    } else if (y >= POW10[digits]) {
+      exponent++;
+    } else {
+      if (!round_scaled(a, k, y, m)) return 0;
+      break;
+    }
+  }
+  // Rounding up to a power of ten adds a digit
+  if (m == (uint64)POW10[digits]) {
+    m /= 10;
+    exponent++;
+  }
+  if (exponent < -4 || exponent >= digits) return 0;
+
+  char significand[32] = { 0 };
+  for (int i = digits - 1; i >= 0; i--) {
+    significand[i] = '0' + m % 10;
+    m /= 10;
+  }
+  // %g drops trailing zeros after the decimal point
+  int n = digits;
+  while (n > 1 && significand[n - 1] == '0') n--;
+
+  if (exponent >= 0) {
+    int integer_digits = exponent + 1;
+    for (int i = 0; i < integer_digits; i++) *out++ = i < n ? significand[i] : '0';
+    if (n > integer_digits) {
+      *out++ = '.';
+      for (int i = integer_digits; i < n; i++) *out++ = significand[i];
+    }
+  } else {
+    *out++ = '0';
+    *out++ = '.';
+    for (int i = 0; i < -exponent - 1; i++) *out++ = '0';
+    for (int i = 0; i < n; i++) *out++ = significand[i];
+  }
+  return out - dest;
+}
+
+size_t format_double(char *dest, double v, int digits) {
+  // Precision 0 means 1 for %g
+  if (digits == 0) digits = 1;
+  if (LDBL_MANT_DIG >= 64 && digits > 0 && digits <= 16 && isfinite(v)) {
+    size_t len = format_double_fast(dest, v, digits);
+    if (len) return len;
+  }
+  return snprintf(dest, FORMAT_DOUBLE_MAX_LENGTH, "%.*g", digits, v);
+}
+
+size_t format_fixed(char *dest, double v, int decimals) {
+  double a = fabs(v);
+  long double y;
+  uint64 m;
+  if (LDBL_MANT_DIG >= 64 && decimals >= 0 && decimals <= 15 && a < 1e16 / POW10[decimals] &&
+      round_scaled(a, decimals, y, m)) {
+    char digits[32];
+    int n = 0;
+    // At least one digit before the decimal point
+    for (; m || n <= decimals; m /= 10) digits[n++] = '0' + m % 10;
+    char *out = dest;
+    if (signbit(v)) *out++ = '-';
+    for (int i = n - 1; i >= decimals; i--) *out++ = digits[i];
+    if (decimals) *out++ = '.';
+    for (int i = decimals - 1; i >= 0; i--) *out++ = digits[i];
+    return out - dest;
+  }
+  return snprintf(dest, FORMAT_DOUBLE_MAX_LENGTH, "%.*f", decimals, v);
+}
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity)
+  : m_fd(fd), m_buffer(std::max(capacity, (size_t)FORMAT_DOUBLE_MAX_LENGTH)), m_len(0) {}
+
+OutputBuffer::~OutputBuffer() {
+  try {
+    flush();
+  } catch (const std::exception &) {
+    // Nowhere left to report a failed write
+  }
+}
+
+void OutputBuffer::append(const char *text, size_t len) {
+  if (len > m_buffer.size() - m_len) {
+    flush();
+    if (len >= m_buffer.size()) {
+      // Too big to buffer;  write directly
+      write_all(text, len);
+      return;
+    }
+  }
+  memcpy(&m_buffer[m_len], text, len);
+  m_len += len;
+}
+
+void OutputBuffer::append(const char *text) {
+  append(text, strlen(text));
+}
+
+void OutputBuffer::append_double(double v, int digits) {
+  m_len += format_double(reserve(FORMAT_DOUBLE_MAX_LENGTH), v, digits);
+}
+
+void OutputBuffer::append_double(double v, int digits, int width) {
+  char text[FORMAT_DOUBLE_MAX_LENGTH];
+  size_t len = format_double(text, v, digits);
+  for (size_t i = len; (int)i < width; i++) append(' ');
+  append(text, len);
+}
+
+void OutputBuffer::append_fixed(double v, int decimals) {
+  m_len += format_fixed(reserve(FORMAT_DOUBLE_MAX_LENGTH), v, decimals);
+}
+
+/// Make room for len more chars, and return where they go
+char *OutputBuffer::reserve(size_t len) {
+  if (len > m_buffer.size() - m_len) flush();
+  return &m_buffer[m_len];
+}
+
+void OutputBuffer::flush() {
+  size_t len = m_len;
+  m_len = 0;
+  write_all(&m_buffer[0], len);
+}
+
+void OutputBuffer::write_all(const char *text, size_t len) {
+  while (len) {
+    ssize_t ret = write(m_fd, text, len);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      throw std::runtime_error(string_printf("OutputBuffer: write failed: %s", strerror(errno)));
+    }
+    text += ret;
+    len -= ret;
+  }
+}
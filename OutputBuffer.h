@@ -0,0 +1,64 @@
+#ifndef OUTPUT_BUFFER_INCLUDE_H
+#define OUTPUT_BUFFER_INCLUDE_H
+
+// C++
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// Write v to dest the way printf("%.*g", digits, v) would, and return its length.  Values that print in fixed
+/// notation are formatted without printf;  the rest, and any whose rounding can't be decided quickly, fall back to
+/// snprintf.
+/// \param dest At least FORMAT_DOUBLE_MAX_LENGTH chars;  not terminated
+size_t format_double(char *dest, double v, int digits);
+
+/// Write v to dest the way printf("%.*f", decimals, v) would, and return its length
+/// \param dest At least FORMAT_DOUBLE_MAX_LENGTH chars;  not terminated
+size_t format_fixed(char *dest, double v, int decimals);
+
+enum { FORMAT_DOUBLE_MAX_LENGTH = 400 };
+
+/// \class OutputBuffer OutputBuffer.h
+///
+/// Text output collected in a large buffer and written to a file descriptor with write(), in place of stdio or
+/// iostreams per value.  Output is written when the buffer fills, on flush(), and on destruction.  Don't mix with
+/// other writes to the same descriptor without flushing first.
+class OutputBuffer {
+public:
+  OutputBuffer(int fd = 1, size_t capacity = 1 << 20);
+  ~OutputBuffer();
+
+  void append(char c) {
+    if (m_len == m_buffer.size()) flush();
+    m_buffer[m_len++] = c;
+  }
+  void append(const char *text, size_t len);
+  void append(const char *text);
+  void append(const std::string &text) { append(text.data(), text.length()); }
+
+  /// Append v as printf("%.*g", digits, v) would
+  void append_double(double v, int digits);
+
+  /// Append v as printf("%*.*g", width, digits, v) would:  right-aligned in at least width chars
+  void append_double(double v, int digits, int width);
+
+  /// Append v as printf("%.*f", decimals, v) would
+  void append_fixed(double v, int decimals);
+
+  /// Write everything appended so far.  Throws std::runtime_error if the write fails.
+  void flush();
+
+private:
+  int m_fd;
+  std::vector<char> m_buffer;
+  size_t m_len;
+
+  char *reserve(size_t len);
+  void write_all(const char *text, size_t len);
+
+  // Not copyable
+  OutputBuffer(const OutputBuffer&);
+  OutputBuffer &operator=(const OutputBuffer&);
+};
+
+#endif
@@ -37,8 +37,8 @@ public:
   std::string to_string(const char *fmt="%g") const {
     return empty() ? "[null]" : string_printf((std::string(fmt)+":"+fmt).c_str(), min, max);
   }
-  bool includes(double a) { return min <= a && a <= max; }
-  bool intersects(const Range &a) {
+  bool includes(double a) const { return min <= a && a <= max; }
+  bool intersects(const Range &a) const {
     if (empty()) return false;
     if (a.empty()) return false;
     if (a.max < min) return false;
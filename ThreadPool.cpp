@@ -0,0 +1,137 @@
+// C++
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+// Local
+#include "utils.h"
+
+// Self
+#include "ThreadPool.h"
+
+/// Start worker threads
+/// \param nthreads Number of workers;  must be at least 1
+ThreadPool::ThreadPool(int nthreads) : m_running(0), m_shutdown(false) {
+  if (nthreads < 1) throw std::runtime_error(string_printf("ThreadPool: invalid number of threads %d", nthreads));
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_task_available, NULL);
+  pthread_cond_init(&m_idle, NULL);
+  for (int i = 0; i < nthreads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker, this)) {
+      stop();
+      throw std::runtime_error("ThreadPool: pthread_create failed");
+    }
+    m_threads.push_back(thread);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  stop();
+}
+
+/// Finish queued tasks, join workers, and release synchronization objects
+void ThreadPool::stop() {
+  pthread_mutex_lock(&m_mutex);
+  m_shutdown = true;
+  pthread_cond_broadcast(&m_task_available);
+  pthread_mutex_unlock(&m_mutex);
+  for (unsigned i = 0; i < m_threads.size(); i++) pthread_join(m_threads[i], NULL);
+  m_threads.clear();
+  pthread_cond_destroy(&m_idle);
+  pthread_cond_destroy(&m_task_available);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+void ThreadPool::add(void (*fn)(void *arg), void *arg) {
+  Task task;
+  task.fn = fn;
+  task.arg = arg;
+  pthread_mutex_lock(&m_mutex);
+  m_queue.push_back(task);
+  pthread_cond_signal(&m_task_available);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void ThreadPool::wait() {
+  pthread_mutex_lock(&m_mutex);
+  while (m_queue.size() || m_running) pthread_cond_wait(&m_idle, &m_mutex);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+/// Tasks of one run_all call.  Shared by the caller and its helpers;  whichever finishes last deletes it, since a
+/// helper may start only after the caller has returned.
+struct ThreadPool::Batch {
+  void (*fn)(void *arg);
+  std::vector<void*> args;
+  std::atomic<size_t> next;
+  std::atomic<int> references;
+  size_t finished;
+  pthread_mutex_t mutex;
+  pthread_cond_t all_finished;
+
+  Batch(void (*fn)(void *arg), const std::vector<void*> &args, int references)
+    : fn(fn), args(args), next(0), references(references), finished(0) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&all_finished, NULL);
+  }
+  ~Batch() {
+    pthread_cond_destroy(&all_finished);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  /// Run tasks until none are left to start
+  void run() {
+    size_t i;
+    while ((i = next++) < args.size()) {
+      (*fn)(args[i]);
+      pthread_mutex_lock(&mutex);
+      if (++finished == args.size()) pthread_cond_broadcast(&all_finished);
+      pthread_mutex_unlock(&mutex);
+    }
+  }
+
+  void release() {
+    if (--references == 0) delete this;
+  }
+};
+
+void ThreadPool::run_batch(void *batch) {
+  ((Batch*)batch)->run();
+  ((Batch*)batch)->release();
+}
+
+void ThreadPool::run_all(void (*fn)(void *arg), const std::vector<void*> &args, int max_helpers) {
+  if (args.empty()) return;
+  int helpers = std::max(0, std::min(std::min(max_helpers, size()), (int)args.size() - 1));
+  Batch *batch = new Batch(fn, args, helpers + 1);
+  for (int i = 0; i < helpers; i++) add(run_batch, batch);
+  batch->run();
+  pthread_mutex_lock(&batch->mutex);
+  while (batch->finished < args.size()) pthread_cond_wait(&batch->all_finished, &batch->mutex);
+  pthread_mutex_unlock(&batch->mutex);
+  batch->release();
+}
+
+void *ThreadPool::worker(void *pool) {
+  ((ThreadPool*)pool)->run();
+  return NULL;
+}
+
+/// Run tasks until shut down and the queue is empty
+void ThreadPool::run() {
+  pthread_mutex_lock(&m_mutex);
+  while (1) {
+    while (m_queue.empty() && !m_shutdown) pthread_cond_wait(&m_task_available, &m_mutex);
+    if (m_queue.empty()) break;
+    Task task = m_queue.front();
+    m_queue.pop_front();
+    m_running++;
+    pthread_mutex_unlock(&m_mutex);
+    (*task.fn)(task.arg);
+    pthread_mutex_lock(&m_mutex);
+    m_running--;
+    if (m_queue.empty() && !m_running) pthread_cond_broadcast(&m_idle);
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
@@ -0,0 +1,59 @@
+#ifndef THREAD_POOL_INCLUDE_H
+#define THREAD_POOL_INCLUDE_H
+
+// C++
+#include <deque>
+#include <vector>
+
+// C
+#include <pthread.h>
+
+/// \class ThreadPool ThreadPool.h
+///
+/// Fixed number of worker threads running tasks from a FIFO queue.  A task is a function and an argument;  tasks
+/// must catch their own exceptions.
+///
+/// The destructor waits for queued tasks to finish, then joins the workers.
+class ThreadPool {
+public:
+  ThreadPool(int nthreads);
+  ~ThreadPool();
+
+  /// Queue fn(arg) to run on a worker thread
+  void add(void (*fn)(void *arg), void *arg);
+
+  /// Block until the queue is empty and no task is running
+  void wait();
+
+  /// Run fn(args[i]) for each i on the calling thread and up to max_helpers workers, returning once all have
+  /// finished.  Tasks that no worker has started yet are run by the calling thread, so a busy pool slows run_all
+  /// down but never blocks it, and concurrent callers don't wait for each other's tasks.
+  void run_all(void (*fn)(void *arg), const std::vector<void*> &args, int max_helpers);
+
+  int size() const { return m_threads.size(); }
+
+private:
+  struct Task {
+    void (*fn)(void *arg);
+    void *arg;
+  };
+  std::vector<pthread_t> m_threads;
+  std::deque<Task> m_queue;
+  int m_running;
+  bool m_shutdown;
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_task_available;
+  pthread_cond_t m_idle;
+
+  struct Batch;
+  static void *worker(void *pool);
+  static void run_batch(void *batch);
+  void run();
+  void stop();
+
+  // Not copyable
+  ThreadPool(const ThreadPool&);
+  ThreadPool &operator=(const ThreadPool&);
+};
+
+#endif
@@ -19,13 +19,15 @@ void Tile::to_binary(std::string &dest) const {
   writer.write(double_samples);
   writer.write(string_samples);
   writer.write(ranges);
+  writer.write(token_filter.bits);
 }
 
 size_t Tile::binary_length() const {
   return BinaryWriter::write_length(header)
     + BinaryWriter::write_length(double_samples)
     + BinaryWriter::write_length(string_samples)
-    + BinaryWriter::write_length(ranges);
+    + BinaryWriter::write_length(ranges)
+    + BinaryWriter::write_length(token_filter.bits);
 }
 
 void Tile::from_binary(const std::string &src) {
@@ -45,10 +47,28 @@ void Tile::from_binary(const std::string &src) {
   } else {
     ranges.clear();
   }
+
+  if (!reader.eof()) {
+    reader.read(token_filter.bits);
+  } else {
+    // Written before tiles stored token filters.  A parent's string samples are drawn from its children's, so a tile
+    // without any has none beneath it;  otherwise it might contain anything.
+    if (string_samples.empty()) {
+      token_filter.clear();
+    } else {
+      token_filter.set_full();
+    }
+  }
 }
 
+/// Merge sorted samples [begin, end) into dest.  A sample at the same time as an earlier one, whether already in dest
+/// or earlier in [begin, end), is combined with it according to policy.  A deletion value deletes all samples at
+/// its time.
+/// \return true if any sample already in dest was combined or deleted, or any samples in [begin, end) were
+/// combined, so that the tile's ranges need recomputing
 template <class T>
-void insert_samples_helper(const DataSample<T> *begin, const DataSample<T> *end, std::vector<DataSample<T> > &dest)
+bool insert_samples_helper(const DataSample<T> *begin, const DataSample<T> *end, std::vector<DataSample<T> > &dest,
+                           DuplicatePolicy policy)
 {
   // Assert sortedness
   for (int i = 1; i < end-begin; i++) assert(begin[i-1].time <= begin[i].time);
@@ -57,48 +77,96 @@ void insert_samples_helper(const DataSample<T> *begin, const DataSample<T> *end,
   DataSample<T> *begin2 = &dest[0];
   DataSample<T> *end2 = &dest[dest.size()];
   DataSample<T> *out = &tmp[0];
+  bool combined = false;
 
   // Merge
   while (!(begin == end && begin2 == end2)) {
-    if (begin == end) *out++ = *begin2++;
-    else if (begin2 == end2 || begin->time < begin2->time) {
-      // Next sample comes from new source.  Skip if deletion value
-      if (begin->is_deletion_value()) {
-        begin++;
-      } else {
-        *out++ = *begin++;
+    if (begin == end || (begin2 != end2 && begin2->time <= begin->time)) {
+      // Existing samples at a time go first, so that new samples at that time are combined with them
+      *out++ = *begin2++;
+    } else if (begin->is_deletion_value()) {
+      // Delete all samples at this time
+      while (out > &tmp[0] && out[-1].time == begin->time) {
+        out--;
+        combined = true;
       }
-    } else if (begin2->time < begin->time) *out++ = *begin2++;
-    else if (begin->is_deletion_value()) {
-      // Delete value
       begin++;
-      begin2++;
+    } else if (out > &tmp[0] && out[-1].time == begin->time) {
+      // Duplicate entry
+      combine_duplicate(out[-1], *begin++, policy);
+      combined = true;
     } else {
-      // Duplicate entry.  Overwrite
       *out++ = *begin++;
-      begin2++;
     }
   }
 
   dest.resize(out - &tmp[0]);
   std::copy(&tmp[0], out, &dest[0]);
+  return combined;
 }
   
-void Tile::insert_samples(const DataSample<double> *begin, const DataSample<double> *end) {
-  insert_samples_helper(begin, end, double_samples);
+void Tile::insert_samples(const DataSample<double> *begin, const DataSample<double> *end, DuplicatePolicy policy) {
+  bool combined = insert_samples_helper(begin, end, double_samples, policy);
+  if (combined) {
+    // Combining or deleting samples might shrink the ranges
+    recompute_ranges();
+    return;
+  }
   for (const DataSample<double> *s = begin; s < end; s++) {
-    // TODO(rsargent): if we're deleting a sample with NaN, we should recalc ranges
-    if (!isnan(s->value)) {
+    if (!s->is_deletion_value()) {
       ranges.times.add(s->time);
       ranges.double_samples.add(s->value);
     }
   }
 }
 
-void Tile::insert_samples(const DataSample<std::string> *begin, const DataSample<std::string> *end) {
-  insert_samples_helper(begin, end, string_samples);
+void Tile::insert_samples(const DataSample<std::string> *begin, const DataSample<std::string> *end,
+                          DuplicatePolicy policy) {
+  bool combined = insert_samples_helper(begin, end, string_samples, policy);
+  if (combined) {
+    recompute_ranges();
+    return;
+  }
   for (const DataSample<std::string> *s = begin; s < end; s++) {
     ranges.times.add(s->time);
+    token_filter.add(s->value);
+  }
+}
+
+template <class T>
+size_t delete_samples_helper(Range times, std::vector<DataSample<T> > &samples)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    if (!times.includes(samples[i].time)) samples[n++] = samples[i];
+  }
+  size_t ndeleted = samples.size() - n;
+  samples.resize(n);
+  return ndeleted;
+}
+
+/// Delete samples with times inside times (inclusive)
+/// \return true if any samples were deleted
+/// Ranges are recomputed from the remaining samples, so this is only meaningful for tiles without children
+bool Tile::delete_samples(Range times) {
+  size_t ndeleted = delete_samples_helper(times, double_samples) + delete_samples_helper(times, string_samples);
+  if (!ndeleted) return false;
+  recompute_ranges();
+  return true;
+}
+
+/// Recompute ranges and token filter from samples.  Only valid for tiles without children;  a parent's ranges and
+/// token filter come from its children, since its samples are summaries
+void Tile::recompute_ranges() {
+  ranges.clear();
+  token_filter.clear();
+  for (unsigned i = 0; i < double_samples.size(); i++) {
+    ranges.times.add(double_samples[i].time);
+    ranges.double_samples.add(double_samples[i].value);
+  }
+  for (unsigned i = 0; i < string_samples.size(); i++) {
+    ranges.times.add(string_samples[i].time);
+    token_filter.add(string_samples[i].value);
   }
 }
 
@@ -9,6 +9,7 @@
 #include "DataSample.h"
 #include "Range.h"
 #include "sizes.h"
+#include "TokenFilter.h"
 
 class Tile {
  public:
@@ -18,6 +19,8 @@ class Tile {
     uint32 version;
   } header;
   DataRanges ranges;
+  /// Tokens of the string samples in and beneath this tile
+  TokenFilter token_filter;
   enum {
     MAGIC = 0x69547442 // Magic('BtTi')
   };
@@ -26,8 +29,12 @@ class Tile {
   void to_binary(std::string &ret) const;
   size_t binary_length() const;
   void from_binary(const std::string &binary);
-  void insert_samples(const DataSample<double> *begin, const DataSample<double> *end);
-  void insert_samples(const DataSample<std::string> *begin, const DataSample<std::string> *end);
+  void insert_samples(const DataSample<double> *begin, const DataSample<double> *end,
+                      DuplicatePolicy policy = DUPLICATES_OVERWRITE);
+  void insert_samples(const DataSample<std::string> *begin, const DataSample<std::string> *end,
+                      DuplicatePolicy policy = DUPLICATES_OVERWRITE);
+  bool delete_samples(Range times);
+  void recompute_ranges();
   template <class T> std::vector<DataSample<T> > &get_samples();
   double first_sample_time() const;
   double last_sample_time() const;
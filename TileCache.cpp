@@ -0,0 +1,226 @@
+// C++
+#include <algorithm>
+#include <stdexcept>
+
+// C
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+// Local
+#include "Log.h"
+#include "utils.h"
+
+// Self
+#include "TileCache.h"
+
+/// First line of a cache file is this, then the key's length, the number of versions, and the versions, separated
+/// by spaces.  The key and the response follow.
+static const char FILE_MAGIC[] = "BTTC1";
+
+TileCache::TileCache(size_t max_bytes, const std::string &directory, size_t max_disk_bytes)
+  : m_max_bytes(max_bytes), m_bytes(0), m_directory(directory), m_max_disk_bytes(max_disk_bytes), m_disk_bytes(-1) {
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_mutex_init(&m_disk_mutex, NULL);
+  if (m_directory != "" && mkdir(m_directory.c_str(), 0777) != 0 && errno != EEXIST) {
+    throw std::runtime_error("mkdir " + m_directory + ": " + strerror(errno));
+  }
+}
+
+TileCache::~TileCache() {
+  pthread_mutex_destroy(&m_disk_mutex);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+bool TileCache::lookup(const std::string &key, std::vector<uint64> &versions, std::string &body) {
+  if (memory_lookup(key, versions, body)) return true;
+  if (m_directory == "" || !read_file(key, versions, body)) return false;
+  memory_insert(key, versions, body);
+  return true;
+}
+
+void TileCache::insert(const std::string &key, const std::vector<uint64> &versions, const std::string &body) {
+  memory_insert(key, versions, body);
+  if (m_directory != "") write_file(key, versions, body);
+}
+
+void TileCache::remove(const std::string &key) {
+  pthread_mutex_lock(&m_mutex);
+  std::map<std::string, Entry>::iterator entry = m_entries.find(key);
+  if (entry != m_entries.end()) erase(entry);
+  pthread_mutex_unlock(&m_mutex);
+  if (m_directory != "") unlink(key_to_path(key).c_str());
+}
+
+size_t TileCache::size_bytes() const {
+  pthread_mutex_lock(&m_mutex);
+  size_t ret = m_bytes;
+  pthread_mutex_unlock(&m_mutex);
+  return ret;
+}
+
+bool TileCache::memory_lookup(const std::string &key, std::vector<uint64> &versions, std::string &body) {
+  bool found = false;
+  pthread_mutex_lock(&m_mutex);
+  std::map<std::string, Entry>::iterator entry = m_entries.find(key);
+  if (entry != m_entries.end()) {
+    versions = entry->second.versions;
+    body = entry->second.body;
+    m_lru.splice(m_lru.begin(), m_lru, entry->second.lru_position);
+    found = true;
+  }
+  pthread_mutex_unlock(&m_mutex);
+  return found;
+}
+
+void TileCache::memory_insert(const std::string &key, const std::vector<uint64> &versions,
+                              const std::string &body) {
+  pthread_mutex_lock(&m_mutex);
+  std::map<std::string, Entry>::iterator entry = m_entries.find(key);
+  if (entry != m_entries.end()) erase(entry);
+  if (key.size() + body.size() <= m_max_bytes / 4) {
+    m_lru.push_front(key);
+    Entry &added = m_entries[key];
+    added.versions = versions;
+    added.body = body;
+    added.lru_position = m_lru.begin();
+    m_bytes += key.size() + body.size();
+    evict();
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+/// Evict least recently used responses until the cache fits.  Call with m_mutex locked.
+void TileCache::evict() {
+  while (m_bytes > m_max_bytes) erase(m_entries.find(m_lru.back()));
+}
+
+/// Call with m_mutex locked
+void TileCache::erase(std::map<std::string, Entry>::iterator entry) {
+  m_bytes -= entry->first.size() + entry->second.body.size();
+  m_lru.erase(entry->second.lru_position);
+  m_entries.erase(entry);
+}
+
+/// File named by the FNV-1a hash of key.  Files hold their key, so a collision reads as a miss.
+std::string TileCache::key_to_path(const std::string &key) const {
+  uint64 hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size(); i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 1099511628211ULL;
+  }
+  return string_printf("%s/%016llx", m_directory.c_str(), (unsigned long long)hash);
+}
+
+/// Read key's file, and mark it used.  Unreadable files are removed.
+bool TileCache::read_file(const std::string &key, std::vector<uint64> &versions, std::string &body) const {
+  std::string path = key_to_path(key);
+  FILE *in = fopen(path.c_str(), "rb");
+  if (!in) return false;
+  std::string contents;
+  char buf[65536];
+  size_t nread;
+  while ((nread = fread(buf, 1, sizeof(buf), in)) > 0) contents.append(buf, nread);
+  fclose(in);
+
+  size_t header_end = contents.find('\n');
+  std::string header = contents.substr(0, header_end);
+  char magic[sizeof(FILE_MAGIC)];
+  unsigned long key_length, nversions;
+  int consumed = 0;
+  bool valid = header_end != std::string::npos &&
+    sscanf(header.c_str(), "%5s %lu %lu%n", magic, &key_length, &nversions, &consumed) == 3 &&
+    !strcmp(magic, FILE_MAGIC) && contents.size() >= header_end + 1 + key_length;
+  std::vector<uint64> file_versions;
+  const char *pos = header.c_str() + consumed;
+  for (unsigned long i = 0; valid && i < nversions; i++) {
+    unsigned long long version;
+    valid = sscanf(pos, " %llu%n", &version, &consumed) == 1;
+    file_versions.push_back(version);
+    pos += consumed;
+  }
+  if (!valid) {
+    unlink(path.c_str());
+    return false;
+  }
+  // A different key with the same hash
+  if (key_length != key.size() || contents.compare(header_end + 1, key_length, key) != 0) return false;
+  utime(path.c_str(), NULL);
+  versions = file_versions;
+  body = contents.substr(header_end + 1 + key_length);
+  return true;
+}
+
+/// Write to a temporary file, then rename it into place, so readers in other threads and processes never see a
+/// partly written response.  Failures are logged, not thrown;  the response is still cached in memory.
+void TileCache::write_file(const std::string &key, const std::vector<uint64> &versions,
+                           const std::string &body) {
+  std::string header = string_printf("%s %zu %zu", FILE_MAGIC, key.size(), versions.size());
+  for (unsigned i = 0; i < versions.size(); i++) header += string_printf(" %llu", (unsigned long long)versions[i]);
+  header += "\n";
+  std::string path = key_to_path(key);
+  std::string temp_path = string_printf("%s.%d.%lx", path.c_str(), getpid(), (unsigned long)pthread_self());
+  FILE *out = fopen(temp_path.c_str(), "wb");
+  if (!out) {
+    log_f("TileCache: can't write %s: %s", temp_path.c_str(), strerror(errno));
+    return;
+  }
+  bool success = fwrite(header.data(), 1, header.size(), out) == header.size() &&
+    fwrite(key.data(), 1, key.size(), out) == key.size() &&
+    fwrite(body.data(), 1, body.size(), out) == body.size();
+  if (fclose(out) != 0) success = false;
+  if (!success || rename(temp_path.c_str(), path.c_str()) != 0) {
+    log_f("TileCache: can't write %s: %s", path.c_str(), strerror(errno));
+    unlink(temp_path.c_str());
+    return;
+  }
+
+  pthread_mutex_lock(&m_disk_mutex);
+  if (m_disk_bytes >= 0) m_disk_bytes += header.size() + key.size() + body.size();
+  if (m_disk_bytes < 0 || m_disk_bytes > (long long)m_max_disk_bytes) trim_directory();
+  pthread_mutex_unlock(&m_disk_mutex);
+}
+
+struct CacheFile {
+  std::string path;
+  time_t last_used;
+  off_t size;
+  bool operator<(const CacheFile &rhs) const { return last_used < rhs.last_used; }
+};
+
+/// Find the size of the files in the directory, and remove the least recently used until they're within three
+/// quarters of m_max_disk_bytes if they're over it.  Files are marked used when read.  Call with m_disk_mutex locked.
+void TileCache::trim_directory() {
+  DIR *dir = opendir(m_directory.c_str());
+  if (!dir) {
+    log_f("TileCache: can't read %s: %s", m_directory.c_str(), strerror(errno));
+    return;
+  }
+  std::vector<CacheFile> files;
+  long long total = 0;
+  while (struct dirent *entry = readdir(dir)) {
+    // Skip ., .. and temporary files
+    if (strchr(entry->d_name, '.')) continue;
+    CacheFile file;
+    file.path = m_directory + "/" + entry->d_name;
+    struct stat st;
+    if (stat(file.path.c_str(), &st) != 0) continue;
+    file.last_used = st.st_mtime;
+    file.size = st.st_size;
+    files.push_back(file);
+    total += st.st_size;
+  }
+  closedir(dir);
+
+  if (total > (long long)m_max_disk_bytes) {
+    std::sort(files.begin(), files.end());
+    for (unsigned i = 0; i < files.size() && total > (long long)(m_max_disk_bytes / 4 * 3); i++) {
+      if (unlink(files[i].path.c_str()) == 0) total -= files[i].size;
+    }
+  }
+  m_disk_bytes = total;
+}
@@ -0,0 +1,86 @@
+#ifndef TILE_CACHE_INCLUDE_H
+#define TILE_CACHE_INCLUDE_H
+
+// C++
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// C
+#include <pthread.h>
+
+// Local
+#include "sizes.h"
+
+/// \class TileCache TileCache.h
+///
+/// Bounded cache of rendered tile responses, evicting the least recently used.  Each response is stored with the
+/// versions of the data it was rendered from (for tiles, the creation ids and modification counts of its channels),
+/// which callers check against the current data before using it.
+///
+/// With a directory, responses are also written to files there, one per key, and read back when missing from
+/// memory, so they outlive the process and are shared by every process using the directory.  Files are replaced
+/// when their key is inserted again.  When a process's writes take the directory past max_disk_bytes, it removes
+/// the least recently used files until the directory is back under three quarters of that;  other processes'
+/// writes are only counted when it next rescans the directory.
+///
+/// The cache is safe to use from multiple threads.
+class TileCache {
+public:
+  static const size_t DEFAULT_MAX_DISK_BYTES = (size_t)1024 * 1024 * 1024;
+
+  /// \param max_bytes Memory for cached responses.  Responses larger than a quarter of this aren't kept in memory.
+  /// \param directory If not "", directory to also cache responses in;  created if it doesn't exist
+  /// \param max_disk_bytes Size of the files in directory
+  TileCache(size_t max_bytes, const std::string &directory = "", size_t max_disk_bytes = DEFAULT_MAX_DISK_BYTES);
+  ~TileCache();
+
+  /// Get cached response
+  /// \param versions If found, returns the versions stored with the response
+  /// \param body If found, returns response in this parameter
+  /// \return true if key is cached
+  bool lookup(const std::string &key, std::vector<uint64> &versions, std::string &body);
+
+  /// Cache response, replacing any earlier response for key
+  void insert(const std::string &key, const std::vector<uint64> &versions, const std::string &body);
+
+  /// Remove any response for key, e.g. when its versions show it's out of date
+  void remove(const std::string &key);
+
+  /// Memory used by responses
+  size_t size_bytes() const;
+
+private:
+  struct Entry {
+    std::vector<uint64> versions;
+    std::string body;
+    std::list<std::string>::iterator lru_position;
+  };
+  size_t m_max_bytes;
+  size_t m_bytes;
+  std::string m_directory;
+  size_t m_max_disk_bytes;
+  /// Size of the files in m_directory, counting writes since it was last scanned;  -1 until first scanned
+  long long m_disk_bytes;
+  pthread_mutex_t m_disk_mutex;
+  /// Most recently used key first
+  std::list<std::string> m_lru;
+  std::map<std::string, Entry> m_entries;
+  mutable pthread_mutex_t m_mutex;
+
+  bool memory_lookup(const std::string &key, std::vector<uint64> &versions, std::string &body);
+  void memory_insert(const std::string &key, const std::vector<uint64> &versions, const std::string &body);
+  void evict();
+  void erase(std::map<std::string, Entry>::iterator entry);
+  std::string key_to_path(const std::string &key) const;
+  bool read_file(const std::string &key, std::vector<uint64> &versions, std::string &body) const;
+  void write_file(const std::string &key, const std::vector<uint64> &versions, const std::string &body);
+  void trim_directory();
+
+  // Not copyable
+  TileCache(const TileCache&);
+  TileCache &operator=(const TileCache&);
+};
+
+#endif
@@ -2,10 +2,12 @@
 #define INCLUDE_TILE_INDEX_H
 
 // System
+#include <algorithm>
 #include <assert.h>
 #include <limits.h>
 #include <limits>
 #include <math.h>
+#include <string.h>
 
 // Local
 #include "Range.h"
@@ -68,11 +70,15 @@ struct TileIndex {
   }
 
   bool contains_time(double time) const {
-    return start_time() <= time && time < end_time();
+    if (is_null() || is_all()) return start_time() <= time && time < end_time();
+    double d = duration();
+    return d*offset <= time && time < d*(offset+1);
   }
 
+  /// Position of time within tile, from 0 at start_time() to 1 at end_time().  Multiplies by the exact inverse of
+  /// the duration, which gives the same result as dividing by it.
   double position(double time) const {
-    return (time - start_time()) / duration();
+    return (time - start_time()) * power_of_two(-(int64)level);
   }
 
   double duration() const {
@@ -80,13 +86,26 @@ struct TileIndex {
   }
 
   static double level_to_duration(int level) {
-    return pow(2.0, level);
+    return power_of_two(level);
   }
   
+  /// Not for hot loops:  durations that aren't powers of two give fractional levels
   static double duration_to_level(double duration) {
     return log2(duration);
   }
 
+  /// 2^exponent, exactly, without calling pow.  Normal doubles are assembled directly from their exponent bits;
+  /// the rest (only the extremes of the level range, such as the roots' INT_MAX) come from ldexp.
+  static double power_of_two(int64 exponent) {
+    if (exponent >= -1022 && exponent <= 1023) {
+      uint64 bits = (uint64)(exponent + 1023) << 52;
+      double ret;
+      memcpy(&ret, &bits, sizeof(ret));
+      return ret;
+    }
+    return ldexp(1.0, (int)std::max<int64>(INT_MIN, std::min<int64>(INT_MAX, exponent)));
+  }
+
   static double level_to_bin_secs(int level) {
     assert(0);
   }
@@ -99,7 +118,7 @@ struct TileIndex {
   }
 
   static TileIndex index_at_level_containing(int level, double time) {
-    return TileIndex(level, (long long)floor(time / level_to_duration(level)));
+    return TileIndex(level, (long long)floor(time * power_of_two(-(int64)level)));
   }
 
   /// Select level according to max_time-min_time, selecting tile that contains min_time, then move to parents until max_time is contained
@@ -107,7 +126,7 @@ struct TileIndex {
   static TileIndex index_containing(Range times) {
     assert(times.min < times.max);
     assert(times.min >= 0 || times.max < 0);
-    int level = (int)floor(log2(times.max - times.min));
+    int level = ilogb(times.max - times.min);  // floor(log2()), exactly
     TileIndex ret = index_at_level_containing(level, times.min);
     while (!ret.contains_time(times.max)) ret = ret.parent();
     //fprintf(stderr, "index_containing(%g, %g)=%s\n", times.min, times.max, ret.to_string().c_str());
@@ -130,7 +149,16 @@ struct TileIndex {
   // Is TileIndex ancestor of child?
   // \return true if TileIndex is parent of child, or a higher ancestor.  false if not.  false if identical to child
   bool is_ancestor_of(const TileIndex &child) const {
-    return (level > child.level) && (offset == (child.offset >> (unsigned)(level-child.level)));
+    if (level <= child.level || child.is_null()) return false;
+    // Shifting by 64 or more bits is undefined;  offsets that far down saturate to 0 (nonnegative) or -1 (negative)
+    int64 shift = (int64)level - child.level;
+    if (shift >= 64) return offset == (child.offset < 0 ? -1 : 0);
+    return offset == (child.offset >> shift);
+  }
+
+  /// Does tile hold times before zero?  Negative and nonnegative times are stored in separate trees
+  bool is_negative() const {
+    return offset < 0;
   }
 
   /// Return parent
@@ -0,0 +1,108 @@
+#ifndef TOKEN_FILTER_INCLUDE_H
+#define TOKEN_FILTER_INCLUDE_H
+
+// C++
+#include <string>
+#include <vector>
+
+// C
+#include <ctype.h>
+
+// Local
+#include "sizes.h"
+
+/// \class TokenFilter TokenFilter.h
+///
+/// Bloom filter of the tokens in a tile's string samples and, for a parent tile, in all the string samples beneath
+/// it, so keyword searches can skip tiles without reading their descendants.  A token is a run of letters and
+/// digits, compared without case.  might_contain can give false positives but never false negatives.
+///
+/// A filter with no tokens has no bits, so tiles without string samples stay small.  Filters read from tiles
+/// written before tiles stored them are full, matching every token, unless the tile has no string samples.
+class TokenFilter {
+public:
+  enum {
+    WORDS = 128,  // 4096 bits
+    HASHES = 3
+  };
+  /// Bits of the filter;  empty if no tokens were added, or WORDS long
+  std::vector<uint32> bits;
+
+  void clear() { bits.clear(); }
+  void set_full() { bits.assign(WORDS, ~(uint32)0); }
+
+  /// Add the tokens of text
+  void add(const std::string &text) {
+    std::vector<std::string> tokens;
+    tokenize(text, tokens);
+    for (unsigned i = 0; i < tokens.size(); i++) add_token(tokens[i]);
+  }
+
+  /// Add the tokens of another filter
+  void add(const TokenFilter &rhs) {
+    if (rhs.bits.empty()) return;
+    if (bits.empty()) {
+      bits = rhs.bits;
+      return;
+    }
+    for (unsigned i = 0; i < WORDS; i++) bits[i] |= rhs.bits[i];
+  }
+
+  void add_token(const std::string &token) {
+    if (bits.empty()) bits.assign(WORDS, 0);
+    uint32 h1, h2;
+    hash(token, h1, h2);
+    for (uint32 i = 0; i < HASHES; i++) {
+      uint32 bit = (h1 + i * h2) % (WORDS * 32);
+      bits[bit / 32] |= (uint32)1 << (bit % 32);
+    }
+  }
+
+  /// \return false if token was certainly never added
+  bool might_contain(const std::string &token) const {
+    if (bits.empty()) return false;
+    uint32 h1, h2;
+    hash(token, h1, h2);
+    for (uint32 i = 0; i < HASHES; i++) {
+      uint32 bit = (h1 + i * h2) % (WORDS * 32);
+      if (!(bits[bit / 32] & ((uint32)1 << (bit % 32)))) return false;
+    }
+    return true;
+  }
+
+  /// \return false if any of tokens was certainly never added
+  bool might_contain_all(const std::vector<std::string> &tokens) const {
+    for (unsigned i = 0; i < tokens.size(); i++) {
+      if (!might_contain(tokens[i])) return false;
+    }
+    return true;
+  }
+
+  /// Split text into lower-case tokens
+  static void tokenize(const std::string &text, std::vector<std::string> &tokens) {
+    tokens.clear();
+    std::string token;
+    for (unsigned i = 0; i <= text.length(); i++) {
+      if (i < text.length() && isalnum((unsigned char)text[i])) {
+        token += (char)tolower((unsigned char)text[i]);
+      } else if (token.length()) {
+        tokens.push_back(token);
+        token.clear();
+      }
+    }
+  }
+
+private:
+  /// Two 32-bit FNV-1a hashes with different offsets, combined for the filter's HASHES bit positions
+  static void hash(const std::string &token, uint32 &h1, uint32 &h2) {
+    h1 = 2166136261u;
+    h2 = 84696351u;
+    for (unsigned i = 0; i < token.length(); i++) {
+      h1 = (h1 ^ (unsigned char)token[i]) * 16777619u;
+      h2 = (h2 ^ (unsigned char)token[i]) * 16777619u;
+    }
+    h2 |= 1;
+  }
+};
+
+#endif
@@ -12,6 +12,8 @@
 
 // Local
 #include "Channel.h"
+#include "ChannelSampleRange.h"
+#include "ChannelWriter.h"
 #include "FilesystemKVS.h"
 #include "Log.h"
 #include "utils.h"
@@ -26,34 +28,24 @@ void usage()
 
 bool dry_run = false;
 
-Channel *to_ch_ptr = NULL;
-size_t total_double_samples;
-size_t total_string_samples;
+// Samples read before adding them to the destination
+enum { COPY_BATCH_SAMPLES = 65536 };
 
-bool copy_samples(const Tile &tile, double min_time, double max_time)
+/// Add batch of samples to writer, and empty the batch
+void copy_samples(ChannelWriter &to_writer,
+                  std::vector<DataSample<double> > &double_samples,
+                  std::vector<DataSample<std::string> > &string_samples,
+                  size_t &total_double_samples,
+                  size_t &total_string_samples)
 {
-  std::vector<DataSample<double> > double_samples;
-  std::vector<DataSample<std::string> > string_samples;
+  if (!dry_run) to_writer.add_data(double_samples);
+  if (!dry_run) to_writer.add_data(string_samples);
 
-  for (unsigned i = 0; i < tile.double_samples.size(); i++) {
-    if (min_time <= tile.double_samples[i].time && tile.double_samples[i].time < max_time) {
-      double_samples.push_back(tile.double_samples[i]);
-    }
-  }
-  if (!dry_run) to_ch_ptr->add_data(double_samples);
-
-  for (unsigned i = 0; i < tile.string_samples.size(); i++) {
-    if (min_time <= tile.string_samples[i].time && tile.string_samples[i].time < max_time) {
-      string_samples.push_back(tile.string_samples[i]);
-    }
-  }
-  if (!dry_run) to_ch_ptr->add_data(string_samples);
-  
   fprintf(stderr, "Added %zd double samples, %zd string samples\n", double_samples.size(), string_samples.size());
   total_double_samples += double_samples.size();
   total_string_samples += string_samples.size();
-
-  return true;
+  double_samples.clear();
+  string_samples.clear();
 }
 
 int main(int argc, char **argv)
@@ -105,11 +97,21 @@ int main(int argc, char **argv)
 	from_store_name.c_str(), from_uid, from_channel_full_name.c_str(),
 	to_store_name.c_str(), to_uid, to_channel_full_name.c_str());
   
-  to_ch_ptr = &to_ch;
-
+  size_t total_double_samples = 0, total_string_samples = 0;
   {
-    Channel::Locker locker(from_ch);
-    from_ch.read_bottommost_tiles_in_range(min_time, max_time, copy_samples);
+    // Samples are read in ascending time, so the writer only holds one destination tile's samples at a time
+    ChannelWriter to_writer(to_ch);
+    std::vector<DataSample<double> > double_samples;
+    std::vector<DataSample<std::string> > string_samples;
+    for (ChannelSampleRange samples(from_ch, Range(min_time, max_time)); !samples.done(); samples.advance()) {
+      if (samples.double_sample()) double_samples.push_back(*samples.double_sample());
+      if (samples.string_sample()) string_samples.push_back(*samples.string_sample());
+      if (double_samples.size() + string_samples.size() >= COPY_BATCH_SAMPLES) {
+        copy_samples(to_writer, double_samples, string_samples, total_double_samples, total_string_samples);
+      }
+    }
+    copy_samples(to_writer, double_samples, string_samples, total_double_samples, total_string_samples);
+    to_writer.commit();
   }
 
   log_f("copy: FINISHED in %lld msec.  copied %zd doubles and %zd strings", 
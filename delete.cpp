@@ -0,0 +1,119 @@
+// C++
+#include <iostream>
+#include <string>
+#include <vector>
+
+// C
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Local
+#include "Arglist.h"
+#include "Channel.h"
+#include "FilesystemKVS.h"
+#include "Log.h"
+#include "simple_shared_ptr.h"
+#include "utils.h"
+
+void usage(const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  std::string msg = string_vprintf(fmt, args);
+  va_end(args);
+  std::cerr << msg << "\n";
+  std::cerr << "Usage:\n";
+  std::cerr << "delete store.kvs uid dev_nickname.ch_name [dev_nickname.ch_name ...] --start t --end t\n";
+  std::cerr << "delete store.kvs uid.dev_nickname.ch_name [uid.dev_nickname.ch_name ...] --start t --end t\n";
+  std::cerr << "   Deletes all samples with start <= time <= end (floating-point epoch times).\n";
+  std::cerr << "   Both --start and --end are required.\n";
+  throw std::runtime_error("Bad arguments: " + msg);
+}
+
+void emit_json(Json::Value &json) {
+  std::string response = rtrim(Json::FastWriter().write(json));
+  printf("%s\n", response.c_str());
+  log_f("delete: sending: %s", response.c_str());
+}
+
+int execute(Arglist args) {
+  long long begin_time = millitime();
+  std::string invocation = args.to_string();
+
+  std::string storename;
+  int uid = -1;
+  std::vector<std::string> channel_full_names;
+  bool has_start = false, has_end = false;
+  Range times;
+
+  while (!args.empty()) {
+    std::string arg = args.shift();
+    if (arg == "--start") {
+      times.min = args.shift_double();
+      has_start = true;
+    } else if (arg == "--end") {
+      times.max = args.shift_double();
+      has_end = true;
+    } else if (Arglist::is_flag(arg)) {
+      usage("Unknown flag '%s'", arg.c_str());
+    } else if (storename == "") {
+      storename = arg;
+    } else if (uid == -1 && !channel_full_names.size()) {
+      // This might be UID or a fully-specified channel name of the form UID.dev.ch
+      if (strchr(arg.c_str(), '.')) {
+        channel_full_names.push_back(arg);
+      } else {
+        uid = Arglist::parse_int(arg);
+      }
+    } else {
+      channel_full_names.push_back(arg);
+    }
+  }
+
+  if (storename == "") usage("Missing store");
+  if (channel_full_names.size() == 0) usage("No channels specified");
+  if (!has_start || !has_end) usage("Both --start and --end must be specified");
+  if (times.empty()) usage("--start must not be after --end");
+
+  set_log_prefix(string_printf("%d %d ", getpid(), uid));
+  log_f("delete START: %s", invocation.c_str());
+
+  FilesystemKVS store(storename.c_str());
+
+  Json::Value channel_specs(Json::objectValue);
+  for (unsigned i = 0; i < channel_full_names.size(); i++) {
+    simple_shared_ptr<Channel> ch;
+    if (uid == -1) {
+      ch.reset(new Channel(store, channel_full_names[i]));
+    } else {
+      ch.reset(new Channel(store, uid, channel_full_names[i]));
+    }
+    DataRanges channel_ranges;
+    ch->delete_range(times, &channel_ranges);
+    log_f("delete: %s: deleted %s", ch->descriptor().c_str(), times.to_string("%.6f").c_str());
+    channel_specs[channel_full_names[i]] = Json::Value(Json::objectValue);
+    channel_specs[channel_full_names[i]]["channel_bounds"] = channel_ranges.to_json();
+  }
+
+  Json::Value result(Json::objectValue);
+  result["channel_specs"] = channel_specs;
+  log_f("delete: finished in %lld msec", millitime() - begin_time);
+  emit_json(result);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int exit_code = 1;
+  try {
+    exit_code = execute(Arglist(argv + 1, argv + argc));
+  } catch (const std::exception &e) {
+    log_f("delete: caught exception '%s'", e.what());
+    Json::Value json_response(Json::objectValue);
+    json_response["failure"] = Json::Value(string_printf("exception: %s", e.what()));
+    emit_json(json_response);
+  }
+  return exit_code;
+}
@@ -6,13 +6,18 @@
 
 // C++
 #include <cfloat>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <queue>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <chrono>
 
 // C
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -25,12 +30,18 @@
 // Local
 #include "Arglist.h"
 #include "Channel.h"
+#include "ChannelSampleRange.h"
 #include "FilesystemKVS.h"
 #include "Log.h"
+#include "OutputBuffer.h"
 #include "simple_shared_ptr.h"
 #include "utils.h"
 
 int double_precision_digits = 15;
+// True if --resolution or --max-points was given:  numeric samples are followed by their stddev and count
+bool output_summaries = false;
+// All exported data goes through here, rather than printf or std::cout per value
+OutputBuffer output;
 
 void usage(const char *fmt, ...) {
   std::cerr << "\n";
@@ -58,51 +69,129 @@ void usage(const char *fmt, ...) {
   std::cerr << "                      sometimes ending similarly to 999999 or 000001.\n";
   std::cerr << "                      output, to capture fully all the bits of precision, at the expense\n";
   std::cerr << "                      of showing an imprecise final digits, e.g. ending with 9999 or 0001\n";
+  std::cerr << "   --resolution:      read summaries with samples no more than this many seconds apart,\n";
+  std::cerr << "                      rather than every sample.  Each numeric value is followed by the\n";
+  std::cerr << "                      standard deviation and count of the samples it summarizes, at the\n";
+  std::cerr << "                      center of its bin, so that channels' summaries share rows.\n";
+  std::cerr << "   --max-points:      like --resolution, choosing the resolution that gives about this many\n";
+  std::cerr << "                      samples per channel over the exported time range\n";
+  std::cerr << "   --asof:            one row per sample of the given channel, with the most recent value\n";
+  std::cerr << "                      at or before that time from each of the other channels.\n";
+  std::cerr << "                      Requires --csv or --json.\n";
   std::cerr << "Exiting...\n";
   exit(1);
 }
 
-bool dump_samples(const Tile &tile, Range requested_times) {
-  unsigned double_index = 0, string_index = 0;
+/// Width of the bins summaries are output in, or 0 when samples are output as they are.  A tile at desired_level
+/// holds up to BT_CHANNEL_DOUBLE_SAMPLES samples, so its bins are 2^(desired_level-15) seconds wide.
+double summary_bin_width(int desired_level) {
+  if (!output_summaries) return 0;
+  return TileIndex(desired_level, 0).duration() / BT_CHANNEL_DOUBLE_SAMPLES;
+}
 
-  while (1) {
-    bool select_double;
-    if (double_index >= tile.double_samples.size()) {
-      // no more double samples
-      if (string_index >= tile.string_samples.size()) {
-        // no more samples at all; done
-        break;
-      }
-      select_double = false;
-    } else if (string_index >= tile.string_samples.size()) {
-      // no more string samples
-      select_double = true;
-    } else {
-      // Select the earliest sample from double or string
-      select_double = tile.double_samples[double_index].time <= tile.string_samples[string_index].time;
+/// A ChannelSampleRange's positions, with summaries snapped to a grid of bins.  A summary's time is the mean time
+/// of the samples it combines, which differs from channel to channel;  here each bin's samples are combined and
+/// given the time of the bin's center, so that summaries of different channels fall at the same times and share
+/// rows.  With a bin width of 0, positions are passed through unchanged.
+class BinnedSamples {
+public:
+  /// \param samples Range to read;  must outlive this
+  /// \param bin_width Width of bins, aligned at multiples of bin_width;  0 to leave samples as they are
+  BinnedSamples(ChannelSampleRange &samples, double bin_width) : m_samples(samples), m_bin_width(bin_width) {
+    combine();
+  }
+
+  bool done() const { return m_done; }
+
+  double time() const { return m_bin_width ? m_time : m_samples.time(); }
+
+  /// \return Double sample at current position, or NULL if none.  Valid until advance.
+  const DataSample<double> *double_sample() const {
+    if (!m_bin_width) return m_samples.double_sample();
+    return m_has_double ? &m_double : NULL;
+  }
+
+  /// \return String sample at current position, or NULL if none.  Valid until advance.
+  const DataSample<std::string> *string_sample() const {
+    if (!m_bin_width) return m_samples.string_sample();
+    return m_has_string ? &m_string : NULL;
+  }
+
+  void advance() {
+    if (!m_bin_width) m_samples.advance();
+    combine();
+  }
+
+private:
+  ChannelSampleRange &m_samples;
+  double m_bin_width;
+  bool m_done;
+  double m_time;
+  bool m_has_double, m_has_string;
+  DataSample<double> m_double;
+  DataSample<std::string> m_string;
+
+  // Combine the samples of the bin holding the range's position, leaving the range at the next bin
+  void combine() {
+    m_done = m_samples.done();
+    if (!m_bin_width || m_done) return;
+    double bin = floor(m_samples.time() / m_bin_width);
+    DataAccumulator<double> doubles;
+    DataAccumulator<std::string> strings;
+    for (; !m_samples.done() && floor(m_samples.time() / m_bin_width) == bin; m_samples.advance()) {
+      if (const DataSample<double> *sample = m_samples.double_sample()) doubles += *sample;
+      if (const DataSample<std::string> *sample = m_samples.string_sample()) strings += *sample;
+    }
+    m_time = (bin + 0.5) * m_bin_width;
+    m_has_double = doubles.weight > 0;
+    if (m_has_double) {
+      m_double = doubles.get_sample();
+      m_double.time = m_time;
+    }
+    m_has_string = strings.weight > 0;
+    if (m_has_string) {
+      m_string = strings.get_sample();
+      m_string.time = m_time;
     }
+  }
+};
 
-    if (select_double) {
-      DataSample<double> sample = tile.double_samples[double_index++];
-      if (requested_times.includes(sample.time))
-        printf("%.*g\t%*g\n", double_precision_digits, sample.time, double_precision_digits, sample.value);
-    } else {
-      DataSample<std::string> sample = tile.string_samples[string_index++];
-      if (requested_times.includes(sample.time))
-        printf("%.*g\t%s\n", double_precision_digits, sample.time, sample.value.c_str());
+void dump_samples(BinnedSamples &samples) {
+  for (; !samples.done(); samples.advance()) {
+    if (const DataSample<double> *sample = samples.double_sample()) {
+      // Value is printed as %*g:  default precision, right-aligned in double_precision_digits chars
+      output.append_double(sample->time, double_precision_digits);
+      output.append('\t');
+      output.append_double(sample->value, 6, double_precision_digits);
+      if (output_summaries) {
+        output.append('\t');
+        output.append_double(sample->stddev, double_precision_digits);
+        output.append('\t');
+        output.append_fixed(sample->weight, 0);
+      }
+      output.append('\n');
+    }
+    if (const DataSample<std::string> *sample = samples.string_sample()) {
+      output.append_double(sample->time, double_precision_digits);
+      output.append('\t');
+      output.append(sample->value.c_str());
+      output.append('\n');
     }
   }
-  return true;
 }
 
-void export_legacy(KVS &store, Range timerange, int uid, const std::vector<std::string> &channel_full_names) {
+void export_legacy(KVS &store, Range timerange, int uid, const std::vector<std::string> &channel_full_names,
+                   int desired_level) {
   for (unsigned i = 0; i < channel_full_names.size(); i++) {
     const std::string &channel_full_name = channel_full_names[i];
-    if (i) printf("\f");
-    printf("Time\t%s\n", channel_full_name.c_str());
+    if (i) output.append('\f');
+    output.append("Time\t");
+    output.append(channel_full_name);
+    output.append('\n');
     Channel ch(store, uid, channel_full_name);
-    Channel::Locker locker(ch);
-    ch.read_tiles_in_range(timerange, dump_samples, TileIndex::lowest_level());
+    ChannelSampleRange range(ch, timerange, desired_level);
+    BinnedSamples samples(range, summary_bin_width(desired_level));
+    dump_samples(samples);
   }
 }
 
@@ -142,157 +231,421 @@ std::string quote_json(std::string str) {
   return ret;
 }
 
-// TODO(rsargent): implement version that can subsample
-// TODO(rsargent): move to ChannelReader.{cpp,h}
+// One channel's samples, in time order, for merging with other channels'.  A background thread reads the channel's
+// tiles into a short queue of batches ahead of the merge, so tile reads overlap output and other channels' reads.
 class ChannelReader {
 private:
-  std::string channel_name;
+  // One position of the channel:  indexes into its batch's samples, or -1 where a sample is missing
+  struct Entry {
+    double time;
+    int double_index, string_index;
+  };
+  struct Batch {
+    std::vector<Entry> entries;
+    std::vector<DataSample<double> > double_samples;
+    std::vector<DataSample<std::string> > string_samples;
+    void swap(Batch &rhs) {
+      entries.swap(rhs.entries);
+      double_samples.swap(rhs.double_samples);
+      string_samples.swap(rhs.string_samples);
+    }
+    void clear() {
+      entries.clear();
+      double_samples.clear();
+      string_samples.clear();
+    }
+  };
+  enum {
+    BATCH_SIZE = 1024,
+    MAX_QUEUED_BATCHES = 4
+  };
+
   simple_shared_ptr<Channel> channel;
-  TileIndex ti; // null if current tile is invalid
-  Tile tile;
-  unsigned double_index, string_index;
+  Range times;
   int desired_level;
 
-public:
-  ChannelReader(const std::string &channel_name, simple_shared_ptr<Channel> channel, double time)
-    : channel_name(channel_name), channel(channel), desired_level(TileIndex::lowest_level()) {
-    seek(time);
+  // Used only by the merging thread
+  Batch current;
+  size_t index;
+  bool finished;
+
+  // Shared with the fetch thread, under mutex
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  std::deque<Batch> queue;
+  bool fetch_done, stopping;
+  std::string fetch_error;
+
+  void start() {
+    fetch_done = stopping = false;
+    index = 0;
+    finished = false;
+    if (pthread_create(&thread, NULL, fetch_thread, this)) throw std::runtime_error("ChannelReader: pthread_create failed");
+  }
+
+  void stop() {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+  }
+
+  static void *fetch_thread(void *reader) {
+    ((ChannelReader*)reader)->fetch();
+    return NULL;
+  }
+
+  // Read batches until the range is done or the reader stops.  Waits while the queue is full.
+  void fetch() {
+    std::string error;
+    try {
+      ChannelSampleRange range(*channel, times, desired_level);
+      BinnedSamples samples(range, summary_bin_width(desired_level));
+      while (!samples.done()) {
+        Batch batch;
+        batch.entries.reserve(BATCH_SIZE);
+        batch.double_samples.reserve(BATCH_SIZE);
+        for (; !samples.done() && batch.entries.size() < BATCH_SIZE; samples.advance()) {
+          Entry entry;
+          entry.time = samples.time();
+          entry.double_index = entry.string_index = -1;
+          if (samples.double_sample()) {
+            entry.double_index = batch.double_samples.size();
+            batch.double_samples.push_back(*samples.double_sample());
+          }
+          if (samples.string_sample()) {
+            entry.string_index = batch.string_samples.size();
+            batch.string_samples.push_back(*samples.string_sample());
+          }
+          batch.entries.push_back(entry);
+        }
+        pthread_mutex_lock(&mutex);
+        while (queue.size() >= MAX_QUEUED_BATCHES && !stopping) pthread_cond_wait(&changed, &mutex);
+        bool stopped = stopping;
+        if (!stopped) {
+          queue.push_back(Batch());
+          queue.back().swap(batch);
+          pthread_cond_broadcast(&changed);
+        }
+        pthread_mutex_unlock(&mutex);
+        if (stopped) return;
+      }
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+    pthread_mutex_lock(&mutex);
+    fetch_done = true;
+    fetch_error = error;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
   }
 
-  // Seek to first time >= new_time
-  void seek(double new_time) {
-    TileIndex root = root_tile();
-    if (root.is_null()) {
-      ti = TileIndex::null();
+  // Make current the next batch from the fetch thread, waiting for it if needed.  Sets finished if none is left.
+  void next_batch() {
+    pthread_mutex_lock(&mutex);
+    while (queue.empty() && !fetch_done) pthread_cond_wait(&changed, &mutex);
+    current.clear();
+    index = 0;
+    if (queue.empty()) {
+      finished = true;
     } else {
-      read_tile_or_successor(channel->find_child_overlapping_time(root, new_time, desired_level), root);
-      while (time() < new_time) advance();
+      current.swap(queue.front());
+      queue.pop_front();
+      pthread_cond_broadcast(&changed);
     }
+    std::string error = fetch_error;
+    pthread_mutex_unlock(&mutex);
+    if (finished && error != "") throw std::runtime_error(error);
+  }
+
+  // Entry at current position, or NULL if no more samples available
+  const Entry *entry() {
+    if (index == current.entries.size() && !finished) next_batch();
+    return finished ? NULL : &current.entries[index];
+  }
+
+public:
+  // desired_level above TileIndex::lowest_level() reads summaries (see Channel::read_data)
+  ChannelReader(simple_shared_ptr<Channel> channel, Range times, int desired_level = TileIndex::lowest_level())
+    : channel(channel), times(times), desired_level(desired_level) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&changed, NULL);
+    start();
+  }
+
+  ~ChannelReader() {
+    stop();
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&mutex);
   }
 
   // Returns NULL if no double_sample at current time, or if no more samples available
-  DataSample<double> *double_sample() {
-    if (!ti.is_null() && double_index < tile.double_samples.size()) {
-      return &tile.double_samples[double_index];
-    }
-    return NULL;
+  const DataSample<double> *double_sample() {
+    const Entry *e = entry();
+    return e && e->double_index >= 0 ? &current.double_samples[e->double_index] : NULL;
   }
 
   // Returns NULL if no string_sample at current time, or if no more samples available
-  DataSample<std::string> *string_sample() {
-    if (!ti.is_null() && string_index < tile.string_samples.size()) {
-      return &tile.string_samples[string_index];
-    }
-    return NULL;
+  const DataSample<std::string> *string_sample() {
+    const Entry *e = entry();
+    return e && e->string_index >= 0 ? &current.string_samples[e->string_index] : NULL;
   }
 
   // Returns DBL_MAX when no more samples available
   double time() {
-    double t = DBL_MAX;
-    if (double_sample()) t = std::min(t, double_sample()->time);
-    if (string_sample()) t = std::min(t, string_sample()->time);
-    return t;
+    const Entry *e = entry();
+    return e ? e->time : DBL_MAX;
   }
 
   // Advance to next available timestamp
   void advance() {
-    if (ti.is_null()) {
-      return;
+    if (entry()) index++;
+  }
+
+private:
+  // Not copyable;  the fetch thread points to the reader
+  ChannelReader(const ChannelReader&);
+  ChannelReader &operator=(const ChannelReader&);
+};
+
+// k-way merge of readers' times, with a heap of each reader's next time, so finding each time costs O(log
+// channels) per channel with a sample there, rather than a scan of every channel
+class ReaderMerge {
+private:
+  typedef std::pair<double, unsigned> HeapEntry;
+  std::vector<simple_shared_ptr<ChannelReader> > &readers;
+  std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > heap;
+  // Readers with samples at the current time
+  std::vector<unsigned> due;
+  std::vector<char> is_due;
+
+  void push(unsigned i) {
+    double time = readers[i]->time();
+    if (time != DBL_MAX) heap.push(HeapEntry(time, i));
+  }
+
+public:
+  ReaderMerge(std::vector<simple_shared_ptr<ChannelReader> > &readers)
+    : readers(readers), is_due(readers.size(), false) {
+    for (unsigned i = 0; i < readers.size(); i++) push(i);
+  }
+
+  // Advance the readers with samples at the current time, and move to the next time any reader has a sample.
+  // Returns false when no more samples available.
+  bool next(double &time) {
+    for (unsigned j = 0; j < due.size(); j++) {
+      is_due[due[j]] = false;
+      readers[due[j]]->advance();
+      push(due[j]);
+    }
+    due.clear();
+    if (heap.empty()) return false;
+    time = heap.top().first;
+    while (!heap.empty() && heap.top().first == time) {
+      due.push_back(heap.top().second);
+      is_due[heap.top().second] = true;
+      heap.pop();
     }
+    return true;
+  }
 
-    double t = time();
-    if (double_sample() && double_sample()->time == t) double_index++;
-    if (string_sample() && string_sample()->time == t) string_index++;
-    if (!double_sample() && !string_sample()) {
-      // Advance to next tile
-      TileIndex root = root_tile();
-      if (root.is_null()) {
-        ti = TileIndex::null();
-      } else {
-        read_tile_or_successor(channel->find_successive_tile(root, ti, desired_level), root);
-      }
+  // True if reader i has a sample at the current time
+  bool has_sample(unsigned i) const { return is_due[i]; }
+};
+
+// Formats zoned timestamps as date::format("%Y-%m-%dT%H:%M:%S%Ez") does.  The timezone's offset is kept for the
+// period it applies to, so its rules are only consulted again at the next transition (e.g. DST), and the text up to
+// the seconds is kept for the current minute.
+class Iso8601Formatter {
+public:
+  Iso8601Formatter() : timezone(NULL), minute(0), has_minute(false) {}
+
+  void append(OutputBuffer &out, double epoch_time, const date::time_zone *tz) {
+    date::sys_seconds second(std::chrono::seconds((long long)floor(epoch_time)));
+    if (tz != timezone || second < zone_info.begin || second >= zone_info.end) {
+      timezone = tz;
+      zone_info = timezone->get_info(second);
+      zone_offset = format_offset(zone_info.offset.count());
+      has_minute = false;
+    }
+
+    // Same arithmetic as date::format on the local time:  whole minutes, then the seconds within them as a double
+    double local = epoch_time + zone_info.offset.count();
+    double whole = floor(local);
+    long long local_seconds = (long long)whole;
+    long long local_minute = floor_div(local_seconds, 60);
+    if (!has_minute || local_minute != minute) {
+      minute = local_minute;
+      minute_prefix = format_minute(local_minute);
+      has_minute = true;
     }
+    double seconds = (local_seconds - local_minute * 60) + (local - whole);
+
+    out.append(minute_prefix);
+    if (seconds < 10) out.append('0');
+    out.append_fixed(seconds, 6);
+    out.append(zone_offset);
   }
 
 private:
-  void read_tile_or_successor(TileIndex tile_index, TileIndex root) {
-    while (1) {
-      Channel::Locker lock(*channel);
-      ti = tile_index;
-      double_index = string_index = 0;
-      if (!ti.is_null()) {
-        if (!channel->read_tile(ti, tile)) {
-          ti = TileIndex::null();
-        } else {
-          if (!double_sample() && !string_sample()) {
-            // Empty tile?  skip to next
-            tile_index = channel->find_successive_tile(root, tile_index, desired_level);
-            continue;
-          }
-        }
-      }
-      return;
+  const date::time_zone *timezone;
+  date::sys_info zone_info;
+  std::string zone_offset;
+  long long minute;
+  bool has_minute;
+  std::string minute_prefix;
+
+  static long long floor_div(long long a, long long b) {
+    return a / b - (a % b < 0 ? 1 : 0);
+  }
+
+  static void append_digits(std::string &str, long long value, int width) {
+    char digits[20];
+    int n = 0;
+    do {
+      digits[n++] = '0' + value % 10;
+      value /= 10;
+    } while (value);
+    for (int i = n; i < width; i++) str += '0';
+    while (n) str += digits[--n];
+  }
+
+  // "YYYY-MM-DDTHH:MM:" for a minute since the epoch, local time
+  static std::string format_minute(long long local_minute) {
+    long long days = floor_div(local_minute, 24 * 60);
+    long long minute_of_day = local_minute - days * 24 * 60;
+
+    // Civil date from days since 1970-01-01 (Howard Hinnant's days_to_civil, as used by the date library)
+    long long z = days + 719468;
+    long long era = floor_div(z, 146097);
+    long long doe = z - era * 146097;
+    long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long long mp = (5 * doy + 2) / 153;
+    long long day = doy - (153 * mp + 2) / 5 + 1;
+    long long month = mp < 10 ? mp + 3 : mp - 9;
+    long long year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+
+    std::string ret;
+    if (year < 0) {
+      ret += '-';
+      year = -year;
     }
+    append_digits(ret, year, 4);
+    ret += '-';
+    append_digits(ret, month, 2);
+    ret += '-';
+    append_digits(ret, day, 2);
+    ret += 'T';
+    append_digits(ret, minute_of_day / 60, 2);
+    ret += ':';
+    append_digits(ret, minute_of_day % 60, 2);
+    ret += ':';
+    return ret;
   }
 
-  TileIndex root_tile() {
-    Channel::Locker lock(*channel);
-    ChannelInfo info;
-    if (!channel->read_info(info)) return TileIndex::null();
-    return info.nonnegative_root_tile_index;
+  // "+HH:MM" for an offset from UTC in seconds
+  static std::string format_offset(long long offset) {
+    std::string ret(offset < 0 ? "-" : "+");
+    if (offset < 0) offset = -offset;
+    append_digits(ret, offset / 3600, 2);
+    ret += ':';
+    append_digits(ret, offset / 60 % 60, 2);
+    return ret;
   }
 };
 
-
-// Write timestamp to stdout
+// Write timestamp to output
 // If timezone is not null, use it
 // Otherwise, output as epoch timestamp in float
 
 void output_timestamp(double epoch_time, const date::time_zone *timezone = NULL) {
   if (timezone) {
-    std::chrono::duration<double> chrono_duration(epoch_time);
-    auto datetime_with_zone = date::make_zoned(timezone, date::sys_time<std::chrono::duration<double>>(chrono_duration));
-    std::cout << date::format("%Y-%m-%dT%H:%M:%S%Ez", datetime_with_zone);
+    static Iso8601Formatter formatter;
+    formatter.append(output, epoch_time, timezone);
   } else {
-    printf("%.*g", double_precision_digits, epoch_time);
+    output.append_double(epoch_time, double_precision_digits);
   }
 }
   
-void export_csv(KVS &store, Range timerange, int uid, const std::vector<std::string> &channel_full_names, const date::time_zone *timezone = NULL) {
+// Write one channel's value as a CSV cell, or nothing if both samples are NULL.  If channel has a double and string
+// sample at same time, just output the double.
+void output_csv_value(const DataSample<double> *double_sample, const DataSample<std::string> *string_sample) {
+  if (double_sample) {
+    output.append_double(double_sample->value, double_precision_digits);
+    if (output_summaries) {
+      output.append(',');
+      output.append_double(double_sample->stddev, double_precision_digits);
+      output.append(',');
+      output.append_fixed(double_sample->weight, 0);
+    }
+  } else {
+    if (string_sample) output.append(quote_csv(string_sample->value).c_str());
+    if (output_summaries) output.append(",,");
+  }
+}
+
+// Write one channel's value as JSON, or null if both samples are NULL
+void output_json_value(const DataSample<double> *double_sample, const DataSample<std::string> *string_sample) {
+  if (double_sample) {
+    if (output_summaries) {
+      output.append('[');
+      output.append_double(double_sample->value, double_precision_digits);
+      output.append(',');
+      output.append_double(double_sample->stddev, double_precision_digits);
+      output.append(',');
+      output.append_fixed(double_sample->weight, 0);
+      output.append(']');
+    } else {
+      output.append_double(double_sample->value, double_precision_digits);
+    }
+  } else if (string_sample) {
+    output.append(quote_json(string_sample->value).c_str());
+  } else {
+    output.append("null");
+  }
+}
+
+simple_shared_ptr<Channel> open_channel(KVS &store, int uid, const std::string &channel_full_name) {
+  if (uid == -1) return simple_shared_ptr<Channel>(new Channel(store, channel_full_name));
+  return simple_shared_ptr<Channel>(new Channel(store, uid, channel_full_name));
+}
+
+void export_csv(KVS &store, Range timerange, int uid, const std::vector<std::string> &channel_full_names,
+                int desired_level, const date::time_zone *timezone = NULL) {
   std::vector<simple_shared_ptr<ChannelReader> > readers;
   
   for (unsigned i = 0; i < channel_full_names.size(); i++) {
-    simple_shared_ptr<Channel> ch;
-    if (uid == -1) {
-      ch.reset(new Channel(store, channel_full_names[i]));
-    } else {
-      ch.reset(new Channel(store, uid, channel_full_names[i]));
-    }
+    simple_shared_ptr<Channel> ch = open_channel(store, uid, channel_full_names[i]);
     readers.push_back(simple_shared_ptr<ChannelReader>
-                          (new ChannelReader(channel_full_names[i], ch, timerange.min)));
+                          (new ChannelReader(ch, timerange, desired_level)));
   }
 
   // Emit header
   if (timezone) {
-    std::cout << quote_csv("Iso8601Time");
+    output.append(quote_csv("Iso8601Time"));
   } else {
-    std::cout << quote_csv("EpochTime");
+    output.append(quote_csv("EpochTime"));
   }
   for (unsigned i = 0; i < readers.size(); i++) {
-    std::cout << ",";
-    std::cout << quote_csv(channel_full_names[i]);
-  }
-  std::cout << "\n";
-
-  while (1) {
-    // Find next time -- min of all channels' next values
-    double time = DBL_MAX;
-    for (unsigned i = 0; i < readers.size(); i++) {
-      time = std::min(time, readers[i]->time());
+    output.append(',');
+    output.append(quote_csv(channel_full_names[i]));
+    if (output_summaries) {
+      output.append(',');
+      output.append(quote_csv(channel_full_names[i] + ":stddev"));
+      output.append(',');
+      output.append(quote_csv(channel_full_names[i] + ":count"));
     }
+  }
+  output.append('\n');
 
+  ReaderMerge merge(readers);
+  double time;
+  while (merge.next(time)) {
     // If no more samples in range, we're done
-    if (time > timerange.max || time == DBL_MAX) break;
+    if (time > timerange.max) break;
 
     // Emit any samples that match this time.  Emit empty entries
     // for channels that don't have a for this time
@@ -300,96 +653,231 @@ void export_csv(KVS &store, Range timerange, int uid, const std::vector<std::str
     output_timestamp(time, timezone);
  
     for (unsigned i = 0; i < readers.size(); i++) {
-      std::cout << ",";
-      if (readers[i]->time() == time) {
-        // If channel has a double and string sample at same time, just output the double
-        if (readers[i]->double_sample()) {
-          printf("%.*g", double_precision_digits, readers[i]->double_sample()->value);
-        } else if (readers[i]->string_sample()) {
-          std::cout << quote_csv(readers[i]->string_sample()->value).c_str();
-        } else {
-          abort();
-        }
-        readers[i]->advance();
+      output.append(',');
+      if (merge.has_sample(i)) {
+        output_csv_value(readers[i]->double_sample(), readers[i]->string_sample());
       } else {
         // No sample at this time;  empty column
+        if (output_summaries) output.append(",,");
       }
     }
-    std::cout << "\n";
+    output.append('\n');
   }
 }
 
-void export_json(KVS &store, Range timerange, int uid, const std::vector<std::string> &channel_full_names, const date::time_zone *timezone = NULL) {
+void export_json(KVS &store, Range timerange, int uid, const std::vector<std::string> &channel_full_names,
+                 int desired_level, const date::time_zone *timezone = NULL) {
   std::vector<simple_shared_ptr<ChannelReader> > readers;
 
   for (unsigned i = 0; i < channel_full_names.size(); i++) {
-    simple_shared_ptr<Channel> ch;
-    if (uid == -1) {
-      ch.reset(new Channel(store, channel_full_names[i]));
-    } else {
-      ch.reset(new Channel(store, uid, channel_full_names[i]));
-    }
+    simple_shared_ptr<Channel> ch = open_channel(store, uid, channel_full_names[i]);
     readers.push_back(simple_shared_ptr<ChannelReader>
-                        (new ChannelReader(channel_full_names[i], ch, timerange.min)));
+                        (new ChannelReader(ch, timerange, desired_level)));
   }
 
   // Emit header
-  std::cout << "{\"channel_names\":[";
+  output.append("{\"channel_names\":[");
   for (unsigned i = 0; i < readers.size(); i++) {
-    std::cout << quote_json(channel_full_names[i]);
+    output.append(quote_json(channel_full_names[i]));
     if (i < readers.size() - 1) {
-      std::cout << ",";
+      output.append(',');
     }
   }
-  std::cout << "],";
+  output.append("],");
+  if (output_summaries) output.append("\"fields\":[\"mean\",\"stddev\",\"count\"],");
 
   // emit the data
-  std::cout << "\"data\":[";
+  output.append("\"data\":[");
 
   bool hasPrintedAtLeastOneLine = false;
-  while (1) {
-    // Find next time -- min of all channels' next values
-    double time = DBL_MAX;
-    for (unsigned i = 0; i < readers.size(); i++) {
-      time = std::min(time, readers[i]->time());
-    }
-
+  ReaderMerge merge(readers);
+  double time;
+  while (merge.next(time)) {
     // If no more samples in range, we're done
-    if (time > timerange.max || time == DBL_MAX) break;
+    if (time > timerange.max) break;
 
     // Emit any samples that match this time.  Emit empty entries
     // for channels that don't have a for this time
 
     if (hasPrintedAtLeastOneLine) {
-      std::cout << ",";
+      output.append(',');
     }
-    printf("\n[");
-    if (timezone) printf("\"");
+    output.append("\n[");
+    if (timezone) output.append('"');
     output_timestamp(time, timezone);
-    if (timezone) printf("\"");
+    if (timezone) output.append('"');
     for (unsigned i = 0; i < readers.size(); i++) {
-      std::cout << ",";
-      if (readers[i]->time() == time) {
-        // If channel has a double and string sample at same time, just output the double
-        if (readers[i]->double_sample()) {
-          printf("%.*g", double_precision_digits, readers[i]->double_sample()->value);
-        } else if (readers[i]->string_sample()) {
-          std::cout << quote_json(readers[i]->string_sample()->value).c_str();
-        } else {
-          abort();
-        }
-        readers[i]->advance();
+      output.append(',');
+      if (merge.has_sample(i)) {
+        output_json_value(readers[i]->double_sample(), readers[i]->string_sample());
       } else {
         // No sample at this time;  empty column
-        std::cout << "null";
+        output.append("null");
       }
     }
-    std::cout << "]";
+    output.append(']');
     hasPrintedAtLeastOneLine = true;
   }
 
   // close it off
-  std::cout << "\n]}\n";
+  output.append("\n]}\n");
+}
+
+// A channel's most recent sample at or before a moving time, for as-of joins.  Times passed to move_to must not
+// decrease.  Short moves step through the samples in between;  long ones seek instead of reading every tile.
+// When summaries are output in bins (see BinnedSamples), a summary counts as at its bin's center, so a reference
+// row takes the most recent summary in its own bin or an earlier one.
+class AsofReader {
+private:
+  simple_shared_ptr<Channel> channel;
+  int desired_level;
+  double bin_width;
+  // Next sample after the current time
+  ChannelSampleRange ahead;
+  // Most recent sample at or before the current time;  either or both may be missing
+  bool has_double, has_string;
+  DataSample<double> last_double;
+  DataSample<std::string> last_string;
+  bool started;
+
+  // Steps to take through samples before seeking instead
+  static const int MAX_STEPS = 1024;
+
+  void remember(const DataSample<double> *double_sample, const DataSample<std::string> *string_sample) {
+    has_double = double_sample != NULL;
+    has_string = string_sample != NULL;
+    if (double_sample) last_double = *double_sample;
+    if (string_sample) last_string = *string_sample;
+  }
+
+  void jump(double t) {
+    ChannelSampleRange before(*channel, Range(-DBL_MAX, t), desired_level, ChannelSampleRange::REVERSE);
+    remember(before.double_sample(), before.string_sample());
+    ahead.seek(t);
+    if (ahead.time() <= t) ahead.advance();
+  }
+
+public:
+  AsofReader(simple_shared_ptr<Channel> channel, int desired_level = TileIndex::lowest_level())
+    : channel(channel), desired_level(desired_level), bin_width(summary_bin_width(desired_level)),
+      ahead(*channel, Range::all(), desired_level), has_double(false), has_string(false), started(false) {}
+
+  void move_to(double t) {
+    // Include the rest of t's bin
+    if (bin_width) t = nextafter((floor(t / bin_width) + 1) * bin_width, -DBL_MAX);
+    // The first time may be far into the channel
+    if (!started) {
+      started = true;
+      jump(t);
+      return;
+    }
+    for (int steps = 0; ahead.time() <= t; steps++) {
+      if (steps == MAX_STEPS) {
+        jump(t);
+        return;
+      }
+      remember(ahead.double_sample(), ahead.string_sample());
+      ahead.advance();
+    }
+  }
+
+  // Returns NULL if the most recent sample has no double
+  const DataSample<double> *double_sample() const {
+    return has_double ? &last_double : NULL;
+  }
+
+  // Returns NULL if the most recent sample has no string
+  const DataSample<std::string> *string_sample() const {
+    return has_string ? &last_string : NULL;
+  }
+};
+
+// One row per sample of the reference channel in timerange, with the most recent sample at or before that time
+// from each of the other channels.  Channels are scanned together, without reading either into memory.
+void export_asof(KVS &store, Range timerange, int uid, const std::string &reference_full_name,
+                 const std::vector<std::string> &channel_full_names, int desired_level, bool json,
+                 const date::time_zone *timezone = NULL) {
+  std::vector<std::string> names(1, reference_full_name);
+  std::vector<simple_shared_ptr<AsofReader> > readers;
+  for (unsigned i = 0; i < channel_full_names.size(); i++) {
+    if (channel_full_names[i] == reference_full_name) continue;
+    names.push_back(channel_full_names[i]);
+    readers.push_back(simple_shared_ptr<AsofReader>
+                        (new AsofReader(open_channel(store, uid, channel_full_names[i]), desired_level)));
+  }
+  ChannelReader reference(open_channel(store, uid, reference_full_name), timerange, desired_level);
+
+  // Emit header
+  if (json) {
+    output.append("{\"channel_names\":[");
+    for (unsigned i = 0; i < names.size(); i++) {
+      if (i) output.append(',');
+      output.append(quote_json(names[i]));
+    }
+    output.append("],");
+    if (output_summaries) output.append("\"fields\":[\"mean\",\"stddev\",\"count\"],");
+    output.append("\"data\":[");
+  } else {
+    output.append(quote_csv(timezone ? "Iso8601Time" : "EpochTime"));
+    for (unsigned i = 0; i < names.size(); i++) {
+      output.append(',');
+      output.append(quote_csv(names[i]));
+      if (output_summaries) {
+        output.append(',');
+        output.append(quote_csv(names[i] + ":stddev"));
+        output.append(',');
+        output.append(quote_csv(names[i] + ":count"));
+      }
+    }
+    output.append('\n');
+  }
+
+  bool first_row = true;
+  for (; reference.time() <= timerange.max && reference.time() != DBL_MAX; reference.advance()) {
+    double time = reference.time();
+    if (json) {
+      if (!first_row) output.append(',');
+      output.append("\n[");
+      if (timezone) output.append('"');
+      output_timestamp(time, timezone);
+      if (timezone) output.append('"');
+      output.append(',');
+      output_json_value(reference.double_sample(), reference.string_sample());
+    } else {
+      output_timestamp(time, timezone);
+      output.append(',');
+      output_csv_value(reference.double_sample(), reference.string_sample());
+    }
+    for (unsigned i = 0; i < readers.size(); i++) {
+      readers[i]->move_to(time);
+      output.append(',');
+      if (json) {
+        output_json_value(readers[i]->double_sample(), readers[i]->string_sample());
+      } else {
+        output_csv_value(readers[i]->double_sample(), readers[i]->string_sample());
+      }
+    }
+    output.append(json ? ']' : '\n');
+    first_row = false;
+  }
+
+  if (json) output.append("\n]}\n");
+}
+
+// Level whose summaries have about max_points samples in the part of timerange the channels cover
+int level_for_max_points(KVS &store, Range timerange, int uid, const std::vector<std::string> &channel_full_names,
+                         int max_points) {
+  Range times;
+  for (unsigned i = 0; i < channel_full_names.size(); i++) {
+    simple_shared_ptr<Channel> ch = open_channel(store, uid, channel_full_names[i]);
+    Channel::Locker locker(*ch);
+    ChannelInfo info;
+    if (ch->read_info(info)) times.add(info.times);
+  }
+  times.min = std::max(times.min, timerange.min);
+  times.max = std::min(times.max, timerange.max);
+  if (!(times.max > times.min)) return TileIndex::lowest_level();
+  return (int)ceil(Channel::level_from_rate(max_points / (times.max - times.min)));
 }
 
 int execute(Arglist args) {
@@ -405,6 +893,9 @@ int execute(Arglist args) {
   int uid = -1;
   std::vector<std::string> channel_full_names;
   const date::time_zone *timezone = NULL;
+  double resolution = 0;
+  int max_points = 0;
+  std::string asof_channel_name;
 
   while (!args.empty()) {
     std::string arg = args.shift();
@@ -418,6 +909,14 @@ int execute(Arglist args) {
       timerange.max = args.shift_double();
     } else if (arg == "--full-precision") {
       double_precision_digits = 16;
+    } else if (arg == "--resolution") {
+      resolution = args.shift_double();
+      if (!(resolution > 0)) usage("--resolution must be positive");
+    } else if (arg == "--max-points") {
+      max_points = args.shift_int();
+      if (max_points <= 0) usage("--max-points must be positive");
+    } else if (arg == "--asof") {
+      asof_channel_name = args.shift();
     } else if (arg == "--timezone") {
       timezone = date::locate_zone(args.shift());
     } else if (Arglist::is_flag(arg)) {
@@ -438,6 +937,7 @@ int execute(Arglist args) {
 
   if (storename == "") usage("Missing store");
   if (channel_full_names.size() == 0) usage("No channels specified");
+  if (asof_channel_name != "" && format == LEGACY_FORMAT) usage("--asof requires --csv or --json");
 
   set_log_prefix(string_printf("%d %d ", getpid(), uid));
 
@@ -446,19 +946,36 @@ int execute(Arglist args) {
   FilesystemKVS store(storename.c_str());
   //store.set_verbosity(100);
 
+  // A tile at level L holds up to BT_CHANNEL_DOUBLE_SAMPLES samples, so its summaries are 2^(L-15) seconds apart
+  int desired_level = TileIndex::lowest_level();
+  if (resolution > 0) {
+    desired_level = (int)floor(Channel::level_from_rate(1 / resolution));
+  } else if (max_points > 0) {
+    desired_level = level_for_max_points(store, timerange, uid, channel_full_names, max_points);
+  }
+  output_summaries = resolution > 0 || max_points > 0;
+
+  if (asof_channel_name != "") {
+    export_asof(store, timerange, uid, asof_channel_name, channel_full_names, desired_level,
+                format == JSON_FORMAT, timezone);
+    output.flush();
+    return 0;
+  }
+
   switch (format) {
     case LEGACY_FORMAT:
-      export_legacy(store, timerange, uid, channel_full_names);
+      export_legacy(store, timerange, uid, channel_full_names, desired_level);
       break;
     case CSV_FORMAT:
-      export_csv(store, timerange, uid, channel_full_names, timezone);
+      export_csv(store, timerange, uid, channel_full_names, desired_level, timezone);
       break;
     case JSON_FORMAT:
-      export_json(store, timerange, uid, channel_full_names, timezone);
+      export_json(store, timerange, uid, channel_full_names, desired_level, timezone);
       break;
     default:
       assert(0);
   }
+  output.flush();
   return 0;
 }
 
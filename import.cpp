@@ -15,11 +15,13 @@
 #include "Arglist.h"
 #include "Binrec.h"
 #include "Channel.h"
+#include "ChannelWriter.h"
 #include "DataSample.h"
 #include "FilesystemKVS.h"
 #include "ImportBT.h"
 #include "ImportJson.h"
 #include "Log.h"
+#include "simple_shared_ptr.h"
 #include "utils.h"
 
 void usage(const char *fmt, ...)
@@ -30,11 +32,74 @@ void usage(const char *fmt, ...)
   va_end(args);
   std::cerr << msg << "\n";
   std::cerr << "Usage:\n";
-  std::cerr << "import store.kvs uid device-nickname [--format format] file1.bt ... fileN.bt\n";
+  std::cerr << "import store.kvs uid device-nickname [--format format] [--duplicates policy] file1.bt ... fileN.bt\n";
   std::cerr << "allows formats: bt json\n";
+  std::cerr << "allows duplicate policies: overwrite keep-first mean sum max\n";
+  std::cerr << "   --duplicates sets how each imported channel combines samples at the same time;\n";
+  std::cerr << "   otherwise channels keep their current policy (overwrite for new channels)\n";
   throw std::runtime_error("Bad arguments: " + msg);
 }
 
+/// Streams samples parsed from a .bt or JSON file into the store as they're parsed, through one ChannelWriter per
+/// channel
+class ImportReceiver : public BtParserReceiver, public JsonParserReceiver {
+public:
+  ImportReceiver(KVS &store, int uid, const std::string &dev_nickname, const DuplicatePolicy *duplicate_policy)
+    : m_store(store), m_uid(uid), m_dev_nickname(dev_nickname), m_duplicate_policy(duplicate_policy) {}
+
+  virtual void receive_data_samples(const std::string &channel_name,
+                                    const std::vector<DataSample<double> > &samples) {
+    writer(channel_name).add_data(samples);
+
+    DataRanges &ir = import_ranges[channel_name];
+    for (unsigned i = 0; i < samples.size(); i++) {
+      ir.times.add(samples[i].time);
+      ir.double_samples.add(samples[i].value);
+    }
+  }
+
+  virtual void receive_string_samples(const std::string &channel_name,
+                                      const std::vector<DataSample<std::string> > &samples) {
+    writer(channel_name).add_data(samples);
+
+    DataRanges &ir = import_ranges[channel_name];
+    for (unsigned i = 0; i < samples.size(); i++) ir.times.add(samples[i].time);
+  }
+
+  /// Finish writing all channels
+  /// \param channel_ranges Returns ranges of each channel written
+  void commit(std::map<std::string, DataRanges> &channel_ranges) {
+    for (std::map<std::string, simple_shared_ptr<ChannelWriter> >::iterator i = m_writers.begin();
+         i != m_writers.end(); ++i) {
+      DataRanges cr;
+      i->second->commit(&cr);
+      if (!cr.times.empty()) channel_ranges[i->first].add(cr);
+      log_f("import: %s samples %s", i->first.c_str(), import_ranges[i->first].times.to_string("%.6f").c_str());
+    }
+  }
+
+  std::map<std::string, DataRanges> import_ranges;
+
+private:
+  KVS &m_store;
+  int m_uid;
+  std::string m_dev_nickname;
+  const DuplicatePolicy *m_duplicate_policy;
+  // Writers are destroyed before the channels they refer to
+  std::map<std::string, simple_shared_ptr<Channel> > m_channels;
+  std::map<std::string, simple_shared_ptr<ChannelWriter> > m_writers;
+
+  ChannelWriter &writer(const std::string &channel_name) {
+    simple_shared_ptr<ChannelWriter> &writer = m_writers[channel_name];
+    if (!writer.get()) {
+      m_channels[channel_name].reset(new Channel(m_store, m_uid, m_dev_nickname + "." + channel_name));
+      writer.reset(new ChannelWriter(*m_channels[channel_name]));
+      if (m_duplicate_policy) writer->set_duplicate_policy(*m_duplicate_policy);
+    }
+    return *writer;
+  }
+};
+
 void emit_json(Json::Value &json) {
   std::string response = rtrim(Json::FastWriter().write(json));
   printf("%s\n", response.c_str());
@@ -46,6 +111,8 @@ int execute(Arglist args) {
   std::string invocation = args.to_string();
 
   std::string format = "";
+  bool set_duplicate_policy = false;
+  DuplicatePolicy duplicate_policy = DUPLICATES_OVERWRITE;
   verbose = true;
 
   std::string storename = "";
@@ -57,6 +124,12 @@ int execute(Arglist args) {
     std::string arg = args.shift();
     if (arg == "--format") {
       format = args.shift();
+    } else if (arg == "--duplicates") {
+      std::string policy_name = args.shift();
+      if (!parse_duplicate_policy(policy_name, duplicate_policy)) {
+        usage("Unrecognized duplicate policy '%s'", policy_name.c_str());
+      }
+      set_duplicate_policy = true;
     } else if (arg =="--verbose") {
       verbose = true;
     } else if (Arglist::is_flag(arg)) {
@@ -93,9 +166,10 @@ int execute(Arglist args) {
     }
     
     ParseInfo info;
-    std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > > numeric_data;
-    std::map<std::string, simple_shared_ptr<std::vector<DataSample<std::string> > > > string_data;
     std::vector<ParseError> errors;
+    std::map<std::string, DataRanges> import_ranges;
+    std::map<std::string, DataRanges> channel_ranges;
+    Range import_time_range;
 
     std::string this_format;
     if (format != "") {
@@ -103,20 +177,24 @@ int execute(Arglist args) {
     } else {
       this_format = filename_suffix(filename);
     }
+    // Stream samples into the store as they're parsed, rather than reading the whole file into memory
+    ImportReceiver receiver(store, uid, dev_nickname, set_duplicate_policy ? &duplicate_policy : NULL);
     if (!strcasecmp(this_format.c_str(), "bt") || !strcasecmp(this_format.c_str(), "binary")) {
-      parse_bt_file(filename, numeric_data, errors, info);
+      parse_bt_file(filename, receiver, errors, info);
     } else if (!strcasecmp(this_format.c_str(), "json")) {
-      parse_json_file(filename, numeric_data, string_data, errors, info);
+      parse_json_file(filename, receiver, errors, info);
     } else {
       throw std::runtime_error(string_printf("Unrecognized format or filename suffix '%s'", this_format.c_str()));
     }
+    receiver.commit(channel_ranges);
+    import_ranges = receiver.import_ranges;
 
     if (errors.size()) {
       log_f("import: Parse errors:");
       for (unsigned i = 0; i < errors.size(); i++) {
         log_f("import:    %s", errors[i].what());
       }
-      if (!numeric_data.size() && !string_data.size()) {
+      if (!import_ranges.size()) {
         log_f("import: No data returned");
       } else if (!write_partial_on_errors) {
         log_f("import: Partial data returned, but not adding to store");
@@ -125,65 +203,6 @@ int execute(Arglist args) {
       }
     }
 
-    std::map<std::string, DataRanges> import_ranges;
-    std::map<std::string, DataRanges> channel_ranges;
-    Range import_time_range;
-    
-    for (std::map<std::string, simple_shared_ptr<std::vector<DataSample<double> > > >::iterator i =
-           numeric_data.begin(); i != numeric_data.end(); ++i) {
-      
-      std::string channel_name = i->first;
-      simple_shared_ptr<std::vector<DataSample<double> > > samples = i->second;
-      std::sort(samples->begin(), samples->end(), DataSample<double>::time_lessthan);
-      
-      log_f("import: %.6f: %s %zd numeric samples", (*samples)[0].time, channel_name.c_str(), samples->size());
-      
-      Channel ch(store, uid, dev_nickname + "." + channel_name);
-
-      {
-        DataRanges cr;
-        ch.add_data(*samples, &cr);
-        if (!cr.times.empty()) channel_ranges[channel_name].add(cr);
-      }
-
-      {
-        DataRanges ir;
-        for (unsigned i = 0; i < samples->size(); i++) {
-          DataSample<double> &sample = (*samples)[i];
-          ir.times.add(sample.time);
-          ir.double_samples.add(sample.value);
-        }
-        import_ranges[channel_name].add(ir);
-      }
-    }  
-    
-    for (std::map<std::string, simple_shared_ptr<std::vector<DataSample<std::string> > > >::iterator i =
-           string_data.begin(); i != string_data.end(); ++i) {
-      
-      std::string channel_name = i->first;
-      simple_shared_ptr<std::vector<DataSample<std::string> > > samples = i->second;
-      std::sort(samples->begin(), samples->end(), DataSample<std::string>::time_lessthan);
-      
-      log_f("%.6f: %s %zd textual samples", (*samples)[0].time, channel_name.c_str(), samples->size());
-      
-      Channel ch(store, uid, dev_nickname + "." + channel_name);
-
-      {
-        DataRanges cr;
-        ch.add_data(*samples, &cr);
-        if (!cr.times.empty()) channel_ranges[channel_name].add(cr);
-      }
-
-      {
-        DataRanges ir;
-        for (unsigned i = 0; i < samples->size(); i++) {
-          DataSample<std::string> &sample = (*samples)[i];
-          ir.times.add(sample.time);
-        }
-        import_ranges[channel_name].add(ir);
-      }
-    }
-
     for (std::map<std::string, DataRanges>::iterator i = import_ranges.begin(); i != import_ranges.end(); ++i) {
       info.channel_specs[i->first]["imported_bounds"] = i->second.to_json();
       import_time_range.add(i->second.times);
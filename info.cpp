@@ -1,4 +1,5 @@
 // C++
+#include <algorithm>
 #include <iostream>
 #include <set>
 #include <string>
@@ -14,6 +15,7 @@
 // Local
 #include "Binrec.h"
 #include "Channel.h"
+#include "ChannelSampleRange.h"
 #include "FilesystemKVS.h"
 #include "ImportBT.h"
 #include "Log.h"
@@ -103,27 +105,23 @@ double parse_time(const char *str)
   return t;
 }
 
-Range *gcic_found_times, *gcic_found_values;
-long long gcic_nsamples;
-
-
-bool get_channel_info_callback(const Tile &tile, Range requested_times)
-{
-  for (unsigned i = 0; i < tile.double_samples.size(); i++) {
-    if (requested_times.includes(tile.double_samples[i].time)) {
-      gcic_found_times->add(tile.double_samples[i].time);
-      gcic_found_values->add(tile.double_samples[i].value);
-      gcic_nsamples++;
+/// Accumulates the times and values of the samples it's applied to
+struct SampleBounds {
+  Range times, values;
+  long long nsamples;
+  SampleBounds() : nsamples(0) {}
+  void operator()(const ChannelSampleRange::Position &position) {
+    if (position.double_sample) {
+      times.add(position.time);
+      values.add(position.double_sample->value);
+      nsamples++;
     }
-  }
-  for (unsigned i = 0; i < tile.string_samples.size(); i++) {
-    if (requested_times.includes(tile.string_samples[i].time)) {
-      gcic_found_times->add(tile.string_samples[i].time);
-      gcic_nsamples++;
+    if (position.string_sample) {
+      times.add(position.time);
+      nsamples++;
     }
   }
-  return true;
-}
+};
 
 /**
  * Gets the info for the given channel.  If will_find_most_recent_data_sample is true and the times Range is
@@ -144,57 +142,73 @@ void get_channel_info(KVS &store,
                       bool will_find_most_recent_data_sample) {
 
   Channel ch(store, uid, channel_name);
-  Channel::Locker locker(ch);
 
   if (times == Range::all()) {
-    ChannelInfo info;
-    if (!ch.read_info(info)) {
-      log_f("Channel %s: no info", channel_name.c_str());
-      return;
-    }
-    Tile root;
-    if (!ch.read_tile(info.nonnegative_root_tile_index, root)) {
-      log_f("Channel %s: cannot read root tile", channel_name.c_str());
-      return;
+    bool has_samples;
+    {
+      Channel::Locker locker(ch);
+      ChannelInfo info;
+      if (!ch.read_info(info)) {
+        log_f("Channel %s: no info", channel_name.c_str());
+        return;
+      }
+      Tile root;
+      if (!ch.read_tile(info.nonnegative_root_tile_index, root)) {
+        log_f("Channel %s: cannot read root tile", channel_name.c_str());
+        return;
+      }
+      found_times = root.ranges.times;
+      found_values = root.ranges.double_samples;
+      has_samples = !root.double_samples.empty() || !root.string_samples.empty();
+
+      // Include samples before time zero, which are stored under a separate root
+      Tile negative_root;
+      if (!info.negative_root_tile_index.is_null() && ch.read_tile(info.negative_root_tile_index, negative_root)) {
+        found_times.add(negative_root.ranges.times);
+        found_values.add(negative_root.ranges.double_samples);
+        has_samples = has_samples || !negative_root.double_samples.empty() || !negative_root.string_samples.empty();
+      }
     }
-    found_times = root.ranges.times;
-    found_values = root.ranges.double_samples;
 
-    // Try to find the value at the max time. Do so by using find_child_overlapping_time() to drill down through the
-    // tile tree to find the appropriate tile.  Then try to read read the tile and, if successful, then pick out the
-    // last value found, if any (note that it might be a string or a double, or both!)
+    // Find the latest double and string samples, scanning back from the end of the channel past any tiles without
+    // samples of that type
     found_most_recent_data_sample = false;
     found_most_recent_string_sample = false;
-    if (will_find_most_recent_data_sample && !found_times.empty() && (!root.double_samples.empty() || !root.string_samples.empty())) {
-      TileIndex ti = ch.find_child_overlapping_time(info.nonnegative_root_tile_index,
-                                                    found_times.max,
-                                                    TileIndex::lowest_level());
-      Tile tile;
-      if (ch.read_tile(ti, tile)) {
-        if (tile.double_samples.size()) {
-          found_most_recent_data_sample = true;
-          most_recent_data_sample.time = tile.double_samples.back().time;
-          most_recent_data_sample.value = tile.double_samples.back().value;
-          most_recent_data_sample.weight = tile.double_samples.back().weight;
-          most_recent_data_sample.stddev = tile.double_samples.back().stddev;
-        }
-        if (tile.string_samples.size()) {
-          found_most_recent_string_sample = true;
-          most_recent_string_sample.time = tile.string_samples.back().time;
-          most_recent_string_sample.value = tile.string_samples.back().value.c_str();
-        }
+    if (will_find_most_recent_data_sample && !found_times.empty() && has_samples) {
+      std::vector<DataSample<double> > latest_doubles;
+      ch.latest(1, latest_doubles);
+      if (latest_doubles.size()) {
+        found_most_recent_data_sample = true;
+        most_recent_data_sample = latest_doubles.back();
+      }
+      std::vector<DataSample<std::string> > latest_strings;
+      ch.latest(1, latest_strings);
+      if (latest_strings.size()) {
+        found_most_recent_string_sample = true;
+        most_recent_string_sample = latest_strings.back();
       }
     }
 
   } else {
-    gcic_found_times = &found_times;
-    gcic_found_values = &found_values;
-    gcic_nsamples = 0;
-    // Look for ~1K samples
+    // Look for ~1K samples, but read roots as stored rather than summarizing them further, which would narrow the
+    // bounds found
     int desired_level = ch.level_from_rate(1000 / (times.max - times.min));
-    ch.read_tiles_in_range(times, get_channel_info_callback, desired_level);
-    //ch.read_bottommost_tiles_in_range(times, get_channel_info_callback);
-    log_f("Channel %s: read %lld samples", channel_name.c_str(), gcic_nsamples);
+    ChannelInfo info;
+    {
+      Channel::Locker locker(ch);
+      if (ch.read_info(info)) {
+        int root_level = info.nonnegative_root_tile_index.level;
+        if (!info.negative_root_tile_index.is_null()) {
+          root_level = std::max(root_level, info.negative_root_tile_index.level);
+        }
+        desired_level = std::min(desired_level, root_level);
+      }
+    }
+    ChannelSampleRange samples(ch, times, desired_level);
+    SampleBounds bounds = std::for_each(samples.begin(), samples.end(), SampleBounds());
+    found_times.add(bounds.times);
+    found_values.add(bounds.values);
+    log_f("Channel %s: read %lld samples", channel_name.c_str(), bounds.nsamples);
   }
 }
 
@@ -472,7 +486,7 @@ int main(int argc, char **argv)
 //    printf("{}");
 //  }
   log_f("info: finished in %lld msec.  read %d tiles",
-	millitime() - begin_perf_time, Channel::total_tiles_read);
+	millitime() - begin_perf_time, Channel::total_tiles_read.load());
 
   return 0;
 }
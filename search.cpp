@@ -0,0 +1,139 @@
+// C++
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+// C
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Local
+#include "Arglist.h"
+#include "Channel.h"
+#include "FilesystemKVS.h"
+#include "Log.h"
+#include "simple_shared_ptr.h"
+#include "TokenFilter.h"
+#include "utils.h"
+
+void usage(const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  std::string msg = string_vprintf(fmt, args);
+  va_end(args);
+  std::cerr << msg << "\n";
+  std::cerr << "Usage:\n";
+  std::cerr << "search [flags] store.kvs uid dev_nickname.ch_name [dev_nickname.ch_name ...]\n";
+  std::cerr << "search [flags] store.kvs uid.dev_nickname.ch_name [uid.dev_nickname.ch_name ...]\n";
+  std::cerr << "   Prints the samples matching all of the given conditions, for each channel.\n";
+  std::cerr << "   Only the tiles that might hold a match are read.\n";
+  std::cerr << "   --above X:   value greater than X\n";
+  std::cerr << "   --below X:   value less than X\n";
+  std::cerr << "   --text T:    string value containing every word of T, ignoring case\n";
+  std::cerr << "   --start t:   time at or after t (floating-point epoch time)\n";
+  std::cerr << "   --end t:     time at or before t (floating-point epoch time)\n";
+  std::cerr << "   Either --text, or at least one of --above and --below, is required.\n";
+  throw std::runtime_error("Bad arguments: " + msg);
+}
+
+int execute(Arglist args) {
+  long long begin_time = millitime();
+  std::string invocation = args.to_string();
+
+  std::string storename;
+  int uid = -1;
+  std::vector<std::string> channel_full_names;
+  Range times = Range::all();
+  Range values = Range::all();
+  bool has_value_condition = false;
+  std::string text;
+
+  while (!args.empty()) {
+    std::string arg = args.shift();
+    if (arg == "--start") {
+      times.min = args.shift_double();
+    } else if (arg == "--end") {
+      times.max = args.shift_double();
+    } else if (arg == "--above") {
+      // Ranges are inclusive;  the next double up excludes X itself
+      values.min = nextafter(args.shift_double(), std::numeric_limits<double>::max());
+      has_value_condition = true;
+    } else if (arg == "--below") {
+      values.max = nextafter(args.shift_double(), -std::numeric_limits<double>::max());
+      has_value_condition = true;
+    } else if (arg == "--text") {
+      text = args.shift();
+    } else if (Arglist::is_flag(arg)) {
+      usage("Unknown flag '%s'", arg.c_str());
+    } else if (storename == "") {
+      storename = arg;
+    } else if (uid == -1 && !channel_full_names.size()) {
+      // This might be UID or a fully-specified channel name of the form UID.dev.ch
+      if (strchr(arg.c_str(), '.')) {
+        channel_full_names.push_back(arg);
+      } else {
+        uid = Arglist::parse_int(arg);
+      }
+    } else {
+      channel_full_names.push_back(arg);
+    }
+  }
+
+  if (storename == "") usage("Missing store");
+  if (channel_full_names.size() == 0) usage("No channels specified");
+  if (text == "" && !has_value_condition) usage("Specify --text, or --above, --below, or both");
+  if (text != "" && has_value_condition) usage("--text can't be combined with --above or --below");
+  std::vector<std::string> tokens;
+  TokenFilter::tokenize(text, tokens);
+  if (text != "" && tokens.empty()) usage("--text must contain a letter or digit");
+
+  set_log_prefix(string_printf("%d %d ", getpid(), uid));
+  log_f("search START: %s", invocation.c_str());
+
+  FilesystemKVS store(storename.c_str());
+
+  for (unsigned i = 0; i < channel_full_names.size(); i++) {
+    simple_shared_ptr<Channel> ch;
+    if (uid == -1) {
+      ch.reset(new Channel(store, channel_full_names[i]));
+    } else {
+      ch.reset(new Channel(store, uid, channel_full_names[i]));
+    }
+    if (i) printf("\f");
+    printf("Time\t%s\n", channel_full_names[i].c_str());
+    if (text != "") {
+      std::vector<DataSample<std::string> > matches;
+      ch->search(times, text, matches);
+      log_f("search: %s: %zd matches", ch->descriptor().c_str(), matches.size());
+      for (unsigned j = 0; j < matches.size(); j++) {
+        printf("%.15g\t%s\n", matches[j].time, matches[j].value.c_str());
+      }
+    } else {
+      std::vector<DataSample<double> > matches;
+      ch->search(times, values, matches);
+      log_f("search: %s: %zd matches", ch->descriptor().c_str(), matches.size());
+      for (unsigned j = 0; j < matches.size(); j++) {
+        printf("%.15g\t%.15g\n", matches[j].time, matches[j].value);
+      }
+    }
+  }
+
+  log_f("search: finished in %lld msec, %d tiles read", millitime() - begin_time, Channel::total_tiles_read.load());
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int exit_code = 1;
+  try {
+    exit_code = execute(Arglist(argv + 1, argv + argc));
+  } catch (const std::exception &e) {
+    log_f("search: caught exception '%s'", e.what());
+  }
+  return exit_code;
+}
@@ -0,0 +1,78 @@
+// Microbenchmark for bin_samples:  times the original per-sample binning loop against each kernel, binning a
+// dense tile into 512 bins as gettile does, and into 32768 bins as combine_samples does.
+//
+// Run with "make bench-binning"
+
+// C++
+#include <vector>
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// Local
+#include "utils.h"
+
+#include "Binning.h"
+
+static const int REPEATS = 50;
+
+/// Per-sample binning, as combine_samples and gettile did before bin_samples
+void reference_bin_samples(TileIndex tile, const std::vector<DataSample<double> > &samples,
+                           std::vector<DataAccumulator<double> > &bins) {
+  for (unsigned i = 0; i < samples.size(); i++) {
+    bins[(unsigned) floor(tile.position(samples[i].time) * bins.size())] += samples[i];
+  }
+}
+
+double checksum(const std::vector<DataAccumulator<double> > &bins) {
+  double ret = 0;
+  for (unsigned i = 0; i < bins.size(); i++) ret += bins[i].sum + bins[i].weight;
+  return ret;
+}
+
+void bench(TileIndex tile, const std::vector<DataSample<double> > &samples, unsigned n_bins) {
+  double reference_secs = 0, reference_checksum = 0;
+  {
+    double begin = doubletime();
+    for (int r = 0; r < REPEATS; r++) {
+      std::vector<DataAccumulator<double> > bins(n_bins);
+      reference_bin_samples(tile, samples, bins);
+      reference_checksum += checksum(bins);
+    }
+    reference_secs = doubletime() - begin;
+  }
+  double msamples = (double) samples.size() * REPEATS / 1e6;
+  fprintf(stderr, "%6u bins  %-10s %8.1f Msamples/s\n", n_bins, "reference", msamples / reference_secs);
+
+  BinningKernel kernels[] = { BINNING_SCALAR, BINNING_SSE2, BINNING_AVX2 };
+  for (unsigned k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    if (kernels[k] > best_binning_kernel()) continue;
+    double sum = 0;
+    double begin = doubletime();
+    for (int r = 0; r < REPEATS; r++) {
+      std::vector<DataAccumulator<double> > bins(n_bins);
+      bin_samples(tile, &samples[0], &samples[0] + samples.size(), bins, kernels[k]);
+      sum += checksum(bins);
+    }
+    double secs = doubletime() - begin;
+    tassert_equals(sum, reference_checksum);
+    fprintf(stderr, "%6u bins  %-10s %8.1f Msamples/s  %.2fx\n", n_bins, binning_kernel_name(kernels[k]),
+            msamples / secs, reference_secs / secs);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  // A store tile at full resolution:  65536 samples in one tile, at slightly irregular times
+  TileIndex tile(14, 100000);
+  std::vector<DataSample<double> > samples;
+  srand(1);
+  for (unsigned i = 0; i < 65536; i++) {
+    double t = tile.start_time() + tile.duration() * (i + (rand() % 100) / 200.0) / 65536;
+    samples.push_back(DataSample<double>(t, rand() / 1000.0));
+  }
+  bench(tile, samples, 512);
+  bench(tile, samples, 32768);
+  return 0;
+}
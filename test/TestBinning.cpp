@@ -0,0 +1,102 @@
+// C++
+#include <vector>
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// Local
+#include "utils.h"
+
+// Module to test
+#include "Binning.h"
+
+/// Sorted samples spread across tile, with runs in the same bin, some weights of zero, and some stddevs
+void make_samples(TileIndex tile, unsigned n, std::vector<DataSample<double> > &samples) {
+  srand(1);
+  samples.clear();
+  double t = tile.start_time();
+  for (unsigned i = 0; i < n; i++) {
+    t += tile.duration() / n * (rand() % 100) / 50.0;
+    if (!tile.contains_time(t)) break;
+    DataSample<double> sample(t, (rand() - RAND_MAX / 2) / 1000.0);
+    if (rand() % 10 == 0) sample.weight = 0;
+    if (rand() % 3 == 0) sample.weight = (rand() % 100) / 7.0f;
+    if (rand() % 3 == 0) sample.stddev = (rand() % 100) / 3.0f;
+    samples.push_back(sample);
+  }
+}
+
+/// Bin the way combine_samples and gettile did, one sample at a time
+void reference_bin_samples(TileIndex tile, const std::vector<DataSample<double> > &samples,
+                           std::vector<DataAccumulator<double> > &bins) {
+  for (unsigned i = 0; i < samples.size(); i++) {
+    bins[(unsigned) floor(tile.position(samples[i].time) * bins.size())] += samples[i];
+  }
+}
+
+void assert_identical(const std::vector<DataAccumulator<double> > &a, const std::vector<DataAccumulator<double> > &b) {
+  tassert_equals(a.size(), b.size());
+  for (unsigned i = 0; i < a.size(); i++) {
+    tassert(!memcmp(&a[i], &b[i], sizeof(a[i])));
+  }
+}
+
+void test_kernels_match_reference() {
+  TileIndex tiles[] = { TileIndex(14, 100000), TileIndex(-3, 51259), TileIndex(20, 0) };
+  unsigned sizes[] = { 512, 8192, 32768 };
+  BinningKernel kernels[] = { BINNING_BEST, BINNING_SCALAR, BINNING_SSE2, BINNING_AVX2 };
+  for (unsigned t = 0; t < sizeof(tiles) / sizeof(tiles[0]); t++) {
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      std::vector<DataSample<double> > samples;
+      make_samples(tiles[t], sizes[s] * 3, samples);
+      tassert(samples.size() > sizes[s]);
+      std::vector<DataAccumulator<double> > expected(sizes[s]);
+      reference_bin_samples(tiles[t], samples, expected);
+      // Bin twice, as combine_samples does for its two children, so the second pass adds to filled bins
+      reference_bin_samples(tiles[t], samples, expected);
+      for (unsigned k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        std::vector<DataAccumulator<double> > bins(sizes[s]);
+        bin_samples(tiles[t], &samples[0], &samples[0] + samples.size(), bins, kernels[k]);
+        bin_samples(tiles[t], &samples[0], &samples[0] + samples.size(), bins, kernels[k]);
+        assert_identical(bins, expected);
+      }
+    }
+  }
+}
+
+void test_edges() {
+  TileIndex tile(0, 7);
+  std::vector<DataSample<double> > samples;
+  samples.push_back(DataSample<double>(tile.start_time(), 1));
+  samples.push_back(DataSample<double>(tile.end_time() - 1e-9, 2));
+  std::vector<DataAccumulator<double> > bins(512);
+  bin_samples(tile, &samples[0], &samples[0] + samples.size(), bins);
+  tassert_equals(bins[0].weight, 1);
+  tassert_equals(bins[511].weight, 1);
+  tassert_equals(bins[511].sum, 2);
+
+  // Nothing to bin
+  bin_samples(tile, &samples[0], &samples[0], bins);
+  tassert_equals(bins[0].weight, 1);
+
+  // Text samples are binned one at a time
+  std::vector<DataSample<std::string> > strings;
+  strings.push_back(DataSample<std::string>(tile.start_time(), "a"));
+  strings.push_back(DataSample<std::string>(tile.start_time() + 0.001, "b"));
+  std::vector<DataAccumulator<std::string> > string_bins(2);
+  bin_samples(tile, &strings[0], &strings[0] + strings.size(), string_bins);
+  tassert(string_bins[0].sum == "<multiple>");
+  tassert_equals(string_bins[1].weight, 0);
+}
+
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "Binning kernel: %s\n", binning_kernel_name(BINNING_BEST));
+  test_kernels_match_reference();
+  test_edges();
+
+  // Done
+  fprintf(stderr, "Tests succeeded\n");
+  return 0;
+}
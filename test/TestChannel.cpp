@@ -11,6 +11,7 @@
 
 // Module to test
 #include "Channel.h"
+#include "ChannelWriter.h"
 
 void test_samples_single_tile(Channel &ch, double begin_time, size_t num_samples)
 {
@@ -140,6 +141,582 @@ void test_samples_multiple_tiles(Channel &ch, double begin_time, size_t num_samp
   fprintf(stderr, "test_samples_multiple_tiles(%zd) succeeded\n", num_samples);
 }
 
+/// \return Number of bottom-level tiles holding the channel's samples, for comparing with the tiles a read needs
+int count_bottom_tiles(const Channel &ch)
+{
+  ChannelInfo info;
+  tassert(ch.read_info(info));
+  int ret = 0;
+  for (TileIndex ti = ch.find_first_tile(info, info.times.min, TileIndex::lowest_level()); !ti.is_null();
+       ti = ch.find_next_tile(info, ti, TileIndex::lowest_level())) {
+    ret++;
+  }
+  return ret;
+}
+
+long long tiles_in_range_nsamples;
+
+bool count_samples_callback(const Tile &tile, Range times)
+{
+  for (unsigned i = 0; i < tile.double_samples.size(); i++) {
+    if (times.includes(tile.double_samples[i].time)) tiles_in_range_nsamples++;
+  }
+  return true;
+}
+
+void test_negative_samples(KVS &kvs)
+{
+  fprintf(stderr, "test_negative_samples:\n");
+  Channel ch(kvs, 2, "a.negative");
+  size_t num_samples = 200000;
+  std::vector<DataSample<double> > data(num_samples);
+  for (size_t i = 0; i < num_samples; i++) {
+    data[i] = DataSample<double>(i - 100000.0, i % 10);
+  }
+  // Add negative-only data first, then data spanning zero
+  ch.add_data(std::vector<DataSample<double> >(data.begin(), data.begin() + 1000));
+  DataRanges channel_ranges;
+  ch.add_data(data, &channel_ranges);
+  tassert_equals(channel_ranges.times.min, -100000);
+  tassert_equals(channel_ranges.times.max, 99999);
+
+  ChannelInfo info;
+  tassert(ch.read_info(info));
+  tassert(!info.negative_root_tile_index.is_null());
+  tassert(!info.negative_root_tile_index.is_all());
+  tassert(info.negative_root_tile_index.is_negative());
+  tassert(!info.nonnegative_root_tile_index.is_all());
+  tassert(!info.nonnegative_root_tile_index.is_negative());
+  tassert_equals(info.times.min, -100000);
+  tassert_equals(info.times.max, 99999);
+
+  std::vector<DataSample<double> > read_data;
+  ch.read_data(read_data, -1e10, 1e10);
+  tassert(read_data == data);
+
+  ch.read_data(read_data, -50000, -10);
+  tassert(read_data == std::vector<DataSample<double> >(data.begin() + 50000, data.begin() + 99990));
+
+  ch.read_data(read_data, -5, 5);
+  tassert(read_data == std::vector<DataSample<double> >(data.begin() + 99995, data.begin() + 100005));
+
+  tiles_in_range_nsamples = 0;
+  ch.read_tiles_in_range(Range(-70000, 30000), count_samples_callback, TileIndex::lowest_level());
+  tassert_equals(tiles_in_range_nsamples, 100001);
+
+  // Tile covering [-1024, 0) is under the negative root
+  TileIndex actual_index;
+  Tile tile;
+  tassert(ch.read_tile_or_closest_ancestor(TileIndex(10, -1), actual_index, tile));
+  tassert(actual_index.is_negative());
+  tassert(actual_index == TileIndex(10, -1) || actual_index.is_ancestor_of(TileIndex(10, -1)));
+  tassert(tile.ranges.times.max == -1);
+
+  // Adding data beyond the negative root's range moves that root upwards
+  TileIndex old_root = info.negative_root_tile_index;
+  ch.add_data(std::vector<DataSample<double> >(1, DataSample<double>(-1e7, 5)));
+  tassert(ch.read_info(info));
+  tassert(info.negative_root_tile_index.is_ancestor_of(old_root));
+  tassert(info.negative_root_tile_index.contains_time(-1e7));
+  ch.read_data(read_data, -1e10, -99999);
+  tassert_equals(read_data.size(), 2);
+  tassert_equals(read_data[0].time, -1e7);
+  fprintf(stderr, "test_negative_samples succeeded\n");
+}
+
+void test_delete_range(KVS &kvs)
+{
+  fprintf(stderr, "test_delete_range:\n");
+  Channel ch(kvs, 2, "a.delete");
+  size_t num_samples = 200000;
+  std::vector<DataSample<double> > data(num_samples);
+  for (size_t i = 0; i < num_samples; i++) {
+    data[i] = DataSample<double>(i - 100000.0, i % 10);
+  }
+  ch.add_data(data);
+  std::vector<DataSample<std::string> > strings(1, DataSample<std::string>(50000.5, "comment"));
+  ch.add_data(strings);
+
+  // Delete a range spanning time zero
+  int tiles_read = Channel::total_tiles_read;
+  DataRanges channel_ranges;
+  ch.delete_range(Range(-30000, 60000), &channel_ranges);
+  fprintf(stderr, "  delete_range read %d tiles\n", Channel::total_tiles_read - tiles_read);
+  tassert_equals(channel_ranges.times.min, -100000);
+  tassert_equals(channel_ranges.times.max, 99999);
+
+  std::vector<DataSample<double> > expected(data.begin(), data.begin() + 70000);
+  expected.insert(expected.end(), data.begin() + 160001, data.end());
+  std::vector<DataSample<double> > read_data;
+  ch.read_data(read_data, -1e10, 1e10);
+  tassert(read_data == expected);
+
+  // Parent tiles are regenerated
+  ChannelInfo info;
+  tassert(ch.read_info(info));
+  Tile root;
+  tassert(ch.read_tile(info.nonnegative_root_tile_index, root));
+  double total_weight = 0;
+  for (unsigned i = 0; i < root.double_samples.size(); i++) total_weight += root.double_samples[i].weight;
+  tassert_approx_equals(total_weight, 39999);
+  tassert(root.string_samples.empty());
+  tassert_equals(root.ranges.times.min, 60001);
+
+  // Trim the edges of the channel
+  ch.delete_range(Range(-1e10, -99990), &channel_ranges);
+  tassert_equals(channel_ranges.times.min, -99989);
+  tassert(ch.read_info(info));
+  tassert_equals(info.times.min, -99989);
+
+  // Delete everything, then add data again
+  ch.delete_range(Range::all(), &channel_ranges);
+  tassert(channel_ranges.times.empty());
+  ch.read_data(read_data, -1e10, 1e10);
+  tassert_equals(read_data.size(), 0);
+  tassert(ch.read_tile(info.nonnegative_root_tile_index, root));
+  tassert(!ch.has_tile(info.nonnegative_root_tile_index.left_child()));
+
+  ch.add_data(data);
+  ch.read_data(read_data, -1e10, 1e10);
+  tassert(read_data == data);
+  fprintf(stderr, "test_delete_range succeeded\n");
+}
+
+void test_channel_writer(KVS &kvs)
+{
+  fprintf(stderr, "test_channel_writer:\n");
+  Channel ch(kvs, 2, "a.writer");
+  size_t num_samples = 300000, chunk_size = 1000;
+  std::vector<DataSample<double> > data(num_samples);
+  for (size_t i = 0; i < num_samples; i++) {
+    data[i] = DataSample<double>(i - 50000.0, i % 7);
+  }
+
+  DataRanges channel_ranges;
+  {
+    ChannelWriter writer(ch);
+    for (size_t i = 0; i < num_samples; i += chunk_size) {
+      writer.add_data(std::vector<DataSample<double> >(data.begin() + i, data.begin() + i + chunk_size));
+    }
+    // Samples out of order with respect to earlier chunks are accepted
+    writer.add_data(std::vector<DataSample<std::string> >(1, DataSample<std::string>(10.5, "comment")));
+    writer.commit(&channel_ranges);
+  }
+  tassert_equals(channel_ranges.times.min, -50000);
+  tassert_equals(channel_ranges.times.max, 249999);
+
+  std::vector<DataSample<double> > read_data;
+  ch.read_data(read_data, -1e10, 1e10);
+  tassert(read_data == data);
+
+  ChannelInfo info;
+  tassert(ch.read_info(info));
+  tassert_equals(info.times.min, -50000);
+  tassert_equals(info.times.max, 249999);
+  Tile root;
+  tassert(ch.read_tile(info.nonnegative_root_tile_index, root));
+  double total_weight = 0;
+  for (unsigned i = 0; i < root.double_samples.size(); i++) total_weight += root.double_samples[i].weight;
+  tassert_approx_equals(total_weight, 250000);
+  tassert_equals(root.string_samples.size(), 1);
+
+  // Destroying a writer commits its samples
+  {
+    ChannelWriter writer(ch);
+    writer.add_data(std::vector<DataSample<double> >(1, DataSample<double>(300000, 1)));
+  }
+  tassert(ch.read_info(info));
+  tassert_equals(info.times.max, 300000);
+
+  // Chunks out of order within the buffered tile are sorted rather than written separately;  later samples at the
+  // same time overwrite earlier ones
+  Channel overlapping(kvs, 2, "a.writer_overlapping");
+  int tiles_written = Channel::total_tiles_written;
+  {
+    ChannelWriter writer(overlapping);
+    std::vector<DataSample<double> > chunk;
+    chunk.push_back(DataSample<double>(2, 1));
+    chunk.push_back(DataSample<double>(3, 1));
+    writer.add_data(chunk);
+    chunk.clear();
+    chunk.push_back(DataSample<double>(1, 2));
+    chunk.push_back(DataSample<double>(2, 2));
+    writer.add_data(chunk);
+  }
+  tassert_equals(Channel::total_tiles_written - tiles_written, 1);
+  overlapping.read_data(read_data, 0, 10);
+  tassert_equals(read_data.size(), 3);
+  tassert(read_data[0] == DataSample<double>(1, 2));
+  tassert(read_data[1] == DataSample<double>(2, 2));
+  tassert(read_data[2] == DataSample<double>(3, 1));
+  fprintf(stderr, "test_channel_writer succeeded\n");
+}
+
+void test_tile_write_counts(KVS &kvs)
+{
+  fprintf(stderr, "test_tile_write_counts:\n");
+  Channel ch(kvs, 2, "a.writecount");
+  size_t num_samples = 100000;
+  std::vector<DataSample<double> > data(num_samples);
+  for (size_t i = 0; i < num_samples; i++) data[i] = DataSample<double>(i, i % 10);
+  ch.add_data(data);
+  ChannelInfo info;
+  tassert(ch.read_info(info));
+  TileIndex old_root = info.nonnegative_root_tile_index;
+  tassert(old_root == TileIndex(17, 0));
+
+  // Moving the root up k levels writes the sample's tile, the k-1 other new siblings, and the k new ancestors
+  // once each
+  int tiles_written = Channel::total_tiles_written;
+  ch.add_data(std::vector<DataSample<double> >(1, DataSample<double>(1048576.5, 1)));
+  tassert(ch.read_info(info));
+  tassert(info.nonnegative_root_tile_index == TileIndex(21, 0));
+  int k = info.nonnegative_root_tile_index.level - old_root.level;
+  tassert_equals(Channel::total_tiles_written - tiles_written, 2 * k);
+
+  // Adding to an existing tile writes it and each of its ancestors once
+  TileIndex leaf = ch.find_child_overlapping_time(info.nonnegative_root_tile_index, 99999.5,
+                                                   TileIndex::lowest_level());
+  tiles_written = Channel::total_tiles_written;
+  ch.add_data(std::vector<DataSample<double> >(1, DataSample<double>(99999.5, 1)));
+  tassert_equals(Channel::total_tiles_written - tiles_written,
+                 info.nonnegative_root_tile_index.level - leaf.level + 1);
+
+  std::vector<DataSample<double> > read_data;
+  ch.read_data(read_data, -1e10, 1e10);
+  tassert_equals(read_data.size(), num_samples + 2);
+  Tile root;
+  tassert(ch.read_tile(info.nonnegative_root_tile_index, root));
+  double total_weight = 0;
+  for (unsigned i = 0; i < root.double_samples.size(); i++) total_weight += root.double_samples[i].weight;
+  tassert_approx_equals(total_weight, num_samples + 2);
+  fprintf(stderr, "test_tile_write_counts succeeded\n");
+}
+
+void test_duplicate_policy(KVS &kvs)
+{
+  fprintf(stderr, "test_duplicate_policy:\n");
+  Channel ch(kvs, 2, "a.duplicates");
+  tassert_equals(ch.duplicate_policy(), DUPLICATES_OVERWRITE);
+  ch.set_duplicate_policy(DUPLICATES_SUM);
+  tassert_equals(ch.duplicate_policy(), DUPLICATES_SUM);
+
+  std::vector<DataSample<double> > data;
+  data.push_back(DataSample<double>(1, 1));
+  data.push_back(DataSample<double>(1, 2));
+  data.push_back(DataSample<double>(2, 3));
+  ch.add_data(data);
+  ch.add_data(data);
+  std::vector<DataSample<double> > read_data;
+  ch.read_data(read_data, 0, 10);
+  tassert_equals(read_data.size(), 2);
+  tassert_equals(read_data[0].value, 6);
+  tassert_equals(read_data[1].value, 6);
+
+  // .info files written before the policy was added read as overwrite
+  ChannelInfo info;
+  tassert(ch.read_info(info));
+  std::string legacy_info((char*)&info, (char*)&info.duplicate_policy);
+  kvs.set("2.a.duplicates.info", legacy_info);
+  tassert_equals(ch.duplicate_policy(), DUPLICATES_OVERWRITE);
+  ch.add_data(std::vector<DataSample<double> >(1, DataSample<double>(2, 7)));
+  ch.read_data(read_data, 0, 10);
+  tassert_equals(read_data[1].value, 7);
+
+  // A partly written .info is an error, rather than reading as a legacy one
+  tassert(ch.read_info(info));
+  kvs.set("2.a.duplicates.info", std::string((char*)&info, (char*)&info.creation_id));
+  try {
+    ch.read_info(info);
+    tassert(0);
+  } catch (const std::runtime_error &) {}
+  fprintf(stderr, "test_duplicate_policy succeeded\n");
+}
+
+void test_modification_count(KVS &kvs)
+{
+  fprintf(stderr, "test_modification_count:\n");
+  Channel ch(kvs, 2, "a.modifications");
+  std::vector<DataSample<double> > data;
+  for (int i = 0; i < 100; i++) data.push_back(DataSample<double>(1000 + i, i));
+  ch.add_data(data);
+  ChannelInfo info;
+  tassert(ch.read_info(info));
+  tassert_equals(info.modification_count, 1);
+  tassert(info.modified_since(0, Range(1050, 1060)));
+  tassert(!info.modified_since(0, Range(2000, 3000)));
+  tassert(!info.modified_since(1, Range::all()));
+
+  // Each addition or deletion counts, recording only the times it changed
+  ch.add_data(std::vector<DataSample<double> >(1, DataSample<double>(1200, 1)));
+  ch.delete_range(Range(1010, 1020));
+  tassert(ch.read_info(info));
+  tassert_equals(info.modification_count, 3);
+  tassert(info.modified_since(1, Range(1150, 1250)));
+  tassert(!info.modified_since(1, Range(1030, 1100)));
+  tassert(info.modified_since(2, Range(1015, 1016)));
+  tassert(!info.modified_since(2, Range(1150, 1250)));
+  tassert(info.modified_since(0, Range(1030, 1100)));
+
+  // Setting the duplicate policy changes no samples
+  ch.set_duplicate_policy(DUPLICATES_MAX);
+  tassert(ch.read_info(info));
+  tassert_equals(info.modification_count, 3);
+
+  // Older modifications are forgotten
+  for (int i = 0; i < ChannelInfo::RECENT_MODIFICATIONS; i++) {
+    ch.add_data(std::vector<DataSample<double> >(1, DataSample<double>(5000 + i, 1)));
+  }
+  tassert(ch.read_info(info));
+  tassert(!info.modified_since(3, Range(1000, 1100)));
+  tassert(info.modified_since(2, Range(1000, 1100)));
+  tassert(info.modified_since(info.modification_count + 1, Range(1000, 1100)));
+
+  // Moving the root changes how the samples under the old root are read
+  Channel ch2(kvs, 2, "a.modifications2");
+  data.resize(100000);
+  for (size_t i = 0; i < data.size(); i++) data[i] = DataSample<double>(i, i % 10);
+  ch2.add_data(data);
+  ch2.add_data(std::vector<DataSample<double> >(1, DataSample<double>(1048576.5, 1)));
+  tassert(ch2.read_info(info));
+  tassert(info.modified_since(info.modification_count - 1, Range(10, 20)));
+  tassert(!info.modified_since(info.modification_count - 1, Range(2000000, 3000000)));
+
+  // Each channel gets its own creation id, which modifications keep
+  uint64 creation_id = info.creation_id;
+  tassert(creation_id != 0);
+  tassert(ch.read_info(info));
+  tassert(info.creation_id != 0 && info.creation_id != creation_id);
+  ch2.delete_range(Range(10, 20));
+  tassert(ch2.read_info(info));
+  tassert_equals(info.creation_id, creation_id);
+  fprintf(stderr, "test_modification_count succeeded\n");
+}
+
+void test_read_data_levels(KVS &kvs)
+{
+  fprintf(stderr, "test_read_data_levels:\n");
+  Channel ch(kvs, 2, "a.levels", 100000);
+  std::vector<DataSample<double> > data;
+  for (int i = 0; i < 200000; i++) data.push_back(DataSample<double>(i, i));
+  ch.add_data(data);
+
+  // Summaries 128 seconds apart
+  std::vector<DataSample<double> > read_data;
+  ch.read_data(read_data, 0, 200000, (int)ch.level_from_rate(1.0 / 128));
+  tassert_equals(read_data.size(), 1563);
+  double weight = 0;
+  for (unsigned i = 0; i < read_data.size(); i++) weight += read_data[i].weight;
+  tassert_equals(weight, 200000);
+  tassert_approx_equals(read_data[1].time, 128 + 63.5);
+  tassert_approx_equals(read_data[1].value, 128 + 63.5);
+  tassert_approx_equals(read_data[1].weight, 128);
+
+  // Above the root, the root is summarized
+  ch.read_data(read_data, 0, 200000, 40);
+  tassert_equals(read_data.size(), 1);
+  tassert_approx_equals(read_data[0].value, 99999.5);
+  tassert_equals(read_data[0].weight, 200000);
+
+  // Bins no wider than the samples' spacing return every sample
+  ch.read_data(read_data, 1000, 2000, (int)ch.level_from_rate(1));
+  tassert_equals(read_data.size(), 1000);
+  tassert_equals(read_data[0].time, 1000);
+  tassert_equals(read_data[0].weight, 1);
+  fprintf(stderr, "test_read_data_levels succeeded\n");
+}
+
+void test_read_pyramid(KVS &kvs)
+{
+  fprintf(stderr, "test_read_pyramid:\n");
+  Channel ch(kvs, 2, "a.pyramid", 20000);
+  std::vector<DataSample<double> > data;
+  for (int i = -20000; i < 50000; i++) data.push_back(DataSample<double>(i * 0.5, i));
+  ch.add_data(data);
+
+  std::vector<int> levels;
+  levels.push_back(TileIndex::lowest_level());
+  levels.push_back(5);
+  levels.push_back(10);
+  levels.push_back(40);
+  Range times(-3000, 12000);
+  std::vector<std::vector<Channel::PyramidTile> > tiles;
+  int tiles_read = Channel::total_tiles_read;
+  ch.read_pyramid(times, levels, tiles);
+  tiles_read = Channel::total_tiles_read - tiles_read;
+  tassert_equals(tiles.size(), levels.size());
+
+  // Same tiles as reading each level separately, each read once
+  ChannelInfo info;
+  tassert(ch.read_info(info));
+  int separate_reads = 0;
+  for (unsigned i = 0; i < levels.size(); i++) {
+    unsigned n = 0;
+    for (TileIndex ti = ch.find_first_tile(info, times.min, levels[i]);
+         !ti.is_null() && ti.start_time() < times.max;
+         ti = ch.find_next_tile(info, ti, levels[i]), n++) {
+      tassert(n < tiles[i].size());
+      tassert(tiles[i][n].index == ti);
+      Tile tile;
+      tassert(ch.read_tile(ti, tile));
+      tassert_equals(tiles[i][n].tile->double_samples.size(), tile.double_samples.size());
+      separate_reads++;
+    }
+    tassert_equals(n, tiles[i].size());
+  }
+  tassert(tiles[0].size() > 2);
+  tassert(tiles_read < separate_reads);
+  fprintf(stderr, "test_read_pyramid succeeded\n");
+}
+
+void test_latest(KVS &kvs)
+{
+  fprintf(stderr, "test_latest:\n");
+  Channel ch(kvs, 2, "a.latest", 20000);
+  std::vector<DataSample<double> > doubles, latest;
+  for (int i = 0; i < 10000; i++) doubles.push_back(DataSample<double>(i, i));
+  ch.add_data(doubles);
+  ch.latest(3, latest);
+  tassert_equals(latest.size(), 3);
+  tassert_equals(latest[0].time, 9997);
+  tassert_equals(latest[2].time, 9999);
+
+  // Latest samples span several tiles
+  ch.latest(5000, latest);
+  tassert_equals(latest.size(), 5000);
+  tassert_equals(latest[0].time, 5000);
+  tassert_equals(latest.back().time, 9999);
+
+  // Tiles at the end with only strings, or whose samples were deleted, are skipped
+  std::vector<DataSample<std::string> > strings, latest_strings;
+  for (int i = 0; i < 2000; i++) strings.push_back(DataSample<std::string>(20000 + i, "comment"));
+  ch.add_data(strings);
+  ch.delete_range(Range(9000, 9999));
+  ch.latest(1, latest);
+  tassert_equals(latest.size(), 1);
+  tassert_equals(latest[0].time, 8999);
+  ch.latest(1, latest_strings);
+  tassert_equals(latest_strings.size(), 1);
+  tassert_equals(latest_strings[0].time, 21999);
+
+  // More than the channel has
+  ch.latest(100000, latest);
+  tassert_equals(latest.size(), 9000);
+
+  // Only negative samples
+  Channel negative(kvs, 2, "a.latest_negative");
+  negative.add_data(std::vector<DataSample<double> >(1, DataSample<double>(-5, 1)));
+  negative.latest(1, latest);
+  tassert_equals(latest.size(), 1);
+  tassert_equals(latest[0].time, -5);
+
+  Channel missing(kvs, 2, "a.latest_missing");
+  missing.latest(1, latest);
+  tassert_equals(latest.size(), 0);
+
+  // Subtrees without samples of the type asked for are skipped without reading the tiles beneath them
+  Channel sparse(kvs, 2, "a.latest_sparse", 2000);
+  doubles.clear();
+  for (int i = 0; i < 50000; i++) doubles.push_back(DataSample<double>(i, i));
+  sparse.add_data(doubles);
+  int bottom_tiles = count_bottom_tiles(sparse);
+  int tiles_read = Channel::total_tiles_read;
+  sparse.latest(1, latest_strings);
+  tassert_equals(latest_strings.size(), 0);
+  tassert_equals(Channel::total_tiles_read - tiles_read, 1);
+
+  sparse.add_data(std::vector<DataSample<std::string> >(1, DataSample<std::string>(10, "start")));
+  tiles_read = Channel::total_tiles_read;
+  sparse.latest(1, latest_strings);
+  tiles_read = Channel::total_tiles_read - tiles_read;
+  tassert_equals(latest_strings.size(), 1);
+  tassert_equals(latest_strings[0].time, 10);
+  fprintf(stderr, "  latest string read %d tiles;  channel has %d bottom-level tiles\n", tiles_read, bottom_tiles);
+  tassert(tiles_read * 4 < bottom_tiles);
+  fprintf(stderr, "test_latest succeeded\n");
+}
+
+void test_search(KVS &kvs)
+{
+  fprintf(stderr, "test_search:\n");
+  // A sawtooth between 0 and 99, with rare spikes of 1000 + i
+  Channel ch(kvs, 2, "a.search", 20000);
+  std::vector<DataSample<double> > data, matches;
+  for (int i = 0; i < 100000; i++) data.push_back(DataSample<double>(i, i % 39989 == 5000 ? 1000 + i : i % 100));
+  ch.add_data(data);
+
+  int tiles_read = Channel::total_tiles_read;
+  ch.search(Range::all(), Range(500, 1e308), matches);
+  tiles_read = Channel::total_tiles_read - tiles_read;
+  tassert_equals(matches.size(), 3);
+  for (unsigned i = 0; i < matches.size(); i++) {
+    tassert_equals(matches[i].time, 5000 + 39989 * i);
+    tassert_equals(matches[i].value, 1000 + matches[i].time);
+  }
+  // Only the branches leading to spikes are read
+  int bottom_tiles = count_bottom_tiles(ch);
+  fprintf(stderr, "  search read %d tiles;  channel has %d bottom-level tiles\n", tiles_read, bottom_tiles);
+  tassert(tiles_read * 4 < bottom_tiles);
+
+  // Times and values are inclusive
+  ch.search(Range(20000, 29999), Range(98, 99), matches);
+  tassert_equals(matches.size(), 200);
+  tassert_equals(matches[0].time, 20098);
+  ch.search(Range(40000, 49999), Range(45000, 46000), matches);
+  tassert_equals(matches.size(), 1);
+  tassert_equals(matches[0].value, 1000 + 44989);
+  ch.search(Range::all(), Range(-10, -1), matches);
+  tassert_equals(matches.size(), 0);
+  Channel(kvs, 2, "a.nonexistent").search(Range::all(), Range::all(), matches);
+  tassert_equals(matches.size(), 0);
+  fprintf(stderr, "test_search succeeded\n");
+}
+
+void test_search_text(KVS &kvs)
+{
+  fprintf(stderr, "test_search_text:\n");
+  // Many tiles of routine comments, with a rare keyword
+  Channel ch(kvs, 2, "a.comments", 20000);
+  std::vector<DataSample<std::string> > comments, matches;
+  for (int i = 0; i < 100000; i++) {
+    comments.push_back(DataSample<std::string>(i, i % 33331 == 1000 ? "Felt DIZZY after run" : string_printf("walk %d", i % 50)));
+  }
+  ch.add_data(comments);
+
+  int tiles_read = Channel::total_tiles_read;
+  ch.search(Range::all(), "dizzy", matches);
+  tiles_read = Channel::total_tiles_read - tiles_read;
+  tassert_equals(matches.size(), 3);
+  for (unsigned i = 0; i < matches.size(); i++) tassert_equals(matches[i].time, 1000 + 33331 * i);
+  int bottom_tiles = count_bottom_tiles(ch);
+  fprintf(stderr, "  search read %d tiles;  channel has %d bottom-level tiles\n", tiles_read, bottom_tiles);
+  tassert(tiles_read * 4 < bottom_tiles);
+
+  // Every token must match, as a whole word
+  ch.search(Range(0, 39999), "after dizzy", matches);
+  tassert_equals(matches.size(), 2);
+  ch.search(Range::all(), "dizz", matches);
+  tassert_equals(matches.size(), 0);
+  ch.search(Range(0, 49), "walk 17", matches);
+  tassert_equals(matches.size(), 1);
+  tassert_equals(matches[0].time, 17);
+  ch.search(Range::all(), "dizzy swim", matches);
+  tassert_equals(matches.size(), 0);
+  ch.search(Range::all(), "!!", matches);
+  tassert_equals(matches.size(), 0);
+
+  // Filters are kept up to date as samples are added and deleted
+  ch.delete_range(Range(0, 2000));
+  ch.search(Range::all(), "dizzy", matches);
+  tassert_equals(matches.size(), 2);
+  comments.assign(1, DataSample<std::string>(130000, "dizzy again"));
+  ch.add_data(comments);
+  ch.search(Range(50000, 140000), "DIZZY", matches);
+  tassert_equals(matches.size(), 2);
+  tassert_equals(matches[1].time, 130000);
+  fprintf(stderr, "test_search_text succeeded\n");
+}
+
 void test_add_data_process(std::vector<DataSample<double> > data)
 {
   FilesystemKVS kvs("channelstore_test.kvs");
@@ -325,6 +902,18 @@ int main(int argc, char **argv) {
   test_subsampling_stddev(kvs);
   test_subsampling_string(kvs);
 
+  test_negative_samples(kvs);
+  test_delete_range(kvs);
+  test_channel_writer(kvs);
+  test_tile_write_counts(kvs);
+  test_duplicate_policy(kvs);
+  test_modification_count(kvs);
+  test_read_data_levels(kvs);
+  test_read_pyramid(kvs);
+  test_latest(kvs);
+  test_search(kvs);
+  test_search_text(kvs);
+
   test_subsampling_processs();
 
   fprintf(stderr, "Tests succeeded\n");
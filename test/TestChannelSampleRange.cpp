@@ -0,0 +1,146 @@
+// C++
+#include <algorithm>
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// Local
+#include "Channel.h"
+#include "FilesystemKVS.h"
+#include "utils.h"
+
+// Module to test
+#include "ChannelSampleRange.h"
+
+// Doubles every half second from -5000 to 10000, strings every 10 seconds, in small tiles
+const int NDOUBLES = 30000;
+const int NSTRINGS = 1500;
+
+double double_time(int i) { return -5000 + i * 0.5; }
+double string_time(int i) { return -5000 + i * 10; }
+
+void make_channel(Channel &ch)
+{
+  std::vector<DataSample<double> > doubles;
+  for (int i = 0; i < NDOUBLES; i++) doubles.push_back(DataSample<double>(double_time(i), i));
+  ch.add_data(doubles);
+  std::vector<DataSample<std::string> > strings;
+  for (int i = 0; i < NSTRINGS; i++) strings.push_back(DataSample<std::string>(string_time(i), string_printf("%d", i)));
+  ch.add_data(strings);
+}
+
+/// Is ChannelSampleRange::Position with a double sample?
+bool has_double(const ChannelSampleRange::Position &position) { return position.double_sample != NULL; }
+
+void test_forward(Channel &ch)
+{
+  fprintf(stderr, "test_forward:\n");
+  ChannelSampleRange samples(ch);
+  int n = 0;
+  for (; !samples.done(); samples.advance(), n++) {
+    // Every string time has a double at the same time
+    tassert(samples.double_sample());
+    tassert_equals(samples.time(), double_time(n));
+    tassert_equals(samples.double_sample()->value, n);
+    if (n % 20 == 0) {
+      tassert(samples.string_sample());
+      tassert(samples.string_sample()->value == string_printf("%d", n / 20));
+    } else {
+      tassert(!samples.string_sample());
+    }
+  }
+  tassert_equals(n, NDOUBLES);
+  tassert(samples.time() > 1e308);
+}
+
+void test_reverse(Channel &ch)
+{
+  fprintf(stderr, "test_reverse:\n");
+  ChannelSampleRange samples(ch, Range(-100, 100), TileIndex::lowest_level(), ChannelSampleRange::REVERSE);
+  double t = 100;
+  for (; !samples.done(); samples.advance(), t -= 0.5) {
+    tassert_equals(samples.time(), t);
+    tassert_equals(samples.double_sample()->time, t);
+  }
+  tassert_equals(t, -100.5);
+
+  // Latest sample
+  ChannelSampleRange latest(ch, Range::all(), TileIndex::lowest_level(), ChannelSampleRange::REVERSE);
+  tassert_equals(latest.time(), double_time(NDOUBLES - 1));
+}
+
+void test_range_and_seek(Channel &ch)
+{
+  fprintf(stderr, "test_range_and_seek:\n");
+  // Range is inclusive
+  ChannelSampleRange samples(ch, Range(1000, 2000));
+  tassert_equals(samples.time(), 1000);
+  tassert_equals(std::count_if(samples.begin(), samples.end(), has_double), 2001);
+  tassert(samples.done());
+
+  // Seek backwards and forwards, staying inside the range
+  samples.seek(1500.25);
+  tassert_equals(samples.time(), 1500.5);
+  samples.seek(-3000);
+  tassert_equals(samples.time(), 1000);
+  samples.seek(5000);
+  tassert(samples.done());
+
+  ChannelSampleRange reverse(ch, Range(1000, 2000), TileIndex::lowest_level(), ChannelSampleRange::REVERSE);
+  reverse.seek(1500.25);
+  tassert_equals(reverse.time(), 1500);
+  reverse.seek(999);
+  tassert(reverse.done());
+
+  // Nothing in range
+  ChannelSampleRange none(ch, Range(20000, 30000));
+  tassert(none.done());
+  tassert(none.begin() == none.end());
+}
+
+void test_concurrent_ranges(Channel &ch)
+{
+  fprintf(stderr, "test_concurrent_ranges:\n");
+  // Ranges over the same channel don't disturb each other
+  ChannelSampleRange a(ch), b(ch, Range::all(), TileIndex::lowest_level(), ChannelSampleRange::REVERSE);
+  for (int i = 0; i < NDOUBLES; i++) {
+    tassert_equals(a.time(), double_time(i));
+    tassert_equals(b.time(), double_time(NDOUBLES - 1 - i));
+    a.advance();
+    b.advance();
+  }
+  tassert(a.done() && b.done());
+}
+
+void test_summaries(Channel &ch)
+{
+  fprintf(stderr, "test_summaries:\n");
+  // Summaries hold every sample
+  double weight = 0;
+  int n = 0;
+  for (ChannelSampleRange samples(ch, Range::all(), 20); !samples.done(); samples.advance(), n++) {
+    if (samples.double_sample()) weight += samples.double_sample()->weight;
+  }
+  tassert_equals(weight, NDOUBLES);
+  tassert(n < NDOUBLES / 20);
+}
+
+int main(int argc, char **argv)
+{
+  if (system("rm -rf channelsamplerange_test.kvs && mkdir channelsamplerange_test.kvs")) abort();
+  FilesystemKVS kvs("channelsamplerange_test.kvs");
+  kvs.set_verbosity(0);
+  Channel ch(kvs, 1, "dev.ch", 20000);
+  make_channel(ch);
+
+  test_forward(ch);
+  test_reverse(ch);
+  test_range_and_seek(ch);
+  test_concurrent_ranges(ch);
+  test_summaries(ch);
+
+  // Done
+  fprintf(stderr, "Tests succeeded\n");
+  return 0;
+}
@@ -157,6 +157,42 @@ std::string generate_val(size_t len)
   return ret;
 }
 
+void test_value_cache()
+{
+  fprintf(stderr, "test_value_cache()\n");
+  FilesystemKVS cached("test.kvs"), writer("test.kvs");
+  cached.set_cache_size(1024*1024);
+  std::string val;
+  writer.set("cache.key", "first");
+  tassert(cached.get("cache.key", val));
+  tassert(val == "first");
+  tassert(cached.get("cache.key", val));
+  tassert(val == "first");
+
+  // Writes through another instance, as from another process, are seen
+  writer.set("cache.key", "second value");
+  tassert(cached.get("cache.key", val));
+  tassert(val == "second value");
+  writer.del("cache.key");
+  tassert(!cached.get("cache.key", val));
+
+  // Rewrites that keep the file's size, within one tick of the filesystem's clock, are seen
+  for (int i = 0; i < 1000; i++) {
+    std::string expected = string_printf("%04d", i);
+    writer.set("cache.key", expected);
+    tassert(cached.get("cache.key", val));
+    tassert(val == expected);
+  }
+  writer.del("cache.key");
+
+  // Values too large for the cache are still read
+  std::string largeval = generate_val(512*1024);
+  writer.set("cache.large", largeval);
+  tassert(cached.get("cache.large", val));
+  tassert(val == largeval);
+  writer.del("cache.large");
+}
+
 void sys_check(const char *cmd) {
   if (system(cmd)) {
     fprintf(stderr, "Executing '%s' failed, aborting\n", cmd);
@@ -217,6 +253,7 @@ int main(int argc, char **argv) {
 
     // confirm_all_keys will no longer work since we wrote from multiple processes
   }
+  test_value_cache();
   fprintf(stderr, "Tests succeeded\n");
   return 0;
 };
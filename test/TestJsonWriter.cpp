@@ -0,0 +1,89 @@
+// C
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// JSON
+#include <json/json.h>
+
+// Local
+#include "utils.h"
+
+// Module to test
+#include "JsonWriter.h"
+
+std::string fast_writer_double(double x)
+{
+  return rtrim(Json::FastWriter().write(Json::Value(x)));
+}
+
+std::string json_writer_double(double x)
+{
+  std::string out;
+  JsonWriter::append_double(out, x);
+  return out;
+}
+
+void test_append_double()
+{
+  double values[] = { 0, -0.0, 1, -1, 0.01, 10, 0.5, -0.25, 123456789012345.0, 999999999999999.0, 1e15, -1e15,
+                      1e16, 2e20, 2.01e20, 2e-20, 2.01e-20, -1e308, 1e308, 1309475056, 1309475056.5,
+                      1309475056.123456, 1.0/3, 2.0/3, 100.5, 1e-5, 1e-4, 12345.678, NAN, INFINITY, -INFINITY };
+  for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    if (json_writer_double(values[i]) != fast_writer_double(values[i])) {
+      fprintf(stderr, "%s != %s\n", json_writer_double(values[i]).c_str(), fast_writer_double(values[i]).c_str());
+    }
+    tassert(json_writer_double(values[i]) == fast_writer_double(values[i]));
+  }
+  srandom(1);
+  for (int i = 0; i < 100000; i++) {
+    double x = (random() - RAND_MAX / 2.0) * pow(10.0, (int)(random() % 40) - 20);
+    if (i % 3 == 0) x = floor(x);
+    tassert(json_writer_double(x) == fast_writer_double(x));
+  }
+}
+
+void test_structure()
+{
+  Json::Value expected(Json::objectValue);
+  expected["data"] = Json::Value(Json::arrayValue);
+  Json::Value row(Json::arrayValue);
+  row.append(Json::Value(1309475056.5));
+  row.append(Json::Value(-1e308));
+  row.append(Json::Value(0));
+  row.append(Json::Value());
+  row.append(Json::Value("quote\" and\nnewline"));
+  expected["data"].append(row);
+  expected["data"].append(Json::Value(Json::arrayValue));
+  expected["level"] = Json::Value(-3);
+
+  std::string out;
+  JsonWriter writer(out);
+  writer.begin_object();
+  writer.key("data");
+  writer.begin_array();
+  writer.begin_array();
+  writer.value(1309475056.5);
+  writer.value(-1e308);
+  writer.value(0);
+  writer.null_value();
+  writer.value(std::string("quote\" and\nnewline"));
+  writer.end_array();
+  writer.begin_array();
+  writer.end_array();
+  writer.end_array();
+  writer.key("level");
+  writer.value(-3);
+  writer.end_object();
+  tassert(out == rtrim(Json::FastWriter().write(expected)));
+}
+
+int main(int argc, char **argv)
+{
+  test_append_double();
+  test_structure();
+
+  // Done
+  fprintf(stderr, "Tests succeeded\n");
+  return 0;
+}
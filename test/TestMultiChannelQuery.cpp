@@ -0,0 +1,109 @@
+// C
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Local
+#include "Channel.h"
+#include "FilesystemKVS.h"
+#include "utils.h"
+
+// Module to test
+#include "MultiChannelQuery.h"
+
+void test_bottom_level(KVS &kvs)
+{
+  // Samples every 3 seconds, and every second
+  Channel sparse(kvs, 1, "dev.sparse"), dense(kvs, 1, "dev.dense");
+  std::vector<DataSample<double> > data;
+  for (int i = 0; i < 100; i++) data.push_back(DataSample<double>(0.5 + 3 * i, i));
+  sparse.add_data(data);
+  data.clear();
+  for (int i = 0; i < 300; i++) data.push_back(DataSample<double>(i, 2 * i));
+  dense.add_data(data);
+  std::vector<DataSample<std::string> > comments;
+  comments.push_back(DataSample<std::string>(10, "comment"));
+  Channel(kvs, 1, "dev.comments").add_data(comments);
+
+  std::vector<std::string> names;
+  names.push_back("dev.sparse");
+  names.push_back("dev.dense");
+  names.push_back("dev.missing");
+  names.push_back("dev.comments");
+  // Bins 3 seconds wide, starting at 30
+  MultiChannelQuery query(kvs, 1, names, 30, 150, 40);
+  tassert_equals(query.level(), 1 + 15);
+  tassert_approx_equals(query.bin_start_time(2), 36);
+
+  unsigned bin, nbins = 0;
+  std::vector<DataSample<double> > samples;
+  while (query.next(bin, samples)) {
+    tassert_equals(bin, nbins);
+    tassert_equals(samples.size(), names.size());
+    tassert_approx_equals(samples[0].weight, 1);
+    tassert_approx_equals(samples[0].time, 30.5 + 3 * bin);
+    tassert_approx_equals(samples[0].value, 10 + bin);
+    tassert_approx_equals(samples[1].weight, 3);
+    tassert_approx_equals(samples[1].time, 31 + 3 * bin);
+    tassert_approx_equals(samples[1].value, 2 * (31 + 3 * bin));
+    // Channels without numeric samples
+    tassert_approx_equals(samples[2].weight, 0);
+    tassert_approx_equals(samples[2].time, query.bin_start_time(bin));
+    tassert_approx_equals(samples[3].weight, 0);
+    nbins++;
+  }
+  tassert_equals(nbins, 40);
+  tassert(!query.next(bin, samples));
+}
+
+void test_summary_level(KVS &kvs)
+{
+  // Small tiles, so the channel has summaries
+  Channel ch(kvs, 1, "dev.long", 100000);
+  std::vector<DataSample<double> > data;
+  for (int i = 0; i < 200000; i++) data.push_back(DataSample<double>(i, i));
+  ch.add_data(data);
+
+  std::vector<std::string> names(1, "1.dev.long");
+  // Bins 200 seconds wide are read from summaries of 8-second bins
+  MultiChannelQuery query(kvs, -1, names, 0, 200000, 1000);
+  tassert_equals(query.level(), 7 + 15);
+  unsigned bin;
+  std::vector<DataSample<double> > samples;
+  double weight = 0;
+  while (query.next(bin, samples)) {
+    tassert_approx_equals(samples[0].weight, 200);
+    tassert(fabs(samples[0].value - (200 * bin + 99.5)) < 1e-6 * samples[0].value + 1e-6);
+    weight += samples[0].weight;
+  }
+  tassert_approx_equals(weight, 200000);
+
+  // Bins of 1 second are read from the bottom tiles
+  MultiChannelQuery detail(kvs, -1, names, 1000, 1100, 100);
+  double time = 1000;
+  while (detail.next(bin, samples)) {
+    tassert_approx_equals(samples[0].weight, 1);
+    tassert_approx_equals(samples[0].time, time);
+    tassert_approx_equals(samples[0].value, time);
+    time++;
+  }
+  tassert_approx_equals(time, 1100);
+
+  // Grid past the channel's data
+  MultiChannelQuery after(kvs, -1, names, 300000, 400000, 10);
+  while (after.next(bin, samples)) tassert_approx_equals(samples[0].weight, 0);
+}
+
+int main(int argc, char **argv)
+{
+  if (system("rm -rf multichannelquery_test.kvs && mkdir multichannelquery_test.kvs")) abort();
+  FilesystemKVS kvs("multichannelquery_test.kvs");
+  kvs.set_verbosity(0);
+
+  test_bottom_level(kvs);
+  test_summary_level(kvs);
+
+  // Done
+  fprintf(stderr, "Tests succeeded\n");
+  return 0;
+}
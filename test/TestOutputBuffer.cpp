@@ -0,0 +1,145 @@
+// C++
+#include <string>
+
+// C
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Local
+#include "utils.h"
+
+// Module to test
+#include "OutputBuffer.h"
+
+/// Check format_double against printf("%.*g")
+void check_double(double v, int digits)
+{
+  char dest[FORMAT_DOUBLE_MAX_LENGTH];
+  std::string actual(dest, format_double(dest, v, digits));
+  std::string expected = string_printf("%.*g", digits, v);
+  if (actual != expected) fprintf(stderr, "format_double(%.17g, %d): '%s' != '%s'\n", v, digits, actual.c_str(), expected.c_str());
+  tassert(actual == expected);
+}
+
+/// Check format_fixed against printf("%.*f")
+void check_fixed(double v, int decimals)
+{
+  char dest[FORMAT_DOUBLE_MAX_LENGTH];
+  std::string actual(dest, format_fixed(dest, v, decimals));
+  std::string expected = string_printf("%.*f", decimals, v);
+  if (actual != expected) fprintf(stderr, "format_fixed(%.17g, %d): '%s' != '%s'\n", v, decimals, actual.c_str(), expected.c_str());
+  tassert(actual == expected);
+}
+
+const int DIGITS[] = { 0, 1, 6, 10, 15, 16, 17, 20 };
+const int NDIGITS = sizeof(DIGITS) / sizeof(DIGITS[0]);
+
+void test_format_double()
+{
+  fprintf(stderr, "test_format_double:\n");
+  const double edge_cases[] = {
+    0, -0.0, 1, -1, 0.1, 0.5, 1.5, 2.5, 9.5, 10, 100, 123456, 999999.5, 1e-4, 9.99999e-5, 1e-5, 0.000123456789,
+    1e15, 1e16, 1e17, 999999999999999.9, 9999999999999999.0, 1312320100.90361, 1312320100.5, 1312320100,
+    1.7976931348623157e308, 4.9e-324, 2.2250738585072014e-308, 3.14159265358979, -273.15, 0.3, 1.0 / 3,
+    NAN, INFINITY, -INFINITY
+  };
+  for (unsigned i = 0; i < sizeof(edge_cases) / sizeof(edge_cases[0]); i++) {
+    for (int j = 0; j < NDIGITS; j++) check_double(edge_cases[i], DIGITS[j]);
+  }
+
+  // Random values over many magnitudes, and values with few significant digits, as sensors report
+  srandom(1);
+  for (int i = 0; i < 200000; i++) {
+    double mantissa = (double)random() / RAND_MAX;
+    double v = ldexp(mantissa, (int)(random() % 140) - 70);
+    if (random() % 2) v = -v;
+    double rounded = floor(mantissa * 100000) / pow(10, (int)(random() % 12));
+    double timestamp = 1300000000 + random() % 100000000 + (random() % 1000000) / 1e6;
+    for (int j = 0; j < NDIGITS; j++) {
+      check_double(v, DIGITS[j]);
+      check_double(rounded, DIGITS[j]);
+      check_double(timestamp, DIGITS[j]);
+    }
+  }
+}
+
+void test_format_fixed()
+{
+  fprintf(stderr, "test_format_fixed:\n");
+  const double edge_cases[] = { 0, -0.0, 0.5, 1.5, 2.5, 59.9999995, 9.9999999, 0.0000005, 12.345678, 1e15, 1e16, 1e300, -1e-10 };
+  for (unsigned i = 0; i < sizeof(edge_cases) / sizeof(edge_cases[0]); i++) {
+    for (int decimals = 0; decimals <= 17; decimals++) check_fixed(edge_cases[i], decimals);
+  }
+  // Seconds within a minute, as in ISO-8601 timestamps
+  srandom(2);
+  for (int i = 0; i < 200000; i++) {
+    double seconds = 60.0 * random() / RAND_MAX;
+    check_fixed(seconds, 6);
+    check_fixed(seconds, 3);
+    check_fixed(-seconds * 1000, 2);
+  }
+}
+
+/// Read the whole of a file into a string
+std::string read_all(const char *filename)
+{
+  FILE *in = fopen(filename, "rb");
+  tassert(in);
+  std::string ret;
+  char buf[4096];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), in)) > 0) ret.append(buf, len);
+  fclose(in);
+  return ret;
+}
+
+void test_output_buffer()
+{
+  fprintf(stderr, "test_output_buffer:\n");
+  const char *filename = "output_buffer_test.txt";
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  tassert(fd >= 0);
+  std::string expected;
+  {
+    // Small capacity, so appends fill it many times over
+    OutputBuffer output(fd, 1000);
+    for (int i = 0; i < 10000; i++) {
+      output.append_double(i * 0.25, 15);
+      output.append('\t');
+      output.append_double(i / 7.0, 6, 15);
+      output.append(",");
+      output.append_fixed(i / 3.0, 6);
+      output.append(std::string("\n"));
+      expected += string_printf("%.15g\t%15.6g,%.6f\n", i * 0.25, i / 7.0, i / 3.0);
+    }
+    // Larger than the buffer
+    std::string big(5000, 'x');
+    output.append(big);
+    expected += big;
+    output.append("end\n");
+    expected += "end\n";
+    output.flush();
+    tassert(read_all(filename) == expected);
+
+    // The rest is written on destruction
+    output.append("more\n");
+    expected += "more\n";
+  }
+  close(fd);
+  tassert(read_all(filename) == expected);
+  unlink(filename);
+}
+
+int main(int argc, char **argv)
+{
+  test_format_double();
+  test_format_fixed();
+  test_output_buffer();
+
+  // Done
+  fprintf(stderr, "Tests succeeded\n");
+  return 0;
+}
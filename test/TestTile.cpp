@@ -75,10 +75,147 @@ void test_string_samples()
   tassert_approx_equals(t2.ranges.times.max, 2.22);
 }
 
+void test_delete_samples()
+{
+  Tile t1;
+  std::vector<DataSample<double> > samples;
+  samples.push_back(DataSample<double>(1, 10));
+  samples.push_back(DataSample<double>(2, 20));
+  samples.push_back(DataSample<double>(3, 30));
+  t1.insert_samples(&samples[0], &samples[samples.size()]);
+  std::vector<DataSample<std::string> > strings;
+  strings.push_back(DataSample<std::string>(4, "abc"));
+  t1.insert_samples(&strings[0], &strings[strings.size()]);
+
+  // Deleting with NaN shrinks the ranges
+  std::vector<DataSample<double> > deletions;
+  deletions.push_back(DataSample<double>(1, NAN));
+  t1.insert_samples(&deletions[0], &deletions[deletions.size()]);
+  tassert_equals(t1.double_samples.size(), 2);
+  tassert_equals(t1.ranges.times.min, 2);
+  tassert_equals(t1.ranges.times.max, 4);
+  tassert_equals(t1.ranges.double_samples.min, 20);
+  tassert_equals(t1.ranges.double_samples.max, 30);
+
+  // Deleting a range removes both double and string samples
+  tassert(!t1.delete_samples(Range(5, 6)));
+  tassert(t1.delete_samples(Range(3, 4)));
+  tassert_equals(t1.double_samples.size(), 1);
+  tassert_equals(t1.string_samples.size(), 0);
+  tassert_equals(t1.ranges.times.min, 2);
+  tassert_equals(t1.ranges.times.max, 2);
+  tassert_equals(t1.ranges.double_samples.min, 20);
+  tassert_equals(t1.ranges.double_samples.max, 20);
+
+  tassert(t1.delete_samples(Range::all()));
+  tassert(t1.ranges.times.empty());
+  tassert(t1.ranges.double_samples.empty());
+}
+
+void test_duplicate_policies()
+{
+  std::vector<DataSample<double> > existing, added;
+  existing.push_back(DataSample<double>(1, 10));
+  existing.push_back(DataSample<double>(2, 20));
+  // Collides with an existing sample, then with another added sample
+  added.push_back(DataSample<double>(2, 40));
+  added.push_back(DataSample<double>(3, 30));
+  added.push_back(DataSample<double>(3, 60));
+
+  DuplicatePolicy policies[] = { DUPLICATES_OVERWRITE, DUPLICATES_KEEP_FIRST, DUPLICATES_MEAN, DUPLICATES_SUM, DUPLICATES_MAX };
+  double expected[][2] = { {40, 60}, {20, 30}, {30, 45}, {60, 90}, {40, 60} };
+  for (unsigned i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    Tile t;
+    t.insert_samples(&existing[0], &existing[existing.size()], policies[i]);
+    t.insert_samples(&added[0], &added[added.size()], policies[i]);
+    tassert_equals(t.double_samples.size(), 3);
+    tassert(t.double_samples[0] == DataSample<double>(1, 10));
+    tassert_equals(t.double_samples[1].time, 2);
+    tassert_approx_equals(t.double_samples[1].value, expected[i][0]);
+    tassert_equals(t.double_samples[2].time, 3);
+    tassert_approx_equals(t.double_samples[2].value, expected[i][1]);
+    tassert_approx_equals(t.ranges.double_samples.min, 10);
+    tassert_approx_equals(t.ranges.double_samples.max, expected[i][1]);
+    if (policies[i] == DUPLICATES_MEAN) tassert_approx_equals(t.double_samples[1].weight, 2);
+  }
+
+  // Policies round-trip through their names
+  for (unsigned i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    DuplicatePolicy parsed;
+    tassert(parse_duplicate_policy(duplicate_policy_name(policies[i]), parsed));
+    tassert_equals(parsed, policies[i]);
+  }
+  DuplicatePolicy parsed;
+  tassert(!parse_duplicate_policy("median", parsed));
+
+  // Text keeps the first, or the lexically greatest for max
+  std::vector<DataSample<std::string> > strings;
+  strings.push_back(DataSample<std::string>(1, "b"));
+  strings.push_back(DataSample<std::string>(1, "c"));
+  strings.push_back(DataSample<std::string>(1, "a"));
+  Tile t1, t2;
+  t1.insert_samples(&strings[0], &strings[strings.size()], DUPLICATES_KEEP_FIRST);
+  tassert_equals(t1.string_samples.size(), 1);
+  tassert(t1.string_samples[0].value == "b");
+  t2.insert_samples(&strings[0], &strings[strings.size()], DUPLICATES_MAX);
+  tassert_equals(t2.string_samples.size(), 1);
+  tassert(t2.string_samples[0].value == "c");
+}
+
+void test_token_filter()
+{
+  Tile t1, t2;
+  std::string binary;
+  std::vector<DataSample<std::string> > samples;
+  samples.push_back(DataSample<std::string>(1, "Took 2 Aspirin, felt better"));
+  samples.push_back(DataSample<std::string>(2, "headache"));
+  t1.insert_samples(&samples[0], &samples[samples.size()]);
+  std::vector<std::string> tokens;
+  TokenFilter::tokenize("ASPIRIN felt", tokens);
+  tassert_equals(tokens.size(), 2);
+  tassert(tokens[0] == "aspirin");
+  tassert(t1.token_filter.might_contain_all(tokens));
+  tassert(!t1.token_filter.might_contain("ibuprofen"));
+
+  t1.to_binary(binary);
+  t2.from_binary(binary);
+  tassert(t2.token_filter.bits == t1.token_filter.bits);
+  tassert(t2.token_filter.might_contain("headache"));
+
+  // Recomputed after deletion
+  t2.delete_samples(Range(2, 2));
+  tassert(!t2.token_filter.might_contain("headache"));
+  tassert(t2.token_filter.might_contain("2"));
+
+  // Tiles without strings have no filter bits
+  Tile numeric;
+  std::vector<DataSample<double> > doubles(1, DataSample<double>(1, 1));
+  numeric.insert_samples(&doubles[0], &doubles[1]);
+  tassert(numeric.token_filter.bits.empty());
+  tassert(!numeric.token_filter.might_contain("1"));
+
+  // Tiles with strings written without a filter might contain anything;  those without strings contain nothing
+  Tile old_strings = t1;
+  old_strings.token_filter.clear();
+  old_strings.to_binary(binary);
+  binary.resize(binary.size() - 4);
+  Tile old;
+  old.from_binary(binary);
+  tassert(old.token_filter.might_contain("anything"));
+  numeric.to_binary(binary);
+  binary.resize(binary.size() - 4);
+  old.from_binary(binary);
+  tassert(old.token_filter.bits.empty());
+  tassert(!old.token_filter.might_contain("anything"));
+}
+
 int main(int argc, char **argv)
 {
   test_double_samples();
   test_string_samples();
+  test_delete_samples();
+  test_duplicate_policies();
+  test_token_filter();
   
   // Done
   fprintf(stderr, "Tests succeeded\n");
@@ -0,0 +1,127 @@
+// C
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Local
+#include "utils.h"
+
+// Module to test
+#include "TileCache.h"
+
+void test_lookup()
+{
+  TileCache cache(1024 * 1024);
+  std::vector<uint64> v1(1, 1), v2(2, 2), versions;
+  std::string body;
+  tassert(!cache.lookup("a", versions, body));
+  cache.insert("a", v1, "body a");
+  tassert(cache.lookup("a", versions, body));
+  tassert(versions == v1);
+  tassert(body == "body a");
+
+  // Inserting replaces
+  cache.insert("a", v2, "new body a");
+  tassert(cache.lookup("a", versions, body));
+  tassert(versions == v2);
+  tassert(body == "new body a");
+  tassert_equals(cache.size_bytes(), std::string("a").size() + body.size());
+}
+
+void test_eviction()
+{
+  TileCache cache(400);
+  std::vector<uint64> v(1, 1), versions;
+  std::string body(90, 'x'), found;
+  cache.insert("1", v, body);
+  cache.insert("2", v, body);
+  cache.insert("3", v, body);
+  cache.insert("4", v, body);
+  // Use 1, so 2 is least recently used
+  tassert(cache.lookup("1", versions, found));
+  cache.insert("5", v, body);
+  tassert(cache.size_bytes() <= 400);
+  tassert(cache.lookup("1", versions, found));
+  tassert(!cache.lookup("2", versions, found));
+  tassert(cache.lookup("5", versions, found));
+
+  // Responses larger than a quarter of the cache aren't cached
+  cache.insert("large", v, std::string(101, 'x'));
+  tassert(!cache.lookup("large", versions, found));
+  tassert(cache.lookup("5", versions, found));
+}
+
+void test_directory()
+{
+  if (system("rm -rf test.tilecache")) abort();
+  std::vector<uint64> v, versions;
+  v.push_back(3);
+  v.push_back(18446744073709551615ULL);
+  std::string body("binary\0body\n", 12), found;
+  {
+    TileCache cache(1024 * 1024, "test.tilecache");
+    cache.insert("1|0|2563125|0|0|dev.ch", v, body);
+  }
+
+  // Responses outlive the cache, even one without memory
+  TileCache cache(0, "test.tilecache");
+  tassert(cache.lookup("1|0|2563125|0|0|dev.ch", versions, found));
+  tassert(versions == v);
+  tassert(found == body);
+  tassert(!cache.lookup("1|0|2563126|0|0|dev.ch", versions, found));
+
+  // Removing a response removes its file
+  cache.remove("1|0|2563125|0|0|dev.ch");
+  tassert(!TileCache(0, "test.tilecache").lookup("1|0|2563125|0|0|dev.ch", versions, found));
+  if (system("rm -rf test.tilecache")) abort();
+}
+
+/// Number of files in directory, other than . and ..
+int count_files(const char *directory)
+{
+  DIR *dir = opendir(directory);
+  tassert(dir);
+  int n = 0;
+  while (struct dirent *entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') n++;
+  }
+  closedir(dir);
+  return n;
+}
+
+void test_directory_limit()
+{
+  if (system("rm -rf test.tilecache")) abort();
+  std::vector<uint64> v(1, 1), versions;
+  std::string body(1000, 'x'), found;
+  // Room for 10 responses
+  TileCache cache(0, "test.tilecache", 10500);
+  for (int i = 0; i < 10; i++) cache.insert(string_printf("%d", i), v, body);
+  tassert_equals(count_files("test.tilecache"), 10);
+
+  // Reading 0 makes it the most recently used, so going over the limit removes others, down to three quarters
+  if (system("touch -d @1000000 test.tilecache/*")) abort();
+  tassert(cache.lookup("0", versions, found));
+  cache.insert("10", v, body);
+  tassert_equals(count_files("test.tilecache"), 7);
+  tassert(cache.lookup("0", versions, found));
+  tassert(cache.lookup("10", versions, found));
+
+  // Unreadable files are removed
+  if (system("for file in test.tilecache/*; do echo garbage > $file; done")) abort();
+  tassert(!cache.lookup("0", versions, found));
+  tassert_equals(count_files("test.tilecache"), 6);
+  if (system("rm -rf test.tilecache")) abort();
+}
+
+int main(int argc, char **argv)
+{
+  test_lookup();
+  test_eviction();
+  test_directory();
+  test_directory_limit();
+
+  // Done
+  fprintf(stderr, "Tests succeeded\n");
+  return 0;
+}
@@ -202,6 +202,21 @@ int main(int argc, char **argv)
   tassert(!TileIndex(10,-100).is_ancestor_of(TileIndex( 8, -401)));
   tassert(!TileIndex(10,-100).is_ancestor_of(TileIndex( 8, -402)));
   
+  // Test is_ancestor_of for the roots of the negative and nonnegative trees
+  tassert( TileIndex::nonnegative_all().is_ancestor_of(TileIndex(-20, 2097152000000000LL)));
+  tassert( TileIndex::nonnegative_all().is_ancestor_of(TileIndex( 30, 0)));
+  tassert(!TileIndex::nonnegative_all().is_ancestor_of(TileIndex( 30, -1)));
+  tassert(!TileIndex::nonnegative_all().is_ancestor_of(TileIndex::negative_all()));
+  tassert( TileIndex::negative_all().is_ancestor_of(TileIndex(-20, -2097152000000000LL)));
+  tassert( TileIndex::negative_all().is_ancestor_of(TileIndex( 30, -1)));
+  tassert(!TileIndex::negative_all().is_ancestor_of(TileIndex( 30, 0)));
+  tassert(!TileIndex::negative_all().is_ancestor_of(TileIndex::null()));
+
+  tassert( TileIndex::negative_all().is_negative());
+  tassert(!TileIndex::nonnegative_all().is_negative());
+  tassert( TileIndex(0, -1).is_negative());
+  tassert(!TileIndex(0, 0).is_negative());
+
   // Test index_containing
   test_index_containing(0.0,1.0);
   test_index_containing(-1.0,-0.000001);
@@ -220,6 +235,27 @@ int main(int argc, char **argv)
   test_index_containing(-1309792268, -1309792268+1e+6);
   test_index_containing(-1309792268, -1309792268+1e+9);
 
+  // Durations and positions match pow() and division exactly, including the roots and the null tile
+  int levels[] = { INT_MIN, -1100, -1074, -1023, -1022, -60, -30, -1, 0, 1, 14, 30, 1023, 1024, 2000, INT_MAX };
+  for (unsigned i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+    tassert_equals(TileIndex::level_to_duration(levels[i]), pow(2.0, levels[i]));
+  }
+  for (int level = -10; level <= 40; level++) {
+    TileIndex ti = TileIndex::index_at_level_containing(level, 1309792268.123456);
+    tassert_equals(ti.offset, (long long)floor(1309792268.123456 / pow(2.0, level)));
+    double times[] = { ti.start_time(), 1309792268.123456, nextafter(ti.end_time(), 0) };
+    for (unsigned j = 0; j < sizeof(times) / sizeof(times[0]); j++) {
+      tassert(ti.contains_time(times[j]));
+      tassert_equals(ti.position(times[j]), (times[j] - ti.start_time()) / pow(2.0, level));
+    }
+    tassert(!ti.contains_time(ti.end_time()));
+  }
+  tassert_equals(TileIndex::nonnegative_all().position(1309792268), 0);
+  tassert(TileIndex::nonnegative_all().contains_time(1309792268));
+  tassert(!TileIndex::nonnegative_all().contains_time(-1));
+  tassert(TileIndex::negative_all().contains_time(-1));
+  tassert(!TileIndex::null().contains_time(0));
+
   // Done
   fprintf(stderr, "Tests succeeded\n");
   return 0;
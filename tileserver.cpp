@@ -0,0 +1,719 @@
+// C++
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// C
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// JSON
+#include <json/json.h>
+
+// Local
+#include "Arglist.h"
+#include "Channel.h"
+#include "FilesystemKVS.h"
+#include "GetTile.h"
+#include "Log.h"
+#include "ThreadPool.h"
+#include "utils.h"
+
+void usage(const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  std::string msg = string_vprintf(fmt, args);
+  va_end(args);
+  std::cerr << msg << "\n";
+  std::cerr << "Usage:\n";
+  std::cerr << "tileserver (--socket path | --port N) --store store.kvs [--store store2.kvs ...] [--threads N] [--cache-mb N]\n";
+  std::cerr << "           [--parallel-reads N] [--response-cache-mb N] [--disk-cache] [--disk-cache-mb N] [--prefetch-threads N]\n";
+  std::cerr << "   Serves tiles over HTTP on a Unix socket, or on localhost port N.  Responses are identical to gettile's output:\n";
+  std::cerr << "   GET /tile?store=store.kvs&uid=UID&channel=dev.ch&level=L&offset=O\n";
+  std::cerr << "   GET /tile?store=store.kvs&uid=UID&channels=dev1.ch1,dev2.ch2&level=L&offset=O   (as gettile --multi)\n";
+  std::cerr << "   store may be omitted if only one store is served.  uid may be omitted if channel names start with UID.\n";
+  std::cerr << "   Add format=binary for the binary tile format described in GetTile.h.\n";
+  std::cerr << "   --threads defaults to 8, --cache-mb (memory for cached tiles per store) to 256.\n";
+  std::cerr << "   --parallel-reads (channels read at once for each channels= request) defaults to 8.\n";
+  std::cerr << "   Responses are cached, per store, in --response-cache-mb (default 64;  0 disables caching and\n";
+  std::cerr << "   prefetching), until data within the tile changes.  --disk-cache also caches them in store.kvs.tilecache,\n";
+  std::cerr << "   next to each store, where they outlast the server and are shared with gettile --disk-cache.  Least\n";
+  std::cerr << "   recently used files are removed to keep each directory within --disk-cache-mb (default 1024).\n";
+  std::cerr << "   After each request, the neighboring tiles, parent and children are rendered into the cache in the\n";
+  std::cerr << "   background on --prefetch-threads threads (default 2;  0 disables).  Prefetches not yet started are\n";
+  std::cerr << "   dropped when a newer request for the same channels arrives or their connection closes.\n";
+  std::cerr << "tileserver (--socket path | --port N) --get '/tile?...'\n";
+  std::cerr << "   Sends one request to a running tileserver and prints the response body.\n";
+  throw std::runtime_error("Bad arguments: " + msg);
+}
+
+// Stores being served, by name as given on the command line.  Not modified once serving starts.
+static std::map<std::string, FilesystemKVS*> stores;
+
+// Channels read at once for each multi-channel request
+static int max_parallel_reads = DEFAULT_MAX_PARALLEL_READS;
+
+// Rendered responses, by store name;  empty if caching is disabled
+static std::map<std::string, TileCache*> response_caches;
+
+// Renders tiles near recent requests into response_caches;  NULL if prefetching is disabled
+static ThreadPool *prefetch_pool = NULL;
+
+// Prefetches waiting for prefetch_pool, oldest first (see queue_prefetches)
+struct Prefetch;
+static std::deque<Prefetch*> pending_prefetches;
+// Tasks on prefetch_pool running pending_prefetches;  at most one per thread
+static int prefetch_runners = 0;
+static pthread_mutex_t pending_prefetches_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/// Beyond this many pending prefetches, the oldest are dropped
+static const size_t MAX_PENDING_PREFETCHES = 100;
+
+/// Close keep-alive connections after this many seconds without a request
+static const int IDLE_TIMEOUT = 60;
+
+/// Give up on a client that stops sending partway through a request after this many seconds
+static const int REQUEST_TIMEOUT = 10;
+
+struct Connection {
+  int fd;
+  /// Identifies the connection's prefetches;  never reused, unlike fd
+  unsigned long id;
+  /// Time in msec since which the connection has waited for a request
+  long long idle_since;
+};
+
+// Connections waiting for a request, by file descriptor.  Watched by the accept loop, which hands each to a worker
+// thread once it becomes readable, so idle connections don't hold worker threads.
+static std::map<int, Connection*> idle_connections;
+static pthread_mutex_t idle_connections_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Written to wake the accept loop when a connection is added to idle_connections
+static int wakeup_pipe[2];
+
+/// Requests with headers longer than this are rejected
+static const size_t MAX_REQUEST_HEADER_LENGTH = 65536;
+
+struct BadRequest : public std::runtime_error {
+  BadRequest(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+/// Keys cached in memory by the stores
+static bool is_tile_key(const std::string &key) {
+  return !Channel::is_metainfo_key(key);
+}
+
+static int hex_digit(char c) {
+  if ('0' <= c && c <= '9') return c - '0';
+  if ('a' <= c && c <= 'f') return c - 'a' + 10;
+  if ('A' <= c && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/// Decode %XX escapes and '+' in URL query component
+std::string url_decode(const std::string &encoded) {
+  std::string ret;
+  for (size_t i = 0; i < encoded.length(); i++) {
+    if (encoded[i] == '+') {
+      ret += ' ';
+    } else if (encoded[i] == '%' && i + 2 < encoded.length() &&
+               hex_digit(encoded[i+1]) >= 0 && hex_digit(encoded[i+2]) >= 0) {
+      ret += (char)(hex_digit(encoded[i+1]) * 16 + hex_digit(encoded[i+2]));
+      i += 2;
+    } else {
+      ret += encoded[i];
+    }
+  }
+  return ret;
+}
+
+/// Parse query string of form a=1&b=2 into params
+void parse_query(const std::string &query, std::map<std::string, std::string> &params) {
+  size_t begin = 0;
+  while (begin < query.length()) {
+    size_t end = query.find('&', begin);
+    if (end == std::string::npos) end = query.length();
+    std::string param = query.substr(begin, end - begin);
+    size_t equals = param.find('=');
+    if (equals == std::string::npos) {
+      params[url_decode(param)] = "";
+    } else {
+      params[url_decode(param.substr(0, equals))] = url_decode(param.substr(equals + 1));
+    }
+    begin = end + 1;
+  }
+}
+
+static long long parse_long_long(const std::string &name, const std::string &value) {
+  char *end;
+  long long ret = strtoll(value.c_str(), &end, 10);
+  if (value == "" || *end) throw BadRequest("Can't parse " + name + " '" + value + "' as integer");
+  return ret;
+}
+
+static const std::string &required_param(std::map<std::string, std::string> &params, const std::string &name) {
+  if (!params.count(name)) throw BadRequest("Missing parameter " + name);
+  return params[name];
+}
+
+/// Tile request, parsed from request target
+struct TileRequest {
+  FilesystemKVS *store;
+  std::string store_name;
+  int uid;
+  /// Channels from channels= (multi), or the channel from channel=
+  std::vector<std::string> full_channel_names;
+  bool multi;
+  int level;
+  long long offset;
+  bool binary;
+
+  /// Same request for another tile
+  TileRequest at(int new_level, long long new_offset) const {
+    TileRequest ret = *this;
+    ret.level = new_level;
+    ret.offset = new_offset;
+    return ret;
+  }
+};
+
+/// Parse request target, e.g. /tile?uid=1&channel=dev.ch&level=0&offset=123
+void parse_tile_request(const std::string &target, TileRequest &request) {
+  size_t question = target.find('?');
+  std::string path = target.substr(0, question);
+  if (path != "/tile") throw BadRequest("Unknown path " + path);
+  std::map<std::string, std::string> params;
+  if (question != std::string::npos) parse_query(target.substr(question + 1), params);
+
+  if (params.count("store")) {
+    if (!stores.count(params["store"])) throw BadRequest("Store " + params["store"] + " is not served");
+    request.store_name = params["store"];
+  } else {
+    if (stores.size() != 1) throw BadRequest("Missing parameter store");
+    request.store_name = stores.begin()->first;
+  }
+  request.store = stores[request.store_name];
+  request.uid = params.count("uid") ? (int)parse_long_long("uid", params["uid"]) : -1;
+  request.level = (int)parse_long_long("level", required_param(params, "level"));
+  request.offset = parse_long_long("offset", required_param(params, "offset"));
+  request.binary = false;
+  if (params.count("format")) {
+    if (params["format"] == "binary") {
+      request.binary = true;
+    } else if (params["format"] != "json") {
+      throw BadRequest("Unknown format " + params["format"]);
+    }
+  }
+
+  request.multi = params.count("channels");
+  if (request.multi) {
+    const std::string &channels = params["channels"];
+    size_t begin = 0;
+    while (begin <= channels.length()) {
+      size_t end = channels.find(',', begin);
+      if (end == std::string::npos) end = channels.length();
+      if (end > begin) request.full_channel_names.push_back(channels.substr(begin, end - begin));
+      begin = end + 1;
+    }
+    if (request.full_channel_names.empty()) throw BadRequest("No channels specified");
+  } else {
+    request.full_channel_names.push_back(required_param(params, "channel"));
+  }
+}
+
+/// Render response, from cache if possible
+/// \param cached If non-NULL, returns true if the response came from cache
+std::string render_tile(const TileRequest &request, bool *cached = NULL) {
+  if (response_caches.empty()) {
+    if (cached) *cached = false;
+    return gettile_response(*request.store, request.uid, request.full_channel_names, request.multi, request.binary,
+                            request.level, request.offset, max_parallel_reads);
+  }
+  return cached_gettile_response(*response_caches[request.store_name], *request.store, request.uid,
+                                 request.full_channel_names, request.multi, request.binary, request.level,
+                                 request.offset, max_parallel_reads, cached);
+}
+
+/// Tile to render in the background, for a request on the given connection
+struct Prefetch {
+  TileRequest request;
+  unsigned long connection_id;
+};
+
+/// Prefetches for the same channels of the same user as a request
+struct ForChannels {
+  const TileRequest &request;
+  explicit ForChannels(const TileRequest &request) : request(request) {}
+  bool operator()(const Prefetch &prefetch) const {
+    return prefetch.request.store == request.store && prefetch.request.uid == request.uid &&
+      prefetch.request.multi == request.multi && prefetch.request.full_channel_names == request.full_channel_names;
+  }
+};
+
+/// Prefetches for requests on a connection
+struct OnConnection {
+  unsigned long connection_id;
+  explicit OnConnection(unsigned long connection_id) : connection_id(connection_id) {}
+  bool operator()(const Prefetch &prefetch) const { return prefetch.connection_id == connection_id; }
+};
+
+/// Drop pending prefetches for which cancel returns true.  Call with pending_prefetches_mutex locked.
+template <class Cancel>
+static void cancel_pending_prefetches(Cancel cancel) {
+  std::deque<Prefetch*>::iterator kept = pending_prefetches.begin();
+  for (std::deque<Prefetch*>::iterator i = pending_prefetches.begin(); i != pending_prefetches.end(); ++i) {
+    if (cancel(**i)) {
+      delete *i;
+    } else {
+      *kept++ = *i;
+    }
+  }
+  pending_prefetches.erase(kept, pending_prefetches.end());
+}
+
+/// Render pending prefetches into the response cache until none are left.  Runs on prefetch_pool.
+void run_prefetches(void *) {
+  while (true) {
+    pthread_mutex_lock(&pending_prefetches_mutex);
+    if (pending_prefetches.empty()) {
+      prefetch_runners--;
+      pthread_mutex_unlock(&pending_prefetches_mutex);
+      return;
+    }
+    Prefetch *prefetch = pending_prefetches.front();
+    pending_prefetches.pop_front();
+    pthread_mutex_unlock(&pending_prefetches_mutex);
+    try {
+      render_tile(prefetch->request);
+      log_f("tileserver: prefetched level %d offset %lld", prefetch->request.level, prefetch->request.offset);
+    } catch (const std::exception &e) {
+      log_f("tileserver: prefetch of level %d offset %lld failed: '%s'", prefetch->request.level,
+            prefetch->request.offset, e.what());
+    }
+    delete prefetch;
+  }
+}
+
+/// Queue prefetches of the tiles a client is likely to request next:  the neighbors when panning, then the parent
+/// and children when zooming.  Pending prefetches for older requests of the same channels are dropped, as the client
+/// has moved on from them, and so are the oldest beyond MAX_PENDING_PREFETCHES, so a burst of requests can't build up
+/// a backlog of stale prefetches.
+void queue_prefetches(const TileRequest &request, unsigned long connection_id) {
+  TileRequest nearby[] = {
+    request.at(request.level, request.offset + 1),
+    request.at(request.level, request.offset - 1),
+    request.at(request.level + 1, request.offset >> 1),
+    request.at(request.level - 1, request.offset * 2),
+    request.at(request.level - 1, request.offset * 2 + 1)
+  };
+  pthread_mutex_lock(&pending_prefetches_mutex);
+  cancel_pending_prefetches(ForChannels(request));
+  for (unsigned i = 0; i < sizeof(nearby) / sizeof(nearby[0]); i++) {
+    Prefetch *prefetch = new Prefetch;
+    prefetch->request = nearby[i];
+    prefetch->connection_id = connection_id;
+    pending_prefetches.push_back(prefetch);
+  }
+  while (pending_prefetches.size() > MAX_PENDING_PREFETCHES) {
+    delete pending_prefetches.front();
+    pending_prefetches.pop_front();
+  }
+  bool start_runner = prefetch_runners < prefetch_pool->size();
+  if (start_runner) prefetch_runners++;
+  pthread_mutex_unlock(&pending_prefetches_mutex);
+  if (start_runner) prefetch_pool->add(run_prefetches, NULL);
+}
+
+/// Render response body for request target, e.g. /tile?uid=1&channel=dev.ch&level=0&offset=123
+/// \param connection_id Connection the request arrived on
+/// \param content_type Returns content type of body
+/// \return HTTP status
+int handle_request(unsigned long connection_id, const std::string &target, std::string &body,
+                   std::string &content_type) {
+  content_type = "application/json";
+  try {
+    TileRequest request;
+    parse_tile_request(target, request);
+
+    bool cached;
+    body = render_tile(request, &cached);
+    if (cached) log_f("tileserver: %s was cached", target.c_str());
+    if (prefetch_pool) queue_prefetches(request, connection_id);
+    if (request.binary) content_type = "application/octet-stream";
+    return 200;
+  } catch (const BadRequest &e) {
+    log_f("tileserver: bad request %s: %s", target.c_str(), e.what());
+    Json::Value json_response(Json::objectValue);
+    json_response["failure"] = Json::Value(e.what());
+    body = rtrim(Json::FastWriter().write(json_response)) + "\n";
+    return 400;
+  } catch (const std::exception &e) {
+    log_f("tileserver: caught exception for %s: '%s'", target.c_str(), e.what());
+    Json::Value json_response(Json::objectValue);
+    json_response["failure"] = Json::Value(string_printf("exception: %s", e.what()));
+    body = rtrim(Json::FastWriter().write(json_response)) + "\n";
+    return 500;
+  }
+}
+
+static const char *status_text(int status) {
+  switch (status) {
+  case 200: return "OK";
+  case 400: return "Bad Request";
+  case 405: return "Method Not Allowed";
+  case 431: return "Request Header Fields Too Large";
+  default: return "Internal Server Error";
+  }
+}
+
+static bool write_all(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.length()) {
+    ssize_t ret = write(fd, data.c_str() + written, data.length() - written);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return false;
+    written += ret;
+  }
+  return true;
+}
+
+static std::string lowercase(std::string s) {
+  for (size_t i = 0; i < s.length(); i++) s[i] = tolower(s[i]);
+  return s;
+}
+
+/// Add connection to idle_connections, to be served again once the client sends its next request
+void wait_for_request(Connection *connection) {
+  connection->idle_since = millitime();
+  pthread_mutex_lock(&idle_connections_mutex);
+  idle_connections[connection->fd] = connection;
+  pthread_mutex_unlock(&idle_connections_mutex);
+  char c = 0;
+  while (write(wakeup_pipe[1], &c, 1) < 0 && errno == EINTR) {}
+}
+
+void close_connection(Connection *connection) {
+  // Nobody is left to ask for the tiles prefetched for its requests
+  pthread_mutex_lock(&pending_prefetches_mutex);
+  cancel_pending_prefetches(OnConnection(connection->id));
+  pthread_mutex_unlock(&pending_prefetches_mutex);
+  close(connection->fd);
+  delete connection;
+}
+
+/// Serve HTTP requests on connection, which has data to read, until the client closes it or asks to close it, or has
+/// sent no further request yet.  Runs on a worker thread.
+/// \param arg Connection
+void serve_connection(void *arg) {
+  Connection *connection = (Connection*)arg;
+  int fd = connection->fd;
+  std::string buffer;
+  while (1) {
+    // Read request header
+    size_t header_end;
+    while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos && buffer.length() <= MAX_REQUEST_HEADER_LENGTH) {
+      char chunk[4096];
+      ssize_t ret = read(fd, chunk, sizeof(chunk));
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret <= 0) {
+        close_connection(connection);
+        return;
+      }
+      buffer.append(chunk, ret);
+    }
+    long long begin_time = millitime();
+    int status;
+    std::string body, content_type = "application/json";
+    bool keep_alive = false;
+    if (header_end == std::string::npos) {
+      status = 431;
+    } else {
+      std::string header = buffer.substr(0, header_end);
+      buffer.erase(0, header_end + 4);
+      std::string request_line = header.substr(0, header.find("\r\n"));
+      std::string connection_header;
+      for (size_t line = header.find("\r\n"); line != std::string::npos; line = header.find("\r\n", line + 2)) {
+        std::string field = lowercase(header.substr(line + 2, header.find("\r\n", line + 2) - line - 2));
+        if (field.compare(0, 11, "connection:") == 0) {
+          size_t value_begin = field.find_first_not_of(" \t", 11);
+          connection_header = value_begin == std::string::npos ? "" : rtrim(field.substr(value_begin));
+        }
+      }
+      size_t space1 = request_line.find(' '), space2 = request_line.rfind(' ');
+      std::string method = request_line.substr(0, space1);
+      std::string version = space2 > space1 && space2 != std::string::npos ? request_line.substr(space2 + 1) : "";
+      keep_alive = version == "HTTP/1.1" ? connection_header != "close" : connection_header == "keep-alive";
+      if (space1 == std::string::npos || space2 <= space1) {
+        status = 400;
+        keep_alive = false;
+      } else if (method != "GET") {
+        status = 405;
+      } else {
+        status = handle_request(connection->id, request_line.substr(space1 + 1, space2 - space1 - 1), body, content_type);
+      }
+      log_f("tileserver: %s: status %d, %zd bytes in %lld msec", request_line.c_str(), status, body.length(),
+            millitime() - begin_time);
+    }
+    std::string response = string_printf("HTTP/1.1 %d %s\r\n", status, status_text(status));
+    response += "Content-Type: " + content_type + "\r\n";
+    response += string_printf("Content-Length: %zd\r\n", body.length());
+    if (!keep_alive) response += "Connection: close\r\n";
+    response += "\r\n";
+    response += body;
+    if (!write_all(fd, response) || !keep_alive) {
+      close_connection(connection);
+      return;
+    }
+    // Wait for the next request without holding this thread, unless the client already sent it
+    if (buffer.empty()) {
+      wait_for_request(connection);
+      return;
+    }
+  }
+}
+
+/// Accept connections, and hand connections in idle_connections to pool once they're readable.  Closes connections
+/// idle for longer than IDLE_TIMEOUT.
+void serve(int listen_fd, ThreadPool &pool) {
+  if (pipe(wakeup_pipe) != 0) throw std::runtime_error(string_printf("pipe: %s", strerror(errno)));
+  std::vector<struct pollfd> fds;
+  unsigned long next_connection_id = 0;
+  while (1) {
+    fds.resize(2);
+    fds[0].fd = listen_fd;
+    fds[1].fd = wakeup_pipe[0];
+    pthread_mutex_lock(&idle_connections_mutex);
+    for (std::map<int, Connection*>::iterator i = idle_connections.begin(); i != idle_connections.end(); ++i) {
+      struct pollfd idle;
+      idle.fd = i->first;
+      fds.push_back(idle);
+    }
+    pthread_mutex_unlock(&idle_connections_mutex);
+    for (unsigned i = 0; i < fds.size(); i++) fds[i].events = POLLIN;
+
+    // Wake at least once a second to close idle connections
+    if (poll(&fds[0], fds.size(), 1000) < 0) {
+      if (errno != EINTR) log_f("tileserver: poll: %s", strerror(errno));
+      continue;
+    }
+    if (fds[1].revents) {
+      char drain[256];
+      read(wakeup_pipe[0], drain, sizeof(drain));
+    }
+    if (fds[0].revents) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd < 0) {
+        if (errno != EINTR && errno != ECONNABORTED) log_f("tileserver: accept: %s", strerror(errno));
+      } else {
+        struct timeval timeout;
+        timeout.tv_sec = REQUEST_TIMEOUT;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        Connection *connection = new Connection;
+        connection->fd = fd;
+        connection->id = next_connection_id++;
+        connection->idle_since = millitime();
+        pthread_mutex_lock(&idle_connections_mutex);
+        idle_connections[fd] = connection;
+        pthread_mutex_unlock(&idle_connections_mutex);
+      }
+    }
+
+    // Only this thread removes connections, so each polled connection is still idle
+    long long now = millitime();
+    pthread_mutex_lock(&idle_connections_mutex);
+    for (unsigned i = 2; i < fds.size(); i++) {
+      Connection *connection = idle_connections[fds[i].fd];
+      if (fds[i].revents) {
+        idle_connections.erase(fds[i].fd);
+        pool.add(serve_connection, connection);
+      } else if (now - connection->idle_since > IDLE_TIMEOUT * 1000LL) {
+        idle_connections.erase(fds[i].fd);
+        close_connection(connection);
+      }
+    }
+    pthread_mutex_unlock(&idle_connections_mutex);
+  }
+}
+
+/// Create listening socket, or connect to server
+/// \param socket_path Unix socket path, or "" to use port
+/// \param port Localhost TCP port
+/// \param listening True to listen, false to connect
+int open_socket(const std::string &socket_path, int port, bool listening) {
+  int fd;
+  int ret;
+  if (socket_path != "") {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.length() >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: " + socket_path);
+    strcpy(addr.sun_path, socket_path.c_str());
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("socket");
+    if (listening) {
+      unlink(socket_path.c_str());
+      ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    } else {
+      ret = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+    }
+  } else {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("socket");
+    if (listening) {
+      int reuse = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+      ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    } else {
+      ret = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+    }
+  }
+  if (ret == 0 && listening) ret = listen(fd, 128);
+  if (ret != 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+}
+
+/// Send one request to a running server and print the response body.  Retries connecting for a few seconds, so a
+/// server started in the background has time to start listening.
+/// \return Exit code:  0 if status was 200, 1 otherwise
+int get(const std::string &socket_path, int port, const std::string &target) {
+  int fd = -1;
+  for (int attempt = 0; fd < 0; attempt++) {
+    fd = open_socket(socket_path, port, false);
+    if (fd < 0) {
+      if (attempt == 50) throw std::runtime_error(string_printf("connect: %s", strerror(errno)));
+      usleep(100000);
+    }
+  }
+  if (!write_all(fd, "GET " + target + " HTTP/1.0\r\n\r\n")) throw std::runtime_error("write");
+  std::string response;
+  while (1) {
+    char chunk[65536];
+    ssize_t ret = read(fd, chunk, sizeof(chunk));
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) throw std::runtime_error("read");
+    if (ret == 0) break;
+    response.append(chunk, ret);
+  }
+  close(fd);
+  size_t header_end = response.find("\r\n\r\n");
+  if (header_end == std::string::npos) throw std::runtime_error("Malformed response");
+  fwrite(response.c_str() + header_end + 4, 1, response.length() - header_end - 4, stdout);
+  return response.compare(0, 12, "HTTP/1.1 200") == 0 ? 0 : 1;
+}
+
+int execute(Arglist args) {
+  std::string socket_path;
+  int port = 0;
+  int nthreads = 8;
+  int cache_mb = 256;
+  int response_cache_mb = 64;
+  bool disk_cache = false;
+  int disk_cache_mb = TileCache::DEFAULT_MAX_DISK_BYTES / 1024 / 1024;
+  int prefetch_threads = 2;
+  std::string get_target;
+  std::vector<std::string> store_names;
+
+  while (!args.empty()) {
+    std::string arg = args.shift();
+    if (arg == "--socket") {
+      socket_path = args.shift();
+    } else if (arg == "--port") {
+      port = args.shift_int();
+    } else if (arg == "--threads") {
+      nthreads = args.shift_int();
+      if (nthreads < 1) usage("--threads must be at least 1");
+    } else if (arg == "--cache-mb") {
+      cache_mb = args.shift_int();
+      if (cache_mb < 0) usage("--cache-mb must not be negative");
+    } else if (arg == "--parallel-reads") {
+      max_parallel_reads = args.shift_int();
+      if (max_parallel_reads < 1) usage("--parallel-reads must be at least 1");
+    } else if (arg == "--response-cache-mb") {
+      response_cache_mb = args.shift_int();
+      if (response_cache_mb < 0) usage("--response-cache-mb must not be negative");
+    } else if (arg == "--disk-cache") {
+      disk_cache = true;
+    } else if (arg == "--disk-cache-mb") {
+      disk_cache_mb = args.shift_int();
+      if (disk_cache_mb < 0) usage("--disk-cache-mb must not be negative");
+    } else if (arg == "--prefetch-threads") {
+      prefetch_threads = args.shift_int();
+      if (prefetch_threads < 0) usage("--prefetch-threads must not be negative");
+    } else if (arg == "--store") {
+      store_names.push_back(args.shift());
+    } else if (arg == "--get") {
+      get_target = args.shift();
+    } else {
+      usage("Unknown argument '%s'", arg.c_str());
+    }
+  }
+
+  if ((socket_path == "") == (port == 0)) usage("Specify exactly one of --socket and --port");
+  if (get_target != "") return get(socket_path, port, get_target);
+  if (store_names.empty()) usage("No stores specified");
+
+  // Logs of a long-running server would otherwise grow without bound
+  record_log = false;
+  set_log_prefix(string_printf("%d ", getpid()));
+  signal(SIGPIPE, SIG_IGN);
+
+  for (unsigned i = 0; i < store_names.size(); i++) {
+    FilesystemKVS *store = new FilesystemKVS(store_names[i].c_str());
+    // Metainformation is read on every request to check cached responses, so it's always read from its file
+    store->set_cache_size((size_t)cache_mb * 1024 * 1024, is_tile_key);
+    stores[store_names[i]] = store;
+    if (response_cache_mb > 0) {
+      response_caches[store_names[i]] = new TileCache((size_t)response_cache_mb * 1024 * 1024,
+                                                      disk_cache ? store_names[i] + ".tilecache" : "",
+                                                      (size_t)disk_cache_mb * 1024 * 1024);
+    }
+  }
+
+  if (prefetch_threads > 0 && response_cache_mb > 0) prefetch_pool = new ThreadPool(prefetch_threads);
+
+  int listen_fd = open_socket(socket_path, port, true);
+  if (listen_fd < 0) throw std::runtime_error(string_printf("bind: %s", strerror(errno)));
+  log_f("tileserver START: listening on %s with %d threads",
+        socket_path != "" ? socket_path.c_str() : string_printf("localhost:%d", port).c_str(), nthreads);
+
+  ThreadPool pool(nthreads);
+  serve(listen_fd, pool);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int exit_code = 1;
+  try {
+    exit_code = execute(Arglist(argv + 1, argv + argc));
+  } catch (const std::exception &e) {
+    log_f("tileserver: caught exception '%s'", e.what());
+  }
+  return exit_code;
+}